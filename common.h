@@ -5,10 +5,12 @@
 
 #pragma once
 
+#include <map>
 #include <set>
 #include <string>
 #include <functional>
 #include <QString>
+#include <QStringList>
 #include <QMetaType>
 #include <QDBusArgument>
 #include <QDataStream>
@@ -26,6 +28,13 @@ enum class ResultError : uint8_t
     SUCCESS = 0,
     CAN_NOT_OPEN_FILE = 1,
     SEEK_ERROR = 2,
+    ARCHIVE_LIMIT_EXCEEDED = 3,
+    // results are partial: found before cancellation
+    CANCELLED = 4,
+    // memory budget of the server is exhausted (@see BufferPool)
+    OUT_OF_MEMORY = 5,
+    // size or position of file can't be got
+    FILE_READ_ERROR = 6,
 };
 
 inline const char* asString(const ResultError val)
@@ -38,6 +47,14 @@ inline const char* asString(const ResultError val)
         return "CAN_NOT_OPEN_FILE";
     case ResultError::SEEK_ERROR:
         return "SEEK_ERROR";
+    case ResultError::ARCHIVE_LIMIT_EXCEEDED:
+        return "ARCHIVE_LIMIT_EXCEEDED";
+    case ResultError::CANCELLED:
+        return "CANCELLED";
+    case ResultError::OUT_OF_MEMORY:
+        return "OUT_OF_MEMORY";
+    case ResultError::FILE_READ_ERROR:
+        return "FILE_READ_ERROR";
     }
     return "";
 }
@@ -52,32 +69,73 @@ struct ScannerResults
 {
     ScannerResults()
         : error(ResultError::SUCCESS)
+        , size(0)
     {}
     ScannerResults(ResultError error, std::set<Guid> &&results)
         : error(error)
         , results(results)
+        , size(0)
     {}
     ResultError error;
     std::set<Guid> results;
+    // size of scanned file or bytes, zero if file has not been opened
+    uint64_t size;
 };
 
 Q_DECLARE_METATYPE(ScannerResults)
 
-inline QDBusArgument &operator<<(QDBusArgument &argument, const ScannerResults &val)
-{
-    argument.beginStructure();
-
-    argument << static_cast<uint8_t>(val.error);
+/**
+ * @brief DatabaseResults results split by requested databases: database name to GUIDs
+ * found by its sequences in the same pass.
+ *
+ * It is registered as DBus meta type with its serialize/deserialize.
+ */
+typedef std::map<std::string, std::set<Guid>> DatabaseResults;
 
-    argument << val.results.size();
+Q_DECLARE_METATYPE(DatabaseResults)
 
+/**
+ * @brief packGuids serializes GUIDs for ScannerResults DBus argument.
+ */
+inline QByteArray packGuids(const std::set<Guid> &guids)
+{
     QByteArray byteArray;
     QDataStream dataStream(&byteArray, QIODevice::WriteOnly);
-    for (const auto &guid : val.results)
+    for (const auto &guid : guids)
     {
         dataStream << QString::fromStdString(guid);
     }
-    argument << byteArray;
+    return byteArray;
+}
+
+/**
+ * @brief unpackGuids deserializes up to count GUIDs packed by packGuids.
+ * Stops at the end of data: wrong count can't make it run endlessly.
+ */
+inline void unpackGuids(const QByteArray &byteArray, size_t count, std::set<Guid> &guids)
+{
+    QDataStream dataStream(byteArray);
+    for (size_t i = 0; i < count && !dataStream.atEnd(); i ++)
+    {
+        QString guid;
+        dataStream >> guid;
+        if (dataStream.status() != QDataStream::Ok)
+        {
+            break;
+        }
+        guids.insert(guid.toStdString());
+    }
+}
+
+inline QDBusArgument &operator<<(QDBusArgument &argument, const ScannerResults &val)
+{
+    argument.beginStructure();
+
+    argument << static_cast<uint8_t>(val.error);
+
+    argument << val.results.size();
+    argument << packGuids(val.results);
+    argument << static_cast<quint64>(val.size);
 
     argument.endStructure();
 
@@ -97,15 +155,49 @@ inline const QDBusArgument &operator>>(const QDBusArgument &argument, ScannerRes
 
     QByteArray byteArray;
     argument >> byteArray;
-    QDataStream dataStream(byteArray);
-    for (size_t i = 0; i < size; i ++)
+    unpackGuids(byteArray, size, val.results);
+
+    quint64 scannedSize;
+    argument >> scannedSize;
+    val.size = scannedSize;
+
+    argument.endStructure();
+
+    return argument;
+}
+
+inline QDBusArgument &operator<<(QDBusArgument &argument, const DatabaseResults &val)
+{
+    QStringList names;
+    QList<QByteArray> guids;
+    for (const auto &database : val)
     {
-        QString guid;
-        dataStream >> guid;
-        val.results.insert(guid.toStdString());
+        names << QString::fromStdString(database.first);
+        guids << packGuids(database.second);
     }
 
+    argument.beginStructure();
+    argument << names << guids;
     argument.endStructure();
 
     return argument;
 }
+
+inline const QDBusArgument &operator>>(const QDBusArgument &argument, DatabaseResults &val)
+{
+    QStringList names;
+    QList<QByteArray> guids;
+
+    argument.beginStructure();
+    argument >> names >> guids;
+    argument.endStructure();
+
+    val.clear();
+    for (int i = 0; i < names.size() && i < guids.size(); i ++)
+    {
+        // packed GUIDs end with data
+        unpackGuids(guids.at(i), static_cast<size_t>(-1), val[names.at(i).toStdString()]);
+    }
+
+    return argument;
+}
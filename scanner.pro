@@ -2,8 +2,13 @@ TEMPLATE = subdirs
 CONFIG += ordered
 win32:CONFIG += console
 
-SUBDIRS = scanner_client
+SUBDIRS = scanner_clientlib
+SUBDIRS+= scanner_client
+SUBDIRS+= scanner_cli
 SUBDIRS+= scanner_server
+SUBDIRS+= scanner_replay
 SUBDIRS+= scanner_tests
+SUBDIRS+= scanner_clienttests
+SUBDIRS+= scanner_fuzz
 
 HEADERS += common.h
@@ -0,0 +1,201 @@
+/**
+  * @file main.cpp
+  * @brief headless client: scans files listed in stdin, one path per line.
+  *
+  * Output line per file in order of completion:
+  * "<path>\tOK", "<path>\tINFECTED\t<guid>,<guid>.." or "<path>\tERROR\t<message>".
+  * Results split by databases are printed as "<database>:<guid>,<guid>.." columns instead.
+  * The first SIGINT cancels scanning: running scans print results found before
+  * as "<path>\tCANCELLED[\t<guid>,<guid>..]", the second one terminates.
+  * Exit code is 0 if all files are clean, 1 if infected ones found, 2 on errors.
+  */
+
+#include <scannerclient.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QTimer>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+
+namespace
+{
+// interval of checking interruption in milliseconds
+const int INTERRUPT_CHECK_INTERVAL = 100;
+
+volatile std::sig_atomic_t interrupted = 0;
+
+void onInterrupt(int)
+{
+    interrupted = 1;
+    std::signal(SIGINT, SIG_DFL);
+}
+
+struct Statistics
+{
+    uint64_t scanned = 0;
+    uint64_t infected = 0;
+    uint64_t errors = 0;
+};
+
+void printGuids(const std::set<Guid> &guids)
+{
+    const char *separator = "";
+    for (const auto &val : guids)
+    {
+        std::cout << separator << val;
+        separator = ",";
+    }
+}
+
+void printReply(const ScanReply &reply, bool quiet, Statistics &statistics)
+{
+    statistics.scanned ++;
+    std::string filename = reply.filename.toStdString();
+
+    if (reply.isError())
+    {
+        statistics.errors ++;
+        std::cout << filename << "\tERROR\t" << reply.error.toStdString() << std::endl;
+    }
+    else if (reply.results.error != ResultError::SUCCESS
+             && reply.results.error != ResultError::CANCELLED)
+    {
+        statistics.errors ++;
+        std::cout << filename << "\tERROR\t" << asString(reply.results.error) << std::endl;
+    }
+    else if (!reply.results.results.empty())
+    {
+        // cancelled scans report partial results
+        statistics.infected ++;
+        std::cout << filename << (reply.results.error == ResultError::CANCELLED
+                                  ? "\tCANCELLED\t"
+                                  : "\tINFECTED\t");
+        if (reply.databaseResults.empty())
+        {
+            printGuids(reply.results.results);
+        }
+        const char *separator = "";
+        for (const auto &val : reply.databaseResults)
+        {
+            if (!val.second.empty())
+            {
+                std::cout << separator << val.first << ":";
+                printGuids(val.second);
+                separator = "\t";
+            }
+        }
+        std::cout << std::endl;
+    }
+    else if (reply.results.error == ResultError::CANCELLED)
+    {
+        statistics.errors ++;
+        std::cout << filename << "\tCANCELLED" << std::endl;
+    }
+    else if (!quiet)
+    {
+        std::cout << filename << "\tOK" << std::endl;
+    }
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Scans files listed in standard input, one path per line.");
+    parser.addHelpOption();
+    QCommandLineOption inFlightOption({"j", "in-flight"}, "Number of requests sent simultaneously.",
+                                      "count", QString::number(ScannerClient::DEFAULT_MAX_IN_FLIGHT));
+    QCommandLineOption queueOption("queue", "Number of paths read ahead.",
+                                   "count", QString::number(ScannerClient::DEFAULT_MAX_QUEUED));
+    QCommandLineOption retriesOption("retries", "Resending attempts when the server is gone.",
+                                     "count", QString::number(ScannerClient::DEFAULT_MAX_RETRIES));
+    QCommandLineOption timeoutOption("timeout", "Timeout of single request in milliseconds.",
+                                     "ms", QString::number(ScannerClient::DEFAULT_TIMEOUT));
+    QCommandLineOption quietOption({"q", "quiet"}, "Print infected files and errors only.");
+    QCommandLineOption databaseOption({"d", "database"}, "Comma separated databases of the server, default is all.",
+                                      "names");
+    QCommandLineOption perDatabaseOption("per-database", "Print results of each database.");
+    parser.addOptions({inFlightOption, queueOption, retriesOption, timeoutOption, quietOption, databaseOption,
+                       perDatabaseOption});
+    parser.process(application);
+
+    if (!QDBusConnection::sessionBus().isConnected())
+    {
+        std::cerr << "Cannot connect to D_Bus session" << std::endl;
+        return 2;
+    }
+
+    ScannerClient client;
+    client.setMaxInFlight(parser.value(inFlightOption).toInt());
+    client.setMaxQueued(parser.value(queueOption).toInt());
+    client.setMaxRetries(parser.value(retriesOption).toInt());
+    client.setTimeout(parser.value(timeoutOption).toInt());
+    client.setDatabases(parser.value(databaseOption));
+    client.setSplitByDatabase(parser.isSet(perDatabaseOption));
+    const bool quiet = parser.isSet(quietOption);
+
+    Statistics statistics;
+    QTextStream input(stdin);
+    bool inputFinished = false;
+
+    auto onReply = [&](const ScanReply &reply)
+    {
+        printReply(reply, quiet, statistics);
+    };
+
+    // reads paths while the client accepts them: stdin is not read ahead of scanning
+    auto feed = [&]()
+    {
+        while (!inputFinished && !client.isSaturated())
+        {
+            QString line = input.readLine();
+            if (line.isNull())
+            {
+                inputFinished = true;
+                break;
+            }
+            if (!line.isEmpty())
+            {
+                client.scanFile(line, onReply);
+            }
+        }
+        if (inputFinished && client.pendingCount() == 0)
+        {
+            QCoreApplication::quit();
+        }
+    };
+
+    QObject::connect(&client, &ScannerClient::readyForMore, feed);
+    QObject::connect(&client, &ScannerClient::finished, feed);
+    QTimer::singleShot(0, feed);
+
+    std::signal(SIGINT, onInterrupt);
+    QTimer interruptTimer;
+    QObject::connect(&interruptTimer, &QTimer::timeout, [&]()
+    {
+        if (interrupted && !inputFinished)
+        {
+            std::cerr << "cancelling.." << std::endl;
+            inputFinished = true;
+            client.cancelAll();
+            feed();
+        }
+    });
+    interruptTimer.start(INTERRUPT_CHECK_INTERVAL);
+
+    application.exec();
+
+    std::cerr << "scanned: " << statistics.scanned
+              << ", infected: " << statistics.infected
+              << ", errors: " << statistics.errors << std::endl;
+
+    if (statistics.errors > 0)
+    {
+        return 2;
+    }
+    return statistics.infected > 0 ? 1 : 0;
+}
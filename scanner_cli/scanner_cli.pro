@@ -0,0 +1,18 @@
+QT += core
+QT += dbus
+QT -= gui
+
+TARGET = scanner_cli
+CONFIG += console
+CONFIG += c++11
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp
+
+INCLUDEPATH += ../scanner_clientlib
+
+LIBS += -L$$OUT_PWD/../scanner_clientlib -lscannerclient
+PRE_TARGETDEPS += $$OUT_PWD/../scanner_clientlib/libscannerclient.a
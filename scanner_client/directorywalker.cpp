@@ -0,0 +1,53 @@
+#include <directorywalker.h>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+
+DirectoryWalker::DirectoryWalker(QObject *parent)
+    : QObject(parent)
+    , m_stopped(false)
+{
+}
+
+void DirectoryWalker::start(const QString &root)
+{
+    m_stopped = false;
+    QMetaObject::invokeMethod(this, "walk", Qt::QueuedConnection, Q_ARG(QString, root));
+}
+
+void DirectoryWalker::stop()
+{
+    m_stopped = true;
+}
+
+void DirectoryWalker::walk(const QString &root)
+{
+    int count = 0;
+    QStringList batch;
+    if (QDir(root).exists())
+    {
+        QDirIterator it(root, QDir::Files|QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+        while (it.hasNext() && !m_stopped)
+        {
+            batch.push_back(it.next());
+            if (batch.size() == BATCH_SIZE)
+            {
+                count += batch.size();
+                emit filesFound(batch);
+                batch.clear();
+            }
+        }
+    }
+    else if (QFile(root).exists())
+    {
+        batch.push_back(root);
+    }
+
+    // files found after stop are dropped
+    if (!batch.isEmpty() && !m_stopped)
+    {
+        count += batch.size();
+        emit filesFound(batch);
+    }
+    emit finished(count);
+}
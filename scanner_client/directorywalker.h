@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QObject>
+#include <QStringList>
+#include <atomic>
+
+/**
+ * @brief The DirectoryWalker class lists files of directory tree in its own thread
+ * (@see QObject::moveToThread): GUI is not blocked by huge trees.
+ * Files are emitted by batches while walking, so scanning starts at once.
+ */
+class DirectoryWalker : public QObject
+{
+    Q_OBJECT
+public:
+    static const int BATCH_SIZE = 1000;
+
+    explicit DirectoryWalker(QObject *parent = nullptr);
+
+    /**
+     * @brief start walks root (directory or single file) in the thread of walker.
+     * Called from other thread.
+     */
+    void start(const QString &root);
+
+    /**
+     * @brief stop stops walking, finished is emitted with count of files emitted before.
+     * Called from other thread.
+     */
+    void stop();
+
+signals:
+    void filesFound(const QStringList &files);
+
+    /**
+     * @brief finished is emitted after the last filesFound.
+     * @param count number of files emitted by filesFound.
+     */
+    void finished(int count);
+
+private slots:
+    void walk(const QString &root);
+
+private:
+    std::atomic<bool> m_stopped;
+};
@@ -0,0 +1,62 @@
+#include <resultsmodel.h>
+#include <iterator>
+
+ResultsModel::ResultsModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+int ResultsModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : static_cast<int>(m_rows.size());
+}
+
+QVariant ResultsModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() < 0 || index.row() >= rowCount())
+    {
+        return QVariant();
+    }
+
+    const Row &row = m_rows[static_cast<size_t>(index.row())];
+    switch (role)
+    {
+    case Qt::DisplayRole:
+        return row.text;
+    case Qt::ToolTipRole:
+        return row.details.isEmpty() ? QVariant() : QVariant(row.details.join("\n"));
+    case InfectedRole:
+        return row.infected;
+    default:
+        return QVariant();
+    }
+}
+
+void ResultsModel::append(const QString &text, bool infected, const QStringList &details)
+{
+    m_pending.push_back({text, details, infected});
+}
+
+bool ResultsModel::flush()
+{
+    if (m_pending.empty())
+    {
+        return false;
+    }
+
+    const int first = rowCount();
+    beginInsertRows(QModelIndex(), first, first + static_cast<int>(m_pending.size()) - 1);
+    m_rows.insert(m_rows.end(), std::make_move_iterator(m_pending.begin()),
+                  std::make_move_iterator(m_pending.end()));
+    m_pending.clear();
+    endInsertRows();
+    return true;
+}
+
+void ResultsModel::clear()
+{
+    beginResetModel();
+    m_rows.clear();
+    m_pending.clear();
+    endResetModel();
+}
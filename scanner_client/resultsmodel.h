@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <vector>
+
+/**
+ * @brief The ResultsModel class is list of scan results: row per file.
+ *
+ * Rows are appended to pending ones and inserted by flush: views are updated
+ * once per batch (e.g. by timer) instead of once per file.
+ */
+class ResultsModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    enum Roles
+    {
+        // bool: the file is infected, used by filter of infected files
+        InfectedRole = Qt::UserRole + 1,
+    };
+
+    explicit ResultsModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+
+    /**
+     * @brief data text of row for DisplayRole, its details for ToolTipRole.
+     */
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    /**
+     * @brief append adds pending row: it's shown after flush.
+     */
+    void append(const QString &text, bool infected = false, const QStringList &details = QStringList());
+
+    /**
+     * @brief flush inserts pending rows by one insertion.
+     * @return false if there were no pending rows.
+     */
+    bool flush();
+
+    /**
+     * @brief clear removes all rows including pending ones.
+     */
+    void clear();
+
+private:
+    struct Row
+    {
+        QString text;
+        QStringList details;
+        bool infected;
+    };
+
+    std::vector<Row> m_rows;
+    std::vector<Row> m_pending;
+};
@@ -15,8 +15,17 @@ TEMPLATE = app
 CONFIG += c++11
 
 SOURCES += main.cpp\
+        directorywalker.cpp \
+        resultsmodel.cpp \
         widget.cpp
 
-HEADERS  += widget.h
+HEADERS  += directorywalker.h \
+        resultsmodel.h \
+        widget.h
 
 FORMS    += widget.ui
+
+INCLUDEPATH += ../scanner_clientlib
+
+LIBS += -L$$OUT_PWD/../scanner_clientlib -lscannerclient
+PRE_TARGETDEPS += $$OUT_PWD/../scanner_clientlib/libscannerclient.a
@@ -1,27 +1,42 @@
 #include <widget.h>
 #include <ui_widget.h>
+#include <directorywalker.h>
+#include <resultsmodel.h>
+#include <scannerclient.h>
 #include <QStringList>
 #include <QDir>
+#include <QFile>
 #include <QFileSystemModel>
-#include <QStringListModel>
-#include <QDBusPendingCallWatcher>
-#include <QtDBus/QtDBus>
+#include <QSortFilterProxyModel>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QTimer>
+#include <algorithm>
 
 ScannerMain::ScannerMain(QWidget *parent)
     : QWidget(parent)
     , ui(new Ui::ScannerMain)
     , fileSystemModel(new QFileSystemModel)
-    , resultListModel(new QStringListModel)
+    , resultsModel(new ResultsModel(this))
+    , filterModel(new QSortFilterProxyModel(this))
+    , scannerClient(nullptr)
+    , walker(new DirectoryWalker)
+    , refreshTimer(new QTimer(this))
+    , filesFound(0)
+    , walkFinished(true)
+    , stopped(false)
+    , numberInfectedFiles(0)
+    , numberErrors(0)
+    , replyCounter(0)
+    , totalSizeScanned(0)
     , busy(false)
 {
-    qDBusRegisterMetaType<ScannerResults>();
-
     ui->setupUi(this);
 
     // setup slots
     connect(ui->buttonScan, SIGNAL(clicked(bool)), SLOT(onScanPushed(bool)));
+    connect(ui->buttonStop, SIGNAL(clicked(bool)), SLOT(onStopPushed(bool)));
+    connect(ui->checkInfectedOnly, SIGNAL(toggled(bool)), SLOT(onInfectedOnlyToggled(bool)));
     connect(ui->buttonImportFromFile, SIGNAL(clicked(bool)), SLOT(onImportFromFilePushed(bool)));
     connect(ui->buttonScanBytes, SIGNAL(clicked(bool)), SLOT(onScanBytes(bool)));
 
@@ -40,8 +55,21 @@ ScannerMain::ScannerMain(QWidget *parent)
         ui->treeFiles->setExpanded(fileSystemModel->index(str), true);
     }
 
-    // setup list view for results
-    ui->listResults->setModel(resultListModel);
+    // setup list view for results: rows of equal height are laid out lazily
+    filterModel->setSourceModel(resultsModel);
+    filterModel->setFilterRole(ResultsModel::InfectedRole);
+    ui->listResults->setModel(filterModel);
+    ui->listResults->setUniformItemSizes(true);
+    ui->listResults->setLayoutMode(QListView::Batched);
+
+    refreshTimer->setInterval(REFRESH_INTERVAL);
+    connect(refreshTimer, SIGNAL(timeout()), SLOT(refresh()));
+
+    // files are listed in background thread
+    walker->moveToThread(&walkerThread);
+    connect(walker, SIGNAL(filesFound(QStringList)), SLOT(onFilesFound(QStringList)));
+    connect(walker, SIGNAL(finished(int)), SLOT(onWalkFinished(int)));
+    walkerThread.start();
 
     // setup dbus
     if(!QDBusConnection::sessionBus().isConnected())
@@ -49,18 +77,17 @@ ScannerMain::ScannerMain(QWidget *parent)
         return;
     }
 
-    scannerIface = new QDBusInterface(DBUS_SERVICE_NAME,
-                                      DBUS_PATH,
-                                      DBUS_INTERFACE_NAME,
-                                      QDBusConnection::sessionBus());
+    scannerClient = new ScannerClient(QDBusConnection::sessionBus(), this);
 }
 
 ScannerMain::~ScannerMain()
 {
-    delete scannerIface;
+    walker->stop();
+    walkerThread.quit();
+    walkerThread.wait();
+    delete walker;
     delete ui;
     delete fileSystemModel;
-    delete resultListModel;
 }
 
 void ScannerMain::onScanPushed(bool)
@@ -70,145 +97,154 @@ void ScannerMain::onScanPushed(bool)
         QMessageBox::information(0, "", "The scanner is already busy!");
         return;
     }
+    if (!scannerClient)
+    {
+        QMessageBox::information(0, "", "Cannot connect to D_Bus session");
+        return;
+    }
 
     scanRecursivelly(fileSystemModel->filePath(ui->treeFiles->currentIndex()));
 }
 
-void ScannerMain::scanRecursivelly(const QString &root)
+void ScannerMain::onStopPushed(bool)
 {
-    filesOutput.clear();
-    filesOutput.push_back("initializing..");
-    resultListModel->setStringList(filesOutput);
-
-    allFiles.clear();
-    if (QDir(root).exists())
-    {
-        QDirIterator it(root, QDir::Files|QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
-        while (it.hasNext())
-        {
-            allFiles.push_back(it.next());
-        }
-    }
-    else
+    if (busy && scannerClient)
     {
-        if (QFile(root).exists())
-        {
-            allFiles.push_back(root);
-        }
+        // running scans are replied with results found before cancellation
+        stopped = true;
+        walker->stop();
+        scannerClient->cancelAll();
     }
+}
 
-    if (allFiles.count() > 0)
-    {
-        numberInfectedFiles = 0;
-        startTime.start();
-        filesOutput[0].append(QString(" %1 files to scan..").arg(allFiles.count()));
-        ui->progressBar->setMaximum(allFiles.count());
+void ScannerMain::onInfectedOnlyToggled(bool checked)
+{
+    filterModel->setFilterFixedString(checked ? QVariant(true).toString() : QString());
+}
 
-        if (scannerIface->isValid())
-        {
-            replyCounter = 0;
-            filesOutput.push_back(allFiles[replyCounter]);
-            busy = true;
-            asyncScanFile();
-        }
-    }
-    else
+void ScannerMain::scanRecursivelly(const QString &root)
+{
+    resultsModel->clear();
+    filesFound = 0;
+    walkFinished = false;
+    stopped = false;
+    numberInfectedFiles = 0;
+    numberErrors = 0;
+    replyCounter = 0;
+    totalSizeScanned = 0;
+    busy = true;
+    startTime.start();
+    ui->progressBar->setMaximum(0);
+    ui->progressBar->setValue(0);
+    ui->labelSummary->setText("initializing..");
+
+    walker->start(root);
+    refreshTimer->start();
+}
+
+void ScannerMain::onFilesFound(const QStringList &files)
+{
+    if (stopped)
     {
-        filesOutput[0].append(" nothing to scan..");
+        return;
     }
-
-    resultListModel->setStringList(filesOutput);
+    filesFound += files.size();
+    // requests are pipelined: replies come in order of completion
+    scannerClient->scanFiles(files, [this](const ScanReply &reply)
+    {
+        scanFileFinished(reply);
+    });
 }
 
-void ScannerMain::asyncScanFile()
+void ScannerMain::onWalkFinished(int count)
 {
-    auto reply = scannerIface->asyncCall("scanFile", allFiles[replyCounter]);
-    connect(new QDBusPendingCallWatcher(reply),
-            SIGNAL(finished(QDBusPendingCallWatcher*)),
-            SLOT(scanFileFinished(QDBusPendingCallWatcher*)));
+    walkFinished = true;
+    if (count == 0)
+    {
+        resultsModel->append("nothing to scan..");
+    }
+    checkFinished();
 }
 
-void ScannerMain::scanFileFinished(QDBusPendingCallWatcher *watcher)
+void ScannerMain::scanFileFinished(const ScanReply &reply)
 {
-    if (watcher->isError())
+    replyCounter ++;
+
+    if (reply.isError())
     {
-        filesOutput.push_back("ABORTING because of error:");
-        filesOutput.push_back(watcher->error().message());
-        busy = false;
+        numberErrors ++;
+        resultsModel->append(QString("%1.. error: %2").arg(reply.filename).arg(reply.error));
+    }
+    else if (reply.results.error == ResultError::CANCELLED && reply.results.results.empty())
+    {
+        resultsModel->append(reply.filename + ".. [CANCELLED]");
+    }
+    else if (reply.results.error != ResultError::SUCCESS
+             && reply.results.error != ResultError::CANCELLED)
+    {
+        numberErrors ++;
+        resultsModel->append(QString("%1.. internal error: %2")
+                             .arg(reply.filename)
+                             .arg(asString(reply.results.error)));
+    }
+    else if (reply.results.results.empty())
+    {
+        resultsModel->append(reply.filename + ".. [OK]");
     }
     else
     {
-        replyCounter ++;
-        if (replyCounter > 0)
+        numberInfectedFiles ++;
+        QStringList guids;
+        QStringList details;
+        for (auto &val : reply.results.results)
         {
-            QDBusPendingReply<ScannerResults> error = *watcher;
-            ScannerResults scannerResults = error.value();
-            QString &lastString = filesOutput[filesOutput.size() - 1];
-
-            if (scannerResults.error == ResultError::SUCCESS)
-            {
-                if (scannerResults.results.empty())
-                {
-                    lastString.append(".. [OK]");
-                }
-                else
-                {
-                    numberInfectedFiles ++;
-                    lastString.append(".. [INFECTED!]");
-                    size_t counter = 0;
-                    for (auto &val : scannerResults.results)
-                    {
-                        filesOutput.push_back(QString(">>>> %1. Found sequence with guid = %2")
-                                              .arg(++counter)
-                                              .arg(QString::fromStdString(val)));
-                    }
-                }
-            }
-            else
-            {
-                lastString.append(QString(".. internal error: %1").arg(asString(scannerResults.error)));
-                busy = false;
-            }
+            guids.push_back(QString::fromStdString(val));
+            details.push_back(QString("%1. Found sequence with guid = %2")
+                              .arg(details.size() + 1)
+                              .arg(guids.back()));
         }
+        resultsModel->append(reply.filename + (reply.results.error == ResultError::CANCELLED
+                                               ? ".. [CANCELLED, INFECTED!] "
+                                               : ".. [INFECTED!] ") + guids.join(", "),
+                             true, details);
+    }
+    // size is reported by the server: files are not touched by the client
+    totalSizeScanned += reply.results.size;
 
-        if (replyCounter < allFiles.count())
-        {
-            if (scannerIface->isValid())
-            {
-                asyncScanFile();
-                filesOutput.push_back(allFiles[replyCounter]);
-            }
-            else
-            {
-                filesOutput.push_back("The server has stopped - aborted!..");
-                busy = false;
-            }
-        }
-        else
-        {
-            auto totalSeconds = startTime.elapsed()/1000;
-            int64_t totalSizeScanned = 0;
-            for (auto &val : allFiles)
-            {
-                totalSizeScanned += QFile(val).size();
-            }
-            filesOutput.push_back(QString("*** Scan of %1 files finished!..")
-                                  .arg(allFiles.size()));
-            filesOutput.push_back(QString("*** Number of infected files: %1")
-                                  .arg(numberInfectedFiles));
-            filesOutput.push_back(QString("*** Total size scanned: %1 MB")
-                                  .arg(totalSizeScanned/1024/1024));
-            filesOutput.push_back(QString("*** Elapsed time: %1 sec")
-                                  .arg(totalSeconds));
-            busy = false;
-        }
+    checkFinished();
+}
+
+void ScannerMain::checkFinished()
+{
+    if (busy && walkFinished && replyCounter == filesFound)
+    {
+        busy = false;
+        refreshTimer->stop();
+        refresh();
     }
+}
 
-    watcher->deleteLater();
+void ScannerMain::refresh()
+{
+    if (resultsModel->flush())
+    {
+        ui->listResults->scrollToBottom();
+    }
 
-    resultListModel->setStringList(filesOutput);
-    ui->listResults->scrollToBottom();
+    // maximum is unknown till the end of walking
+    ui->progressBar->setMaximum(walkFinished ? std::max(filesFound, 1) : 0);
     ui->progressBar->setValue(replyCounter);
+
+    auto totalSeconds = startTime.elapsed()/1000;
+    ui->labelSummary->setText(QString("%1%2 of %3%4 files, infected: %5, errors: %6, %7 MB, %8 sec")
+                              .arg(busy ? "" : "*** Scan finished: ")
+                              .arg(replyCounter)
+                              .arg(filesFound)
+                              .arg(walkFinished ? "" : "+")
+                              .arg(numberInfectedFiles)
+                              .arg(numberErrors)
+                              .arg(totalSizeScanned/1024/1024)
+                              .arg(totalSeconds));
 }
 
 void ScannerMain::onImportFromFilePushed(bool)
@@ -238,24 +274,28 @@ void ScannerMain::onScanBytes(bool)
         QMessageBox::information(0, "", "The scanner is already busy!");
         return;
     }
+    if (!scannerClient)
+    {
+        QMessageBox::information(0, "", "Cannot connect to D_Bus session");
+        return;
+    }
     busy = true;
 
-    auto reply = scannerIface->asyncCall("scanBytes", ui->textBytes->toPlainText().toLatin1());
-    connect(new QDBusPendingCallWatcher(reply),
-            SIGNAL(finished(QDBusPendingCallWatcher*)),
-            SLOT(scanBytesFinished(QDBusPendingCallWatcher*)));
+    scannerClient->scanBytes(ui->textBytes->toPlainText().toLatin1(), [this](const ScanReply &reply)
+    {
+        scanBytesFinished(reply);
+    });
 }
 
-void ScannerMain::scanBytesFinished(QDBusPendingCallWatcher *watcher)
+void ScannerMain::scanBytesFinished(const ScanReply &reply)
 {
-    if (watcher->isError())
+    if (reply.isError())
     {
-        ui->labelBytes->setText(QString("Error: ") + watcher->error().message());
+        ui->labelBytes->setText(QString("Error: ") + reply.error);
     }
     else
     {
-        QDBusPendingReply<ScannerResults> error = *watcher;
-        ScannerResults scannerResults = error.value();
+        const ScannerResults &scannerResults = reply.results;
 
         if (scannerResults.error == ResultError::SUCCESS)
         {
@@ -280,6 +320,5 @@ void ScannerMain::scanBytesFinished(QDBusPendingCallWatcher *watcher)
         }
     }
 
-    watcher->deleteLater();
     busy = false;
 }
@@ -2,6 +2,7 @@
 
 #include <QWidget>
 #include <../common.h>
+#include <QThread>
 #include <QTime>
 
 namespace Ui
@@ -9,41 +10,74 @@ namespace Ui
 class ScannerMain;
 }
 
-class QDBusPendingCallWatcher;
 class QFileSystemModel;
-class QStringListModel;
-class QDBusInterface;
+class QSortFilterProxyModel;
+class QTimer;
+class DirectoryWalker;
+class ResultsModel;
+class ScannerClient;
+struct ScanReply;
 
+/**
+ * @brief The ScannerMain class is main window of the client.
+ *
+ * Files of tree are listed by DirectoryWalker in background and sent for scanning
+ * by batches while walking. Replies are appended to ResultsModel, the view, progress
+ * and summary are refreshed by timer: cost of reply doesn't depend on number of results.
+ */
 class ScannerMain : public QWidget
 {
     Q_OBJECT
 public:
+    /**
+     * @brief REFRESH_INTERVAL interval of refreshing results during scan in milliseconds.
+     */
+    static const int REFRESH_INTERVAL = 200;
+
     explicit ScannerMain(QWidget *parent = 0);
     ~ScannerMain();
 
 private:
     Ui::ScannerMain *ui;
     QFileSystemModel *fileSystemModel;
-    QStringListModel *resultListModel;
-    QDBusInterface *scannerIface;
-    QStringList allFiles;
-    QStringList filesOutput;
+    ResultsModel *resultsModel;
+    // filter of infected files
+    QSortFilterProxyModel *filterModel;
+    ScannerClient *scannerClient;
+    DirectoryWalker *walker;
+    QThread walkerThread;
+    QTimer *refreshTimer;
+    int filesFound;
+    bool walkFinished;
+    // files found after stop are not sent
+    bool stopped;
     uint32_t numberInfectedFiles;
+    uint32_t numberErrors;
     QTime startTime;
     int replyCounter;
+    uint64_t totalSizeScanned;
     bool busy;
 
 private slots:
     // files tab
     void onScanPushed(bool);
-    void scanFileFinished(QDBusPendingCallWatcher *watcher);
+    void onStopPushed(bool);
+    void onInfectedOnlyToggled(bool checked);
+    void onFilesFound(const QStringList &files);
+    void onWalkFinished(int count);
+    void refresh();
 
     // bytes tab
     void onImportFromFilePushed(bool);
     void onScanBytes(bool);
-    void scanBytesFinished(QDBusPendingCallWatcher *watcher);
 
 private:
-    void asyncScanFile();
     void scanRecursivelly(const QString &root);
+    void scanFileFinished(const ScanReply &reply);
+    void scanBytesFinished(const ScanReply &reply);
+
+    /**
+     * @brief checkFinished finishes scan when all found files are replied.
+     */
+    void checkFinished();
 };
@@ -0,0 +1,15 @@
+QT += core
+QT += dbus
+QT -= gui
+
+TARGET = scannerclient
+CONFIG += c++11
+CONFIG += staticlib
+
+TEMPLATE = lib
+
+SOURCES += \
+    scannerclient.cpp
+
+HEADERS += \
+    scannerclient.h
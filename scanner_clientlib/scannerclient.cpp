@@ -0,0 +1,332 @@
+#include <scannerclient.h>
+#include <QTimer>
+#include <QtDBus/QtDBus>
+#include <algorithm>
+
+namespace
+{
+/**
+ * @brief isServerGone errors after which request is worth resending.
+ * NoReply is not: the server may be just slow and still scanning the request.
+ */
+bool isServerGone(QDBusError::ErrorType type)
+{
+    switch (type)
+    {
+    case QDBusError::ServiceUnknown:
+    case QDBusError::NoServer:
+    case QDBusError::Disconnected:
+        return true;
+    default:
+        return false;
+    }
+}
+}
+
+ScannerClient::ScannerClient(const QDBusConnection &connection, QObject *parent)
+    : QObject(parent)
+    , m_connection(connection)
+    , m_retryTimer(new QTimer(this))
+    , m_lastJobId(0)
+    , m_inFlight(0)
+    , m_maxInFlight(DEFAULT_MAX_IN_FLIGHT)
+    , m_maxQueued(DEFAULT_MAX_QUEUED)
+    , m_maxRetries(DEFAULT_MAX_RETRIES)
+    , m_timeout(DEFAULT_TIMEOUT)
+    , m_splitByDatabase(false)
+    , m_paused(false)
+{
+    qDBusRegisterMetaType<ScannerResults>();
+    qDBusRegisterMetaType<DatabaseResults>();
+
+    m_retryTimer->setSingleShot(true);
+    m_retryTimer->setInterval(RETRY_INTERVAL);
+    connect(m_retryTimer, SIGNAL(timeout()), SLOT(onRetryTimeout()));
+
+    auto serviceWatcher = new QDBusServiceWatcher(DBUS_SERVICE_NAME, m_connection,
+                                                  QDBusServiceWatcher::WatchForRegistration
+                                                  | QDBusServiceWatcher::WatchForUnregistration,
+                                                  this);
+    connect(serviceWatcher, SIGNAL(serviceRegistered(QString)), SLOT(onServiceRegistered()));
+    connect(serviceWatcher, SIGNAL(serviceUnregistered(QString)), SLOT(onServiceUnregistered()));
+
+    m_connection.connect(DBUS_SERVICE_NAME, DBUS_PATH, DBUS_INTERFACE_NAME, "progress",
+                         this, SLOT(onProgress(quint64,quint64,quint64)));
+}
+
+void ScannerClient::setMaxInFlight(int count)
+{
+    m_maxInFlight = std::max(count, 1);
+    dispatch();
+}
+
+void ScannerClient::setMaxQueued(int count)
+{
+    m_maxQueued = std::max(count, 1);
+}
+
+void ScannerClient::setMaxRetries(int count)
+{
+    m_maxRetries = std::max(count, 0);
+}
+
+void ScannerClient::setTimeout(int timeout)
+{
+    m_timeout = timeout;
+}
+
+void ScannerClient::setDatabases(const QString &databases)
+{
+    m_databases = databases;
+}
+
+void ScannerClient::setSplitByDatabase(bool split)
+{
+    m_splitByDatabase = split;
+}
+
+quint64 ScannerClient::scanFile(const QString &filename, cb_reply onReply, cb_job_progress onProgress)
+{
+    quint64 jobId = ++m_lastJobId;
+    enqueue({"scanFileJob", filename, QByteArray(), onReply, 0, jobId, onProgress, m_databases,
+             m_splitByDatabase});
+    return jobId;
+}
+
+void ScannerClient::scanBytes(const QByteArray &bytes, cb_reply onReply)
+{
+    enqueue({"scanBytes", QString(), bytes, onReply, 0, 0, cb_job_progress(), m_databases,
+             m_splitByDatabase});
+}
+
+void ScannerClient::scanFiles(const QStringList &filenames, cb_reply onReply)
+{
+    for (const auto &val : filenames)
+    {
+        m_queue.push_back({"scanFileJob", val, QByteArray(), onReply, 0, ++m_lastJobId, cb_job_progress(),
+                           m_databases, m_splitByDatabase});
+    }
+    dispatch();
+}
+
+void ScannerClient::cancel(quint64 jobId)
+{
+    auto it = std::find_if(m_queue.begin(), m_queue.end(), [jobId](const Request &request)
+    {
+        return request.jobId == jobId;
+    });
+    if (it != m_queue.end())
+    {
+        Request request = std::move(*it);
+        m_queue.erase(it);
+        complete(request, cancelledReply(request));
+    }
+    else if (m_jobsInFlight.count(jobId) > 0)
+    {
+        sendCancel(jobId);
+    }
+}
+
+void ScannerClient::cancelAll()
+{
+    std::deque<Request> cancelled;
+    for (auto it = m_queue.begin(); it != m_queue.end();)
+    {
+        if (it->jobId != 0)
+        {
+            cancelled.push_back(std::move(*it));
+            it = m_queue.erase(it);
+        }
+        else
+        {
+            it ++;
+        }
+    }
+
+    for (const auto &val : m_jobsInFlight)
+    {
+        sendCancel(val.first);
+    }
+
+    for (const auto &val : cancelled)
+    {
+        complete(val, cancelledReply(val));
+    }
+}
+
+bool ScannerClient::isSaturated() const
+{
+    return static_cast<int>(m_queue.size()) >= m_maxQueued;
+}
+
+int ScannerClient::pendingCount() const
+{
+    return static_cast<int>(m_queue.size()) + m_inFlight;
+}
+
+void ScannerClient::onServiceRegistered()
+{
+    // the server has (re)started: resend failed requests at once
+    m_retryTimer->stop();
+    m_paused = false;
+    dispatch();
+}
+
+void ScannerClient::onServiceUnregistered()
+{
+    pause();
+}
+
+void ScannerClient::onProgress(quint64 jobId, quint64 bytesDone, quint64 bytesTotal)
+{
+    auto it = m_jobsInFlight.find(jobId);
+    if (it != m_jobsInFlight.end() && it->second)
+    {
+        it->second(bytesDone, bytesTotal);
+    }
+}
+
+void ScannerClient::onRetryTimeout()
+{
+    // the server may be started without registration signal received (e.g. before
+    // connection), so sending is tried again: failed requests spend their attempts
+    m_paused = false;
+    dispatch();
+}
+
+void ScannerClient::enqueue(Request &&request)
+{
+    m_queue.push_back(std::move(request));
+    dispatch();
+}
+
+void ScannerClient::dispatch()
+{
+    while (!m_paused && m_inFlight < m_maxInFlight && !m_queue.empty())
+    {
+        Request request = std::move(m_queue.front());
+        m_queue.pop_front();
+        send(request);
+    }
+}
+
+void ScannerClient::send(const Request &request)
+{
+    // methods with "In" suffix take databases as the first argument,
+    // ones with "PerDatabase" suffix take them always
+    QString method = request.method;
+    if (request.splitByDatabase)
+    {
+        method += "PerDatabase";
+    }
+    else if (!request.databases.isEmpty())
+    {
+        method += "In";
+    }
+    QDBusMessage message = QDBusMessage::createMethodCall(DBUS_SERVICE_NAME,
+                                                          DBUS_PATH,
+                                                          DBUS_INTERFACE_NAME,
+                                                          method);
+    if (request.splitByDatabase || !request.databases.isEmpty())
+    {
+        message << request.databases;
+    }
+    if (request.method == "scanBytes")
+    {
+        message << request.bytes;
+    }
+    else
+    {
+        message << request.filename << request.jobId;
+        m_jobsInFlight[request.jobId] = request.onProgress;
+    }
+
+    m_inFlight ++;
+    auto watcher = new QDBusPendingCallWatcher(m_connection.asyncCall(message, m_timeout), this);
+    connect(watcher, &QDBusPendingCallWatcher::finished, this,
+            [this, request](QDBusPendingCallWatcher *watcher)
+    {
+        onReplied(watcher, request);
+    });
+}
+
+void ScannerClient::onReplied(QDBusPendingCallWatcher *watcher, Request request)
+{
+    m_inFlight --;
+    m_jobsInFlight.erase(request.jobId);
+    watcher->deleteLater();
+
+    QDBusPendingReply<ScannerResults> reply = *watcher;
+    if (reply.isError() && isServerGone(reply.error().type()) && request.attempts < m_maxRetries)
+    {
+        // keep order of requests: resend it first
+        request.attempts ++;
+        m_queue.push_front(std::move(request));
+        pause();
+        return;
+    }
+
+    ScanReply scanReply;
+    scanReply.filename = request.filename;
+    if (reply.isError())
+    {
+        scanReply.error = reply.error().message();
+    }
+    else
+    {
+        scanReply.results = reply.value();
+        if (request.splitByDatabase)
+        {
+            QDBusPendingReply<ScannerResults, DatabaseResults> splitReply = *watcher;
+            scanReply.databaseResults = splitReply.argumentAt<1>();
+        }
+    }
+
+    dispatch();
+    complete(request, scanReply);
+}
+
+void ScannerClient::complete(const Request &request, const ScanReply &reply)
+{
+    if (request.onReply)
+    {
+        request.onReply(reply);
+    }
+
+    if (pendingCount() == 0)
+    {
+        emit finished();
+    }
+    else if (!isSaturated())
+    {
+        emit readyForMore();
+    }
+}
+
+void ScannerClient::pause()
+{
+    m_paused = true;
+    if (!m_retryTimer->isActive())
+    {
+        m_retryTimer->start();
+    }
+}
+
+void ScannerClient::sendCancel(quint64 jobId)
+{
+    // reply is not needed: cancelled job is replied by its scanFileJob call
+    QDBusMessage message = QDBusMessage::createMethodCall(DBUS_SERVICE_NAME,
+                                                          DBUS_PATH,
+                                                          DBUS_INTERFACE_NAME,
+                                                          "cancel");
+    message << jobId;
+    m_connection.asyncCall(message);
+}
+
+ScanReply ScannerClient::cancelledReply(const Request &request)
+{
+    ScanReply reply;
+    reply.filename = request.filename;
+    reply.results.error = ResultError::CANCELLED;
+    return reply;
+}
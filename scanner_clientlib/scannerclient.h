@@ -0,0 +1,182 @@
+#pragma once
+
+#include <../common.h>
+#include <QObject>
+#include <QByteArray>
+#include <QStringList>
+#include <QtDBus/QDBusConnection>
+#include <deque>
+#include <map>
+
+class QDBusPendingCallWatcher;
+class QTimer;
+
+/**
+ * @brief The ScanReply struct is passed to callbacks of ScannerClient.
+ */
+struct ScanReply
+{
+    bool isError() const
+    {
+        return !error.isEmpty();
+    }
+
+    // scanned file name, empty for scanned bytes
+    QString filename;
+    ScannerResults results;
+    // GUIDs found by each requested database, filled if split by databases
+    DatabaseResults databaseResults;
+    // D-Bus error message, empty if the server has replied
+    QString error;
+};
+
+typedef std::function<void(const ScanReply &reply)> cb_reply;
+
+/**
+ * @brief cb_job_progress is called with scanned and total bytes counts of file.
+ */
+typedef std::function<void(quint64 bytesDone, quint64 bytesTotal)> cb_job_progress;
+
+/**
+ * @brief The ScannerClient class is asynchronous client of the scanner server.
+ *
+ * All requests are pipelined through one D-Bus connection: up to maxInFlight
+ * requests are sent without waiting for replies, the others wait in the client queue.
+ * Producers should stop submitting while isSaturated() and continue on readyForMore().
+ *
+ * Requests failed because the server has gone are resent (up to maxRetries times)
+ * when the server is registered again or after RETRY_INTERVAL. Timed out requests
+ * are replied with error, not resent: the server may still be scanning them.
+ *
+ * File scans are jobs: they may be cancelled (partial results are replied
+ * with CANCELLED error) and report throttled progress.
+ *
+ * Callbacks are called in the thread of the client in order of completion.
+ */
+class ScannerClient : public QObject
+{
+    Q_OBJECT
+public:
+    static const int DEFAULT_MAX_IN_FLIGHT = 4;
+    static const int DEFAULT_MAX_QUEUED = 256;
+    static const int DEFAULT_MAX_RETRIES = 3;
+    // milliseconds: large files are scanned with low priority and may wait long
+    static const int DEFAULT_TIMEOUT = 10*60*1000;
+    static const int RETRY_INTERVAL = 1000;
+
+    explicit ScannerClient(const QDBusConnection &connection = QDBusConnection::sessionBus(),
+                           QObject *parent = nullptr);
+
+    void setMaxInFlight(int count);
+    void setMaxQueued(int count);
+    void setMaxRetries(int count);
+
+    /**
+     * @param timeout of single request in milliseconds, -1 is D-Bus default.
+     */
+    void setTimeout(int timeout);
+
+    /**
+     * @brief setDatabases selects comma separated databases of the server for next requests,
+     * empty selects all ones. Unknown database is replied with error.
+     */
+    void setDatabases(const QString &databases);
+
+    /**
+     * @brief setSplitByDatabase requests results split by databases for next requests
+     * (@see ScanReply::databaseResults).
+     */
+    void setSplitByDatabase(bool split);
+
+    /**
+     * @return job ID for cancel.
+     */
+    quint64 scanFile(const QString &filename, cb_reply onReply,
+                     cb_job_progress onProgress = cb_job_progress());
+    void scanBytes(const QByteArray &bytes, cb_reply onReply);
+
+    /**
+     * @brief scanFiles batch of scanFile calls, onReply is called for every file.
+     */
+    void scanFiles(const QStringList &filenames, cb_reply onReply);
+
+    /**
+     * @brief cancel cancels file scan: queued one is replied at once,
+     * running one is replied by the server with results found before.
+     */
+    void cancel(quint64 jobId);
+
+    /**
+     * @brief cancelAll cancels all file scans.
+     */
+    void cancelAll();
+
+    /**
+     * @brief isSaturated the client queue is full: producers should wait for readyForMore.
+     * Requests are accepted anyway.
+     */
+    bool isSaturated() const;
+
+    /**
+     * @brief pendingCount number of queued and in flight requests.
+     */
+    int pendingCount() const;
+
+signals:
+    /**
+     * @brief readyForMore is emitted when a reply has been received and the queue is not full.
+     */
+    void readyForMore();
+
+    /**
+     * @brief finished is emitted when all submitted requests have been answered.
+     */
+    void finished();
+
+private slots:
+    void onServiceRegistered();
+    void onServiceUnregistered();
+    void onRetryTimeout();
+    void onProgress(quint64 jobId, quint64 bytesDone, quint64 bytesTotal);
+
+private:
+    struct Request
+    {
+        QString method;
+        QString filename;
+        QByteArray bytes;
+        cb_reply onReply;
+        int attempts;
+        // zero for scanBytes
+        quint64 jobId;
+        cb_job_progress onProgress;
+        // requested databases, empty for all ones
+        QString databases;
+        bool splitByDatabase;
+    };
+
+    void enqueue(Request &&request);
+    void dispatch();
+    void send(const Request &request);
+    void onReplied(QDBusPendingCallWatcher *watcher, Request request);
+    void complete(const Request &request, const ScanReply &reply);
+    void pause();
+    void sendCancel(quint64 jobId);
+    static ScanReply cancelledReply(const Request &request);
+
+    QDBusConnection m_connection;
+    QTimer *m_retryTimer;
+    std::deque<Request> m_queue;
+    // progress callbacks of sent jobs
+    std::map<quint64, cb_job_progress> m_jobsInFlight;
+    quint64 m_lastJobId;
+    int m_inFlight;
+    int m_maxInFlight;
+    int m_maxQueued;
+    int m_maxRetries;
+    int m_timeout;
+    QString m_databases;
+    bool m_splitByDatabase;
+    // sending is paused while the server is gone
+    bool m_paused;
+};
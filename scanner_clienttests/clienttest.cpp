@@ -0,0 +1,289 @@
+#include <scannerclient.h>
+#include <QString>
+#include <QtTest>
+#include <QtDBus/QtDBus>
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+const char *SERVER_CONNECTION_NAME = "scanner_fake_server";
+const int TEST_TIMEOUT = 300;
+}
+
+/**
+ * @brief The FakeServer class stands for the scanner server on its own bus connection:
+ * calls are held till the test replies to them.
+ */
+class FakeServer : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", DBUS_INTERFACE_NAME)
+
+public:
+    explicit FakeServer(const QDBusConnection &connection)
+        : connection(connection)
+        , maxHeld(0)
+        , failuresLeft(0)
+    {}
+
+    /**
+     * @brief reply replies to held call with index, found GUID is its payload.
+     */
+    void reply(int index)
+    {
+        QDBusMessage message = held[static_cast<size_t>(index)];
+        held.erase(held.begin() + index);
+        std::set<Guid> guids{message.arguments().at(0).toByteArray().toStdString()};
+        connection.send(message.createReply(QVariant::fromValue(ScannerResults(ResultError::SUCCESS,
+                                                                               std::move(guids)))));
+    }
+
+    void replyAll()
+    {
+        while (!held.empty())
+        {
+            reply(0);
+        }
+    }
+
+public slots:
+    ScannerResults scanBytes(const QByteArray &bytes, const QDBusMessage &message)
+    {
+        calls << QString::fromLatin1(bytes);
+        message.setDelayedReply(true);
+        if (failuresLeft > 0)
+        {
+            failuresLeft --;
+            connection.send(message.createErrorReply(QDBusError::ServiceUnknown, "Server has gone"));
+            return ScannerResults();
+        }
+        held.push_back(message);
+        maxHeld = std::max(maxHeld, static_cast<int>(held.size()));
+        return ScannerResults();
+    }
+
+    /**
+     * @brief scanBytesPerDatabase replies at once: payload is found by each requested database.
+     */
+    ScannerResults scanBytesPerDatabase(const QString &databases, const QByteArray &bytes,
+                                        const QDBusMessage &message, DatabaseResults &databaseResults)
+    {
+        calls << databases + ":" + QString::fromLatin1(bytes);
+        message.setDelayedReply(true);
+        std::set<Guid> guids{bytes.toStdString()};
+        DatabaseResults split;
+        for (const auto &val : databases.split(','))
+        {
+            split[val.toStdString()] = guids;
+        }
+        QDBusMessage reply = message.createReply(QVariant::fromValue(ScannerResults(ResultError::SUCCESS,
+                                                                                    std::move(guids))));
+        reply << QVariant::fromValue(split);
+        connection.send(reply);
+        databaseResults = DatabaseResults();
+        return ScannerResults();
+    }
+
+public:
+    QDBusConnection connection;
+    // payloads in order of arrival
+    QStringList calls;
+    std::vector<QDBusMessage> held;
+    int maxHeld;
+    // next calls replied with ServiceUnknown error
+    int failuresLeft;
+};
+
+class ClientTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void testInFlightLimit();
+    void testBackpressure();
+    void testRetry();
+    void testTimeout();
+    void testSplitByDatabase();
+
+private:
+    QDBusConnection serverConnection = QDBusConnection(SERVER_CONNECTION_NAME);
+    FakeServer *server = nullptr;
+};
+
+void ClientTest::initTestCase()
+{
+    qDBusRegisterMetaType<ScannerResults>();
+    qDBusRegisterMetaType<DatabaseResults>();
+}
+
+void ClientTest::init()
+{
+    serverConnection = QDBusConnection::connectToBus(QDBusConnection::SessionBus, SERVER_CONNECTION_NAME);
+    if (!serverConnection.isConnected())
+    {
+        QSKIP("No D-Bus session bus");
+    }
+    server = new FakeServer(serverConnection);
+    QVERIFY(serverConnection.registerObject(DBUS_PATH, server, QDBusConnection::ExportAllSlots));
+    if (!serverConnection.registerService(DBUS_SERVICE_NAME))
+    {
+        QSKIP("Scanner service is already registered on the bus");
+    }
+}
+
+void ClientTest::cleanup()
+{
+    if (server != nullptr)
+    {
+        serverConnection.unregisterService(DBUS_SERVICE_NAME);
+        serverConnection.unregisterObject(DBUS_PATH);
+        delete server;
+        server = nullptr;
+    }
+    QDBusConnection::disconnectFromBus(SERVER_CONNECTION_NAME);
+}
+
+void ClientTest::testInFlightLimit()
+{
+    ScannerClient client;
+    client.setMaxInFlight(2);
+    QStringList replies;
+    for (int i = 0; i < 6; i ++)
+    {
+        client.scanBytes(QByteArray::number(i), [&](const ScanReply &reply)
+        {
+            QVERIFY(!reply.isError());
+            replies << QString::fromStdString(*reply.results.results.begin());
+        });
+    }
+
+    QTRY_COMPARE(server->held.size(), size_t(2));
+    QTest::qWait(TEST_TIMEOUT);
+    QCOMPARE(server->held.size(), size_t(2));
+    QCOMPARE(client.pendingCount(), 6);
+
+    // callbacks are called in order of completion
+    server->reply(1);
+    QTRY_COMPARE(replies, QStringList() << "1");
+    QTRY_COMPARE(server->held.size(), size_t(2));
+    while (replies.size() < 6)
+    {
+        QTRY_VERIFY(!server->held.empty());
+        server->replyAll();
+        QTest::qWait(10);
+    }
+
+    // requests are sent in order of submission
+    QCOMPARE(server->calls, QStringList() << "0" << "1" << "2" << "3" << "4" << "5");
+    QCOMPARE(server->maxHeld, 2);
+    QCOMPARE(replies.first(), QString("1"));
+    QCOMPARE(client.pendingCount(), 0);
+}
+
+void ClientTest::testBackpressure()
+{
+    ScannerClient client;
+    client.setMaxInFlight(1);
+    client.setMaxQueued(2);
+    QSignalSpy readySpy(&client, SIGNAL(readyForMore()));
+    QSignalSpy finishedSpy(&client, SIGNAL(finished()));
+    int repliesCount = 0;
+    for (int i = 0; i < 4; i ++)
+    {
+        client.scanBytes(QByteArray::number(i), [&](const ScanReply &) { repliesCount ++; });
+    }
+    QVERIFY(client.isSaturated());
+
+    // the first reply leaves the queue full
+    QTRY_COMPARE(server->held.size(), size_t(1));
+    server->reply(0);
+    QTRY_COMPARE(repliesCount, 1);
+    QVERIFY(client.isSaturated());
+    QCOMPARE(readySpy.count(), 0);
+
+    QTRY_COMPARE(server->held.size(), size_t(1));
+    server->reply(0);
+    QTRY_COMPARE(repliesCount, 2);
+    QVERIFY(!client.isSaturated());
+    QCOMPARE(readySpy.count(), 1);
+
+    while (repliesCount < 4)
+    {
+        QTRY_COMPARE(server->held.size(), size_t(1));
+        server->reply(0);
+        QTest::qWait(10);
+    }
+    QTRY_COMPARE(finishedSpy.count(), 1);
+    QCOMPARE(server->maxHeld, 1);
+}
+
+void ClientTest::testRetry()
+{
+    ScannerClient client;
+    server->failuresLeft = 1;
+    QStringList replies;
+    client.scanBytes("first", [&](const ScanReply &reply)
+    {
+        replies << (reply.isError() ? reply.error : QString::fromStdString(*reply.results.results.begin()));
+    });
+    client.scanBytes("second", [&](const ScanReply &reply)
+    {
+        replies << (reply.isError() ? reply.error : QString::fromStdString(*reply.results.results.begin()));
+    });
+
+    // the failed request is resent first after RETRY_INTERVAL
+    QTRY_COMPARE_WITH_TIMEOUT(server->calls.size(), 3, 5*ScannerClient::RETRY_INTERVAL);
+    QCOMPARE(server->calls.at(0), QString("first"));
+    QCOMPARE(server->calls.at(2), QString("first"));
+    server->replyAll();
+    QTRY_COMPARE(replies.size(), 2);
+    QVERIFY(replies.contains("first"));
+    QVERIFY(replies.contains("second"));
+}
+
+void ClientTest::testTimeout()
+{
+    ScannerClient client;
+    client.setTimeout(TEST_TIMEOUT);
+    QStringList errors;
+    client.scanBytes("slow", [&](const ScanReply &reply)
+    {
+        QVERIFY(reply.isError());
+        errors << reply.error;
+    });
+
+    // timed out request is reported and not resent: the server is still scanning it
+    QTRY_COMPARE(errors.size(), 1);
+    QTest::qWait(2*ScannerClient::RETRY_INTERVAL);
+    QCOMPARE(server->calls, QStringList() << "slow");
+
+    // the queue is not paused
+    client.scanBytes("next", [](const ScanReply &) {});
+    QTRY_COMPARE(server->calls.size(), 2);
+    server->replyAll();
+}
+
+void ClientTest::testSplitByDatabase()
+{
+    ScannerClient client;
+    client.setDatabases("first,second");
+    client.setSplitByDatabase(true);
+    std::vector<ScanReply> replies;
+    client.scanBytes("bytes", [&](const ScanReply &reply) { replies.push_back(reply); });
+
+    QTRY_COMPARE(replies.size(), size_t(1));
+    QVERIFY(!replies[0].isError());
+    QCOMPARE(server->calls, QStringList() << "first,second:bytes");
+    QCOMPARE(replies[0].results.results, std::set<Guid>{"bytes"});
+    QCOMPARE(replies[0].databaseResults.size(), size_t(2));
+    QCOMPARE(replies[0].databaseResults["first"], std::set<Guid>{"bytes"});
+    QCOMPARE(replies[0].databaseResults["second"], std::set<Guid>{"bytes"});
+}
+
+QTEST_MAIN(ClientTest)
+
+#include "clienttest.moc"
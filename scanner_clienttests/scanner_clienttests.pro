@@ -0,0 +1,17 @@
+QT       += testlib dbus
+QT       -= gui
+
+TARGET = clienttest
+CONFIG+= console
+CONFIG+= c++11
+CONFIG-= app_bundle
+
+TEMPLATE = app
+
+# needs D-Bus session bus: the fake server is registered on it by the test
+SOURCES += clienttest.cpp
+
+INCLUDEPATH += ../scanner_clientlib
+
+LIBS += -L$$OUT_PWD/../scanner_clientlib -lscannerclient
+PRE_TARGETDEPS += $$OUT_PWD/../scanner_clientlib/libscannerclient.a
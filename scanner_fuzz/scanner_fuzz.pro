@@ -0,0 +1,37 @@
+QT       += dbus
+QT       -= gui
+
+TARGET = scanner_fuzz
+CONFIG+= console
+CONFIG+= c++11
+CONFIG-= app_bundle
+
+TEMPLATE = app
+
+SOURCES += scannerfuzz.cpp
+SOURCES += ../scanner_server/aggregator.cpp
+SOURCES += ../scanner_server/bufferpool.cpp
+SOURCES += ../scanner_server/filetype.cpp
+SOURCES += ../scanner_server/manager.cpp
+SOURCES += ../scanner_server/policy.cpp
+SOURCES += ../scanner_server/profiler.cpp
+SOURCES += ../scanner_server/scanner.cpp
+SOURCES += ../scanner_server/signaturestore.cpp
+SOURCES += ../scanner_server/unpacker.cpp
+
+INCLUDEPATH += ../scanner_server
+
+LIBS += -lz
+
+# qmake CONFIG+=sanitize: build with AddressSanitizer and UndefinedBehaviorSanitizer
+sanitize {
+    QMAKE_CXXFLAGS += -fsanitize=address,undefined -fno-omit-frame-pointer -fno-sanitize-recover=undefined
+    QMAKE_LFLAGS += -fsanitize=address,undefined
+}
+
+# qmake CONFIG+=libfuzzer (clang only): libFuzzer provides main function
+libfuzzer {
+    DEFINES += SCANNER_LIBFUZZER
+    QMAKE_CXXFLAGS += -fsanitize=fuzzer
+    QMAKE_LFLAGS += -fsanitize=fuzzer
+}
@@ -0,0 +1,319 @@
+/**
+  * @file scannerfuzz.cpp
+  * @brief differential fuzzing of scanning engines against brute force search.
+  *
+  * Built as libFuzzer target with CONFIG+=libfuzzer, otherwise as standalone
+  * program which replays input files passed in arguments or runs random inputs.
+  */
+
+#include <manager.h>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <unistd.h>
+
+namespace
+{
+const size_t MAX_SEQUENCES_COUNT = 8;
+// longer than 32 bytes: all length classes of matching kernels are covered
+const size_t MAX_SEQUENCE_SIZE = 40;
+const unsigned MAX_THREADS_COUNT = 8;
+const unsigned MAX_PARALLEL_READERS = 4;
+const uint64_t MAX_CHUNK_SIZE = 64;
+// default iterations count of standalone driver
+const unsigned DEFAULT_ITERATIONS = 1000;
+const size_t MAX_RANDOM_INPUT_SIZE = 4096;
+
+#define FUZZ_CHECK(condition, message) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::cerr << "FUZZ CHECK FAILED: " << message << std::endl; \
+            std::abort(); \
+        } \
+    } \
+    while (false)
+
+/**
+ * @brief The FuzzInput class consumes fuzzer data as parameters.
+ * Exhausted input gives zeros.
+ */
+class FuzzInput
+{
+public:
+    FuzzInput(const uint8_t *data, size_t size)
+        : m_data(data)
+        , m_size(size)
+    {}
+
+    uint8_t byte()
+    {
+        if (m_size == 0)
+        {
+            return 0;
+        }
+        m_size --;
+        return *m_data++;
+    }
+
+    uint64_t range(uint64_t min, uint64_t max)
+    {
+        return min + byte()%(max - min + 1);
+    }
+
+    /**
+     * @brief rest returns remaining input mapped to alphabet of given size,
+     * small alphabet makes matches frequent.
+     */
+    std::string rest(unsigned alphabetSize)
+    {
+        std::string result;
+        result.reserve(m_size);
+        while (m_size > 0)
+        {
+            result.push_back(static_cast<char>('a' + byte()%alphabetSize));
+        }
+        return result;
+    }
+
+private:
+    const uint8_t *m_data;
+    size_t m_size;
+};
+
+Anchor randomAnchor(FuzzInput &input)
+{
+    Anchor anchor;
+    switch (input.byte()%8)
+    {
+    case 0:
+        anchor.type = Anchor::Type::OFFSET;
+        anchor.begin = input.byte();
+        break;
+    case 1:
+        anchor.type = Anchor::Type::OFFSET_FROM_END;
+        anchor.begin = input.byte();
+        break;
+    case 2:
+        anchor.type = Anchor::Type::RANGE;
+        anchor.begin = static_cast<int8_t>(input.byte());
+        anchor.end = static_cast<int8_t>(input.byte());
+        break;
+    default:
+        break;
+    }
+    return anchor;
+}
+
+/**
+ * @brief bruteForce is the reference: every sequence is checked by ByteSequence::find
+ * at every allowed position.
+ */
+std::set<Guid> bruteForce(const std::vector<ByteSequence> &byteSequences, const std::string &data)
+{
+    std::set<Guid> results;
+    for (const auto &val : byteSequences)
+    {
+        uint64_t first, last;
+        if (!val.anchor().positions(data.size(), val.size(), first, last))
+        {
+            continue;
+        }
+        for (uint64_t position = first; position <= last; position ++)
+        {
+            if (val.find(data.data() + position, data.size() - position))
+            {
+                results.insert(val.guid());
+                break;
+            }
+        }
+    }
+    return results;
+}
+
+void checkEngines(const uint8_t *data, size_t size)
+{
+    FuzzInput input(data, size);
+    const unsigned alphabetSize = input.range(2, 4);
+    const size_t sequencesCount = input.range(1, MAX_SEQUENCES_COUNT);
+    const unsigned threadsCount = input.range(1, MAX_THREADS_COUNT);
+    const uint64_t chunkSize = input.range(1, MAX_CHUNK_SIZE);
+    const unsigned parallelReaders = input.range(1, MAX_PARALLEL_READERS);
+
+    std::vector<ByteSequence> byteSequences;
+    // long sequences hardly ever occur in random content: some of them are planted
+    std::vector<std::pair<size_t, uint8_t>> plantedSequences;
+    for (size_t i = 0; i < sequencesCount; i ++)
+    {
+        size_t sequenceSize = input.range(1, MAX_SEQUENCE_SIZE);
+        std::string bytes;
+        for (size_t j = 0; j < sequenceSize; j ++)
+        {
+            bytes.push_back(static_cast<char>('a' + input.byte()%alphabetSize));
+        }
+        Anchor anchor = randomAnchor(input);
+        byteSequences.push_back({bytes, "guid" + std::to_string(i), anchor});
+        if (input.byte()%2 == 0)
+        {
+            plantedSequences.push_back({i, input.byte()});
+        }
+    }
+    std::string content = input.rest(alphabetSize);
+    for (const auto &val : plantedSequences)
+    {
+        // position is fraction of content size
+        content.insert(content.size()*val.second/256, byteSequences[val.first].bytes());
+    }
+    const std::set<Guid> expected = bruteForce(byteSequences, content);
+
+    UnpackLimits noUnpacking;
+    noUnpacking.maxDepth = 0;
+    Manager manager(std::vector<ByteSequence>(byteSequences), threadsCount);
+    manager.setUnpackLimits(noUnpacking);
+
+    ScannerResults results = manager.scanBytes(content.data(), content.size());
+    FUZZ_CHECK(results.error == ResultError::SUCCESS, "scanBytes error");
+    FUZZ_CHECK(results.results == expected, "scanBytes differs, threads = " << threadsCount);
+
+    // file scanning with chunk boundaries at every place
+    std::string filename = "/tmp/scanner_fuzz_" + std::to_string(getpid()) + ".tmp";
+    FILE *file = fopen(filename.c_str(), "wb");
+    FUZZ_CHECK(file != nullptr, "can't create " << filename);
+    fwrite(content.data(), 1, content.size(), file);
+    fclose(file);
+
+    manager.setChunkSize(chunkSize);
+    manager.setParallelReaders(parallelReaders);
+    results = manager.scanFile(filename);
+    std::remove(filename.c_str());
+    FUZZ_CHECK(results.error == ResultError::SUCCESS, "scanFile error");
+    FUZZ_CHECK(results.results == expected, "scanFile differs, chunk size = " << chunkSize
+               << ", threads = " << threadsCount << ", parallel readers = " << parallelReaders);
+}
+
+void checkAnchorText(const std::string &text)
+{
+    Anchor anchor;
+    if (!Anchor::parse(text, anchor))
+    {
+        return;
+    }
+    FUZZ_CHECK(anchor.type == Anchor::Type::RANGE || anchor.begin >= 0, "negative offset of " << text);
+    uint64_t first, last;
+    if (anchor.positions(MAX_RANDOM_INPUT_SIZE, 1, first, last))
+    {
+        FUZZ_CHECK(first <= last && last < MAX_RANDOM_INPUT_SIZE, "positions out of data of " << text);
+    }
+}
+
+void checkAnchorParsing(const uint8_t *data, size_t size)
+{
+    // boundary values are checked in every run, random input rarely hits them
+    static const char *const boundaries[] = {
+        "-9223372036854775808", "-9223372036854775807", "9223372036854775807",
+        "-9223372036854775808:", ":-9223372036854775808", "-9223372036854775807:9223372036854775807",
+    };
+    for (const char *text : boundaries)
+    {
+        checkAnchorText(text);
+    }
+    checkAnchorText(std::string(reinterpret_cast<const char *>(data), size));
+}
+
+void checkSerialization(const uint8_t *data, size_t size)
+{
+    // arbitrary bytes must not crash or hang deserialization
+    QByteArray byteArray(reinterpret_cast<const char *>(data), static_cast<int>(size));
+    std::set<Guid> guids;
+    unpackGuids(byteArray, std::numeric_limits<size_t>::max(), guids);
+
+    // round trip of printable GUIDs made of the same input
+    std::set<Guid> original;
+    std::string guid;
+    for (size_t i = 0; i < size; i ++)
+    {
+        if (data[i]%16 == 0)
+        {
+            original.insert(guid);
+            guid.clear();
+        }
+        else
+        {
+            guid.push_back(static_cast<char>(' ' + data[i]%('~' - ' ')));
+        }
+    }
+
+    std::set<Guid> restored;
+    unpackGuids(packGuids(original), original.size(), restored);
+    FUZZ_CHECK(restored == original, "GUIDs round trip differs");
+}
+}
+
+extern "C" int LLVMFuzzerInitialize(int *, char ***)
+{
+    // scanning reports are not needed
+    std::cout.setstate(std::ios::failbit);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    checkSerialization(data, size);
+    checkAnchorParsing(data, size);
+    checkEngines(data, size);
+    return 0;
+}
+
+#ifndef SCANNER_LIBFUZZER
+int main(int argc, char *argv[])
+{
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    if (argc > 1)
+    {
+        // replay inputs (e.g. crashes found by libFuzzer)
+        for (int i = 1; i < argc; i ++)
+        {
+            FILE *file = fopen(argv[i], "rb");
+            if (file == nullptr)
+            {
+                std::cerr << "can't open " << argv[i] << std::endl;
+                return 1;
+            }
+            std::vector<uint8_t> data;
+            int byte;
+            while ((byte = fgetc(file)) != EOF)
+            {
+                data.push_back(static_cast<uint8_t>(byte));
+            }
+            fclose(file);
+
+            LLVMFuzzerTestOneInput(data.data(), data.size());
+        }
+        std::cerr << "replayed " << argc - 1 << " inputs" << std::endl;
+        return 0;
+    }
+
+    const char *iterationsString = std::getenv("SCANNER_FUZZ_ITERATIONS");
+    const char *seedString = std::getenv("SCANNER_FUZZ_SEED");
+    unsigned iterations = iterationsString ? std::strtoul(iterationsString, nullptr, 10) : DEFAULT_ITERATIONS;
+    unsigned seed = seedString ? std::strtoul(seedString, nullptr, 10) : std::random_device()();
+    std::cerr << "random inputs: " << iterations << ", seed = " << seed << std::endl;
+
+    std::mt19937 generator(seed);
+    std::vector<uint8_t> data;
+    for (unsigned i = 0; i < iterations; i ++)
+    {
+        data.resize(generator()%MAX_RANDOM_INPUT_SIZE);
+        for (auto &val : data)
+        {
+            val = static_cast<uint8_t>(generator());
+        }
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    std::cerr << "done" << std::endl;
+    return 0;
+}
+#endif
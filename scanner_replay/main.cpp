@@ -0,0 +1,303 @@
+/**
+  * @file main.cpp
+  * @brief replays trace recorded by the server (@see TraceRecorder) through Manager offline.
+  *
+  * Files and byte arrays are replaced by synthetic ones of the same sizes: content
+  * is pseudo random and deterministic, so replays of one trace scan the same data.
+  * Requests are submitted at recorded times or at once, by recorded clients and
+  * priorities into RequestScheduler, the same way as the server does.
+  * Latency distributions are printed to stderr and compared with baseline trace:
+  * the replayed trace itself if no other one is given.
+  */
+
+#include <manager.h>
+#include <scheduler.h>
+#include <sequencesfile.h>
+#include <trace.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <condition_variable>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+// default number of requests processed simultaneously: the same as server one
+const unsigned DEFAULT_MAX_CONCURRENT_REQUESTS = 2;
+
+// size of blocks written to corpus files
+const size_t CORPUS_WRITE_SIZE = 1024*1024;
+
+/**
+ * @brief syntheticContent fills buffer by xorshift generator seeded by content size
+ * and offset: the same size gives the same content.
+ */
+void syntheticContent(char *buffer, size_t size, uint64_t contentSize, uint64_t offset)
+{
+    uint64_t state = (contentSize + 1)*0x9e3779b97f4a7c15ULL ^ (offset + 1);
+    for (size_t i = 0; i < size; i ++)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        buffer[i] = static_cast<char>(state);
+    }
+}
+
+/**
+ * @brief corpusFile path of synthetic file of given size, the file is created
+ * if it doesn't exist or has other size.
+ * @return empty string on write error.
+ */
+std::string corpusFile(const QDir &corpus, uint64_t size)
+{
+    QString path = corpus.filePath(QString("size_%1.bin").arg(size));
+    if (QFileInfo(path).exists() && static_cast<uint64_t>(QFileInfo(path).size()) == size)
+    {
+        return path.toStdString();
+    }
+
+    FILE *file = fopen(path.toStdString().c_str(), "wb");
+    if (file == nullptr)
+    {
+        return std::string();
+    }
+    std::vector<char> buffer(CORPUS_WRITE_SIZE);
+    for (uint64_t offset = 0; offset < size; offset += buffer.size())
+    {
+        size_t toWrite = static_cast<size_t>(std::min<uint64_t>(buffer.size(), size - offset));
+        syntheticContent(buffer.data(), toWrite, size, offset);
+        if (fwrite(buffer.data(), 1, toWrite, file) != toWrite)
+        {
+            fclose(file);
+            return std::string();
+        }
+    }
+    fclose(file);
+    return path.toStdString();
+}
+
+typedef std::map<std::string, std::vector<uint64_t>> Latencies;
+
+/**
+ * @brief groupLatencies latencies by method and of all requests.
+ */
+Latencies groupLatencies(const std::vector<TraceRecord> &records)
+{
+    Latencies result;
+    for (const auto &val : records)
+    {
+        result["all"].push_back(val.latencyMicroseconds);
+        result[asString(val.method)].push_back(val.latencyMicroseconds);
+    }
+    return result;
+}
+
+std::string changePercent(uint64_t value, uint64_t baseline)
+{
+    if (baseline == 0)
+    {
+        return "n/a";
+    }
+    std::stringstream result;
+    double change = (static_cast<double>(value) - baseline)*100/baseline;
+    result << std::showpos << std::fixed << std::setprecision(1) << change << "%";
+    return result.str();
+}
+
+void printReport(const std::vector<TraceRecord> &replayed, const std::vector<TraceRecord> &baseline)
+{
+    Latencies current = groupLatencies(replayed);
+    Latencies previous = groupLatencies(baseline);
+
+    std::cerr << std::left << std::setw(12) << "latency, us" << std::right
+              << std::setw(8) << "count" << std::setw(12) << "mean" << std::setw(12) << "p50"
+              << std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12) << "max" << std::endl;
+    for (const auto &val : current)
+    {
+        LatencySummary summary = summarizeLatencies(val.second);
+        LatencySummary base = summarizeLatencies(previous[val.first]);
+        std::cerr << std::left << std::setw(12) << val.first << std::right
+                  << std::setw(8) << summary.count << std::setw(12) << summary.mean
+                  << std::setw(12) << summary.p50 << std::setw(12) << summary.p90
+                  << std::setw(12) << summary.p99 << std::setw(12) << summary.max << std::endl;
+        std::cerr << std::left << std::setw(12) << "  baseline" << std::right
+                  << std::setw(8) << base.count << std::setw(12) << base.mean
+                  << std::setw(12) << base.p50 << std::setw(12) << base.p90
+                  << std::setw(12) << base.p99 << std::setw(12) << base.max << std::endl;
+        std::cerr << std::left << std::setw(12) << "  change" << std::right
+                  << std::setw(8) << "" << std::setw(12) << changePercent(summary.mean, base.mean)
+                  << std::setw(12) << changePercent(summary.p50, base.p50)
+                  << std::setw(12) << changePercent(summary.p90, base.p90)
+                  << std::setw(12) << changePercent(summary.p99, base.p99)
+                  << std::setw(12) << changePercent(summary.max, base.max) << std::endl;
+    }
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication application(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays trace of scan requests recorded by the server.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("sequences", "Sequences argument of the server: file or name=file list.");
+    parser.addPositionalArgument("trace", "Trace file to replay.");
+    QCommandLineOption maxSpeedOption("max-speed", "Submit all requests at once instead of recorded times.");
+    QCommandLineOption baselineOption("baseline", "Trace to compare latencies with, default is replayed one.",
+                                      "trace");
+    QCommandLineOption outputOption("output", "Write replayed requests as trace (e.g. new baseline).",
+                                    "trace");
+    QCommandLineOption corpusOption("corpus", "Directory of synthetic files, they are reused by next replays.",
+                                    "directory", QDir::temp().filePath("scanner_replay_corpus"));
+    QCommandLineOption concurrencyOption("concurrency", "Number of requests processed simultaneously.",
+                                         "count", QString::number(DEFAULT_MAX_CONCURRENT_REQUESTS));
+    QCommandLineOption threadsOption("threads", "Size of scanners pool, 0 means count of CPU cores.",
+                                     "count", "0");
+    QCommandLineOption chunkSizeOption("chunk-size", "Chunk size of reading files in bytes.", "bytes");
+    parser.addOptions({maxSpeedOption, baselineOption, outputOption, corpusOption,
+                       concurrencyOption, threadsOption, chunkSizeOption});
+    parser.process(application);
+
+    const QStringList arguments = parser.positionalArguments();
+    if (arguments.size() != 2)
+    {
+        parser.showHelp(1);
+    }
+
+    std::vector<TraceRecord> records;
+    if (!loadTrace(arguments[1].toStdString(), records))
+    {
+        std::cerr << "Can't load trace: " << arguments[1].toStdString() << std::endl;
+        return 1;
+    }
+    // trace is written in order of replies: requests are submitted in order of arrival
+    sortByArrival(records);
+    std::vector<TraceRecord> baseline = records;
+    if (parser.isSet(baselineOption) && !loadTrace(parser.value(baselineOption).toStdString(), baseline))
+    {
+        std::cerr << "Can't load baseline trace: " << parser.value(baselineOption).toStdString() << std::endl;
+        return 1;
+    }
+
+    std::vector<SignatureDatabase> databases;
+    if (!loadDatabases(arguments[0].toStdString(), databases))
+    {
+        std::cerr << "Empty sequences or not supported file!" << std::endl;
+        return 1;
+    }
+    Manager manager(std::move(databases), parser.value(threadsOption).toUInt());
+    if (parser.isSet(chunkSizeOption))
+    {
+        manager.setChunkSize(parser.value(chunkSizeOption).toULongLong());
+    }
+
+    // synthetic content is prepared before replay: it's not measured
+    QDir corpus(parser.value(corpusOption));
+    if (!corpus.mkpath("."))
+    {
+        std::cerr << "Can't create corpus directory: " << corpus.path().toStdString() << std::endl;
+        return 1;
+    }
+    std::map<uint64_t, std::string> files;
+    std::map<uint64_t, std::string> blocks;
+    for (const auto &val : records)
+    {
+        if (val.method == TraceMethod::SCAN_FILE && files.count(val.size) == 0)
+        {
+            files[val.size] = corpusFile(corpus, val.size);
+            if (files[val.size].empty())
+            {
+                std::cerr << "Can't write corpus file of size " << val.size << std::endl;
+                return 1;
+            }
+        }
+        else if (val.method == TraceMethod::SCAN_BYTES && blocks.count(val.size) == 0)
+        {
+            std::string &block = blocks[val.size];
+            block.resize(val.size);
+            syntheticContent(&block[0], block.size(), val.size, 0);
+        }
+    }
+
+    TraceRecorder output;
+    if (parser.isSet(outputOption) && !output.start(parser.value(outputOption).toStdString(), false))
+    {
+        std::cerr << "Can't create output trace: " << parser.value(outputOption).toStdString() << std::endl;
+        return 1;
+    }
+
+    const bool maxSpeed = parser.isSet(maxSpeedOption);
+    std::vector<TraceRecord> replayed(records.size());
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t doneCount = 0;
+    const auto replayStart = TraceRecorder::now();
+    {
+        RequestScheduler scheduler(parser.value(concurrencyOption).toUInt());
+        for (size_t i = 0; i < records.size(); i ++)
+        {
+            const TraceRecord &record = records[i];
+            // latency is counted from recorded receiving time: late submission is not hidden
+            const auto started = maxSpeed
+                    ? TraceRecorder::now()
+                    : replayStart + std::chrono::microseconds(record.startMicroseconds);
+            std::this_thread::sleep_until(started);
+
+            scheduler.submit(std::to_string(record.client), record.priority, [&, i, started]()
+            {
+                const TraceRecord &record = records[i];
+                ScannerResults results;
+                if (record.method == TraceMethod::SCAN_FILE)
+                {
+                    ScanControl control;
+                    control.onChunk = [&scheduler, &record]()
+                    {
+                        scheduler.yield(record.priority);
+                    };
+                    results = manager.scanFile(files.at(record.size), control);
+                }
+                else
+                {
+                    const std::string &block = blocks.at(record.size);
+                    results = manager.scanBytes(block.data(), block.size());
+                }
+                const auto finished = TraceRecorder::now();
+
+                TraceRecord result = record;
+                result.error = results.error;
+                result.resultsCount = static_cast<uint32_t>(results.results.size());
+                result.contentHash = 0;
+                result.latencyMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                            finished - started).count();
+                output.record(std::to_string(record.client), started, finished, result);
+
+                std::lock_guard<std::mutex> lock(doneMutex);
+                replayed[i] = result;
+                doneCount ++;
+                doneCondition.notify_one();
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCondition.wait(lock, [&]()
+        {
+            return doneCount == records.size();
+        });
+    }
+    const auto replayTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+                TraceRecorder::now() - replayStart).count();
+    output.stop();
+
+    std::cerr << "replayed " << records.size() << " requests in " << replayTime << " ms ("
+              << (maxSpeed ? "max" : "recorded") << " speed)" << std::endl;
+    printReport(replayed, baseline);
+    return 0;
+}
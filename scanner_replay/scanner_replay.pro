@@ -0,0 +1,29 @@
+QT += core
+QT += dbus
+QT -= gui
+
+TARGET = scanner_replay
+CONFIG += console
+CONFIG += c++11
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += \
+    main.cpp \
+    ../scanner_server/aggregator.cpp \
+    ../scanner_server/bufferpool.cpp \
+    ../scanner_server/filetype.cpp \
+    ../scanner_server/manager.cpp \
+    ../scanner_server/policy.cpp \
+    ../scanner_server/profiler.cpp \
+    ../scanner_server/scanner.cpp \
+    ../scanner_server/scheduler.cpp \
+    ../scanner_server/sequencesfile.cpp \
+    ../scanner_server/signaturestore.cpp \
+    ../scanner_server/trace.cpp \
+    ../scanner_server/unpacker.cpp
+
+INCLUDEPATH += ../scanner_server
+
+LIBS += -lz
@@ -0,0 +1,30 @@
+#include <aggregator.h>
+
+namespace
+{
+const size_t CACHE_LINE_SIZE = 64;
+const size_t WORDS_PER_CACHE_LINE = CACHE_LINE_SIZE/sizeof(uint64_t);
+}
+
+ResultsAggregator::ResultsAggregator(const std::vector<size_t> &slotSizes)
+    : m_sizes(slotSizes)
+{
+    // every slot takes whole cache lines
+    size_t totalWords = 0;
+    m_offsets.reserve(slotSizes.size());
+    for (auto size : slotSizes)
+    {
+        m_offsets.push_back(totalWords);
+        size_t words = (size + 63)/64;
+        totalWords += (words + WORDS_PER_CACHE_LINE - 1)/WORDS_PER_CACHE_LINE*WORDS_PER_CACHE_LINE;
+    }
+
+    // one more line for alignment of storage start
+    m_storage.assign(totalWords + WORDS_PER_CACHE_LINE, 0);
+    size_t misalignment = reinterpret_cast<uintptr_t>(m_storage.data())%CACHE_LINE_SIZE;
+    size_t alignmentWords = misalignment == 0 ? 0 : (CACHE_LINE_SIZE - misalignment)/sizeof(uint64_t);
+    for (auto &val : m_offsets)
+    {
+        val += alignmentWords;
+    }
+}
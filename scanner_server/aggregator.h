@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief lowestBit index of the lowest set bit, bits must not be zero.
+ */
+inline size_t lowestBit(uint64_t bits)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_ctzll(bits));
+#else
+    size_t index = 0;
+    while ((bits & 1) == 0)
+    {
+        bits >>= 1;
+        index ++;
+    }
+    return index;
+#endif
+}
+
+/**
+ * @brief The ResultsAggregator class collects found sequences from several threads
+ * without synchronization.
+ *
+ * Every writer thread owns a slot: bitset of indices of sequences it is responsible for.
+ * Slots are placed in separate cache lines, so writers don't contend even for lines.
+ * Results are read (@see forEachMarked) once after all writers are joined.
+ */
+class ResultsAggregator
+{
+public:
+    /**
+     * @param slotSizes number of sequences of every slot.
+     */
+    explicit ResultsAggregator(const std::vector<size_t> &slotSizes);
+
+    void mark(size_t slot, size_t index)
+    {
+        m_storage[m_offsets[slot] + index/64] |= uint64_t(1) << (index%64);
+    }
+
+    bool marked(size_t slot, size_t index) const
+    {
+        return (m_storage[m_offsets[slot] + index/64] >> (index%64)) & 1;
+    }
+
+    /**
+     * @brief forEachMarked calls function(slot, index) for every marked sequence.
+     * Must not be called while writers are running.
+     */
+    template<typename Function>
+    void forEachMarked(Function function) const
+    {
+        for (size_t slot = 0; slot < m_sizes.size(); slot ++)
+        {
+            for (size_t word = 0; word*64 < m_sizes[slot]; word ++)
+            {
+                uint64_t bits = m_storage[m_offsets[slot] + word];
+                while (bits != 0)
+                {
+                    size_t bit = lowestBit(bits);
+                    function(slot, word*64 + bit);
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> m_storage;
+    // first word of every slot in m_storage, aligned by cache line
+    std::vector<size_t> m_offsets;
+    std::vector<size_t> m_sizes;
+};
@@ -0,0 +1,284 @@
+#include <bufferpool.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+const char *asString(BudgetPolicy policy)
+{
+    switch (policy)
+    {
+    case BudgetPolicy::BLOCK:
+        return "block";
+    case BudgetPolicy::REJECT:
+        return "reject";
+    }
+    return "";
+}
+
+PooledBuffer::PooledBuffer()
+    : m_pool(nullptr)
+    , m_size(0)
+{
+}
+
+PooledBuffer::PooledBuffer(BufferPool *pool, std::unique_ptr<char[]> &&data, uint64_t size)
+    : m_pool(pool)
+    , m_data(std::move(data))
+    , m_size(size)
+{
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other)
+    : m_pool(other.m_pool)
+    , m_data(std::move(other.m_data))
+    , m_size(other.m_size)
+{
+    other.m_pool = nullptr;
+    other.m_size = 0;
+}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other)
+{
+    if (this != &other)
+    {
+        release();
+        m_pool = other.m_pool;
+        m_data = std::move(other.m_data);
+        m_size = other.m_size;
+        other.m_pool = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer()
+{
+    release();
+}
+
+void PooledBuffer::release()
+{
+    if (m_pool != nullptr)
+    {
+        m_pool->release(std::move(m_data), m_size);
+        m_pool = nullptr;
+        m_size = 0;
+    }
+}
+
+BufferPool::BufferPool(uint64_t budget, BudgetPolicy policy)
+    : m_maxWait(DEFAULT_MAX_WAIT)
+{
+    m_status.budget = budget;
+    m_status.policy = policy;
+}
+
+void BufferPool::setBudget(uint64_t budget, BudgetPolicy policy)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_status.budget = budget;
+    m_status.policy = policy;
+    fits(0);
+    // waiting requests are rechecked by new budget
+    m_released.notify_all();
+}
+
+void BufferPool::setMaxWait(int maxWait)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_maxWait = maxWait;
+}
+
+PooledBuffer BufferPool::acquire(uint64_t size, uint64_t minSize, const std::atomic<bool> *cancelled,
+                                 const cb_wait &onWait)
+{
+    minSize = std::min(minSize, size);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::chrono::steady_clock::time_point waitStarted;
+    while (true)
+    {
+        if (m_status.budget > 0 && minSize > m_status.budget)
+        {
+            // it would wait forever
+            m_status.rejected ++;
+            return PooledBuffer();
+        }
+
+        const uint64_t room = m_status.budget == 0
+                ? size
+                : m_status.budget - std::min(m_status.inUse, m_status.budget);
+        uint64_t bufferSize = size;
+        while (bufferSize > room && bufferSize > minSize)
+        {
+            bufferSize = std::max(minSize, bufferSize/2);
+        }
+        if (bufferSize <= room)
+        {
+            if (bufferSize < size)
+            {
+                m_status.shrunk ++;
+            }
+            return take(bufferSize);
+        }
+
+        if (!wait(lock, waitStarted, cancelled, onWait))
+        {
+            return PooledBuffer();
+        }
+    }
+}
+
+PooledBuffer BufferPool::tryAcquire(uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_status.budget > 0 && m_status.inUse + size > m_status.budget)
+    {
+        return PooledBuffer();
+    }
+    return take(size);
+}
+
+PooledBuffer BufferPool::tryReserve(uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_status.budget > 0 && (m_status.inUse + size > m_status.budget || !fits(size)))
+    {
+        m_status.rejected ++;
+        return PooledBuffer();
+    }
+    m_status.inUse += size;
+    m_status.peak = std::max(m_status.peak, m_status.inUse);
+    return PooledBuffer(this, std::unique_ptr<char[]>(), size);
+}
+
+PooledBuffer BufferPool::reserve(uint64_t size, const std::atomic<bool> *cancelled, const cb_wait &onWait)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::chrono::steady_clock::time_point waitStarted;
+    while (m_status.budget > 0 && (m_status.inUse + size > m_status.budget || !fits(size)))
+    {
+        if (size > m_status.budget)
+        {
+            // it would wait forever
+            m_status.rejected ++;
+            return PooledBuffer();
+        }
+        if (!wait(lock, waitStarted, cancelled, onWait))
+        {
+            return PooledBuffer();
+        }
+    }
+    m_status.inUse += size;
+    m_status.peak = std::max(m_status.peak, m_status.inUse);
+    return PooledBuffer(this, std::unique_ptr<char[]>(), size);
+}
+
+BufferPoolStatus BufferPool::status() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_status;
+}
+
+std::string BufferPool::report() const
+{
+    BufferPoolStatus current = status();
+    std::stringstream result;
+    result << "buffer pool: budget = " << current.budget << " bytes (" << asString(current.policy)
+           << "), in use = " << current.inUse << " bytes in " << current.buffersInUse
+           << " buffers, cached = " << current.cached << " bytes, peak = " << current.peak
+           << " bytes, waiting = " << current.waiting << ", blocked = " << current.blocked
+           << ", rejected = " << current.rejected << ", shrunk = " << current.shrunk
+           << ", timed out = " << current.timedOut;
+    return result.str();
+}
+
+void BufferPool::release(std::unique_ptr<char[]> &&data, uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_status.inUse -= size;
+    if (data)
+    {
+        m_status.buffersInUse --;
+        if (m_cache.size() < MAX_CACHED_BUFFERS)
+        {
+            m_cache.insert({size, std::move(data)});
+            m_status.cached += size;
+        }
+        // budget may have been decreased meanwhile
+        fits(0);
+    }
+    m_released.notify_all();
+}
+
+bool BufferPool::fits(uint64_t size)
+{
+    // the largest cached buffers are freed first
+    while (m_status.budget > 0 && m_status.inUse + m_status.cached + size > m_status.budget
+           && !m_cache.empty())
+    {
+        auto it = std::prev(m_cache.end());
+        m_status.cached -= it->first;
+        m_cache.erase(it);
+    }
+    return m_status.budget == 0 || m_status.inUse + m_status.cached + size <= m_status.budget;
+}
+
+bool BufferPool::wait(std::unique_lock<std::mutex> &lock, std::chrono::steady_clock::time_point &waitStarted,
+                      const std::atomic<bool> *cancelled, const cb_wait &onWait)
+{
+    if (m_status.policy == BudgetPolicy::REJECT)
+    {
+        m_status.rejected ++;
+        return false;
+    }
+    if (cancelled != nullptr && cancelled->load())
+    {
+        return false;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (waitStarted == std::chrono::steady_clock::time_point())
+    {
+        m_status.blocked ++;
+        waitStarted = now;
+    }
+    else if (now - waitStarted >= std::chrono::milliseconds(m_maxWait))
+    {
+        // memory is held by requests which don't finish (e.g. waiting themselves)
+        m_status.rejected ++;
+        m_status.timedOut ++;
+        return false;
+    }
+
+    m_status.waiting ++;
+    m_released.wait_for(lock, std::chrono::milliseconds(static_cast<int>(WAIT_CHECK_INTERVAL)));
+    if (onWait)
+    {
+        lock.unlock();
+        onWait();
+        lock.lock();
+    }
+    m_status.waiting --;
+    return true;
+}
+
+PooledBuffer BufferPool::take(uint64_t size)
+{
+    std::unique_ptr<char[]> data;
+    auto it = m_cache.find(size);
+    if (it != m_cache.end())
+    {
+        data = std::move(it->second);
+        m_cache.erase(it);
+        m_status.cached -= size;
+    }
+    else
+    {
+        fits(size);
+        data.reset(new char[size]);
+    }
+    m_status.inUse += size;
+    m_status.buffersInUse ++;
+    m_status.peak = std::max(m_status.peak, m_status.inUse);
+    return PooledBuffer(this, std::move(data), size);
+}
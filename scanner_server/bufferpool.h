@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief The BudgetPolicy enum behaviour of BufferPool::acquire when budget is exhausted.
+ */
+enum class BudgetPolicy : uint8_t
+{
+    // wait until other requests release their buffers, up to BufferPool::maxWait
+    BLOCK = 0,
+    // fail at once
+    REJECT,
+};
+
+const char *asString(BudgetPolicy policy);
+
+/**
+ * @brief The BufferPoolStatus struct occupancy and counters of BufferPool.
+ */
+struct BufferPoolStatus
+{
+    // zero means unlimited
+    uint64_t budget = 0;
+    BudgetPolicy policy = BudgetPolicy::BLOCK;
+    // bytes of acquired buffers and reservations
+    uint64_t inUse = 0;
+    uint64_t buffersInUse = 0;
+    // bytes of released buffers kept for reuse
+    uint64_t cached = 0;
+    uint64_t peak = 0;
+    // requests waiting for memory now
+    uint64_t waiting = 0;
+    // requests which have waited, have been rejected or have got smaller buffers
+    uint64_t blocked = 0;
+    uint64_t rejected = 0;
+    uint64_t shrunk = 0;
+    // requests which have waited longer than maxWait, they are counted as rejected too
+    uint64_t timedOut = 0;
+};
+
+class BufferPool;
+
+/**
+ * @brief The PooledBuffer class is buffer or reservation taken from BufferPool,
+ * it's returned to the pool on destruction. Reservation has no data: it accounts
+ * memory owned by caller (e.g. received request payload).
+ */
+class PooledBuffer
+{
+public:
+    PooledBuffer();
+    PooledBuffer(PooledBuffer &&other);
+    PooledBuffer &operator=(PooledBuffer &&other);
+    ~PooledBuffer();
+
+    PooledBuffer(const PooledBuffer &) = delete;
+    PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+    char *data() const { return m_data.get(); }
+    uint64_t size() const { return m_size; }
+
+    /**
+     * @brief operator bool false if memory has not been given by the pool.
+     */
+    explicit operator bool() const { return m_pool != nullptr; }
+
+    /**
+     * @brief release returns memory to the pool before destruction.
+     */
+    void release();
+
+private:
+    friend class BufferPool;
+    PooledBuffer(BufferPool *pool, std::unique_ptr<char[]> &&data, uint64_t size);
+
+    BufferPool *m_pool;
+    std::unique_ptr<char[]> m_data;
+    uint64_t m_size;
+};
+
+/**
+ * @brief The BufferPool class bounds memory of read buffers of all requests by budget.
+ *
+ * Released buffers are kept for reuse by next requests of the same size, they are
+ * freed when new ones don't fit into budget. It's thread safe.
+ */
+class BufferPool
+{
+public:
+    /**
+     * @brief MAX_CACHED_BUFFERS released buffers kept for reuse.
+     */
+    static const size_t MAX_CACHED_BUFFERS = 8;
+
+    /**
+     * @brief WAIT_CHECK_INTERVAL interval of checking cancellation while waiting in milliseconds.
+     */
+    static const int WAIT_CHECK_INTERVAL = 100;
+
+    /**
+     * @brief DEFAULT_MAX_WAIT default limit of waiting for memory in milliseconds.
+     */
+    static const int DEFAULT_MAX_WAIT = 30*1000;
+
+    /**
+     * @brief cb_wait is called without lock every WAIT_CHECK_INTERVAL while request waits,
+     * e.g. to let other requests run in the waiting thread.
+     */
+    typedef std::function<void()> cb_wait;
+
+    /**
+     * @param budget bytes of all buffers, zero means unlimited.
+     */
+    explicit BufferPool(uint64_t budget = 0, BudgetPolicy policy = BudgetPolicy::BLOCK);
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    /**
+     * @brief setBudget changes budget, buffers acquired before are not affected.
+     */
+    void setBudget(uint64_t budget, BudgetPolicy policy);
+
+    /**
+     * @brief setMaxWait limits waiting of BLOCK policy: request fails after it.
+     * @param maxWait in milliseconds.
+     */
+    void setMaxWait(int maxWait);
+
+    /**
+     * @brief acquire gives buffer of size bytes, under memory pressure it's halved
+     * down to minSize. When even minSize doesn't fit, waits for released buffers
+     * or fails according to policy. Fails at once if minSize exceeds budget.
+     * @param cancelled optional flag which stops waiting.
+     * @param onWait optional callback called while waiting.
+     * @return empty buffer on failure.
+     */
+    PooledBuffer acquire(uint64_t size, uint64_t minSize, const std::atomic<bool> *cancelled = nullptr,
+                         const cb_wait &onWait = cb_wait());
+
+    /**
+     * @brief tryAcquire gives buffer of exactly size bytes if it fits into budget now.
+     */
+    PooledBuffer tryAcquire(uint64_t size);
+
+    /**
+     * @brief tryReserve accounts size bytes owned by caller if they fit into budget now.
+     */
+    PooledBuffer tryReserve(uint64_t size);
+
+    /**
+     * @brief reserve accounts size bytes owned by caller. When they don't fit,
+     * waits for released buffers or fails according to policy like acquire.
+     */
+    PooledBuffer reserve(uint64_t size, const std::atomic<bool> *cancelled = nullptr,
+                         const cb_wait &onWait = cb_wait());
+
+    BufferPoolStatus status() const;
+
+    /**
+     * @brief report text line of status.
+     */
+    std::string report() const;
+
+private:
+    friend class PooledBuffer;
+    void release(std::unique_ptr<char[]> &&data, uint64_t size);
+
+    /**
+     * @brief fits checks that size bytes fit into budget freeing cached buffers if needed.
+     */
+    bool fits(uint64_t size);
+
+    /**
+     * @brief wait waits for released buffers once according to policy.
+     * @param waitStarted is set on the first wait of request.
+     * @return false if request fails.
+     */
+    bool wait(std::unique_lock<std::mutex> &lock, std::chrono::steady_clock::time_point &waitStarted,
+              const std::atomic<bool> *cancelled, const cb_wait &onWait);
+
+    /**
+     * @brief take gives cached or new buffer of size bytes, it must fit.
+     */
+    PooledBuffer take(uint64_t size);
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+    BufferPoolStatus m_status;
+    int m_maxWait;
+    // released buffers by size
+    std::multimap<uint64_t, std::unique_ptr<char[]>> m_cache;
+};
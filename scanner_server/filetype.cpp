@@ -0,0 +1,143 @@
+#include <filetype.h>
+#include <cstring>
+#include <sstream>
+
+namespace
+{
+bool startsWith(const char *header, size_t size, const char *magic, size_t magicSize, size_t offset = 0)
+{
+    return size >= offset + magicSize && memcmp(header + offset, magic, magicSize) == 0;
+}
+
+bool isText(const char *header, size_t size)
+{
+    if (size == 0)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < size; i ++)
+    {
+        unsigned char byte = static_cast<unsigned char>(header[i]);
+        // control characters except tab, line feed, carriage return and form feed
+        if (byte < 0x20 && byte != '\t' && byte != '\n' && byte != '\r' && byte != '\f')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+FileType sniffFileType(const char *header, size_t size)
+{
+    if (startsWith(header, size, "\x7f" "ELF", 4))
+    {
+        return FileType::ELF;
+    }
+    if (startsWith(header, size, "MZ", 2))
+    {
+        return FileType::PE;
+    }
+    if (startsWith(header, size, "\xcf\xfa\xed\xfe", 4) || startsWith(header, size, "\xce\xfa\xed\xfe", 4)
+            || startsWith(header, size, "\xfe\xed\xfa\xcf", 4) || startsWith(header, size, "\xfe\xed\xfa\xce", 4))
+    {
+        return FileType::MACHO;
+    }
+    if (startsWith(header, size, "%PDF-", 5))
+    {
+        return FileType::PDF;
+    }
+    if (startsWith(header, size, "PK\x03\x04", 4) || startsWith(header, size, "PK\x05\x06", 4))
+    {
+        return FileType::ZIP;
+    }
+    if (startsWith(header, size, "\x1f\x8b", 2))
+    {
+        return FileType::GZIP;
+    }
+    if (startsWith(header, size, "\x89PNG\r\n\x1a\n", 8))
+    {
+        return FileType::PNG;
+    }
+    if (startsWith(header, size, "\xff\xd8\xff", 3))
+    {
+        return FileType::JPEG;
+    }
+    if (startsWith(header, size, "GIF87a", 6) || startsWith(header, size, "GIF89a", 6))
+    {
+        return FileType::GIF;
+    }
+    if (startsWith(header, size, "ftyp", 4, 4))
+    {
+        return FileType::MP4;
+    }
+    if (startsWith(header, size, "#!", 2))
+    {
+        return FileType::SCRIPT;
+    }
+    if (isText(header, size))
+    {
+        return FileType::TEXT;
+    }
+    return FileType::UNKNOWN;
+}
+
+const char *asString(FileType type)
+{
+    switch (type)
+    {
+    case FileType::UNKNOWN:
+        return "unknown";
+    case FileType::TEXT:
+        return "text";
+    case FileType::SCRIPT:
+        return "script";
+    case FileType::ELF:
+        return "elf";
+    case FileType::PE:
+        return "pe";
+    case FileType::MACHO:
+        return "macho";
+    case FileType::PDF:
+        return "pdf";
+    case FileType::ZIP:
+        return "zip";
+    case FileType::GZIP:
+        return "gzip";
+    case FileType::PNG:
+        return "png";
+    case FileType::JPEG:
+        return "jpeg";
+    case FileType::GIF:
+        return "gif";
+    case FileType::MP4:
+        return "mp4";
+    }
+    return "";
+}
+
+bool parseFileTypes(const std::string &text, FileTypeMask &mask)
+{
+    mask = 0;
+    std::stringstream stream(text);
+    std::string name;
+    while (std::getline(stream, name, ','))
+    {
+        bool found = false;
+        for (size_t i = 0; i < FILE_TYPES_COUNT; i ++)
+        {
+            FileType type = static_cast<FileType>(i);
+            if (name == asString(type))
+            {
+                mask |= fileTypeBit(type);
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+    }
+    return mask != 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief The FileType enum lists types detected by magic numbers (@see sniffFileType).
+ */
+enum class FileType : uint8_t
+{
+    UNKNOWN = 0,
+    TEXT,
+    SCRIPT,
+    ELF,
+    PE,
+    MACHO,
+    PDF,
+    ZIP,
+    GZIP,
+    PNG,
+    JPEG,
+    GIF,
+    MP4,
+};
+
+const size_t FILE_TYPES_COUNT = 13;
+
+/**
+ * @brief FileTypeMask is a set of file types: bit N stands for FileType with value N.
+ */
+typedef uint32_t FileTypeMask;
+
+const FileTypeMask ALL_FILE_TYPES = (1u << FILE_TYPES_COUNT) - 1;
+
+inline FileTypeMask fileTypeBit(FileType type)
+{
+    return 1u << static_cast<uint8_t>(type);
+}
+
+/**
+ * @brief FILE_TYPE_SNIFF_SIZE bytes from file start are enough to detect file type.
+ */
+const size_t FILE_TYPE_SNIFF_SIZE = 512;
+
+/**
+ * @brief sniffFileType detects file type by its first bytes.
+ */
+FileType sniffFileType(const char *header, size_t size);
+
+const char *asString(FileType type);
+
+/**
+ * @brief parseFileTypes parses comma separated list of file type names (e.g. "pe,elf").
+ * @return false if unknown name is met.
+ */
+bool parseFileTypes(const std::string &text, FileTypeMask &mask);
@@ -1,10 +1,40 @@
 #pragma once
 
 #include <manager.h>
+#include <scheduler.h>
+#include <trace.h>
 #include <QtCore/QObject>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStringList>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusError>
+#include <QtDBus/QDBusMessage>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
 
 /**
  * @brief The ManagerDBusInterface is DBus interface for Manager class.
+ *
+ * Scan requests are not processed in the event loop thread: they are answered
+ * with delayed replies and passed to RequestScheduler (@see RequestScheduler).
+ * Requests dropped by stopped scheduler are replied with Failed error.
+ *
+ * File scans started by scanFileJob have job IDs chosen by client: they are unique
+ * per client connection. Such jobs may be cancelled and report progress by
+ * signals sent only to the client.
+ *
+ * Scan requests may be recorded to trace file for offline replay (@see TraceRecorder).
+ *
+ * Payloads of scanBytes are accounted in memory budget of the server from reception
+ * till reply: they are rejected with OUT_OF_MEMORY error at once if budget is exhausted
+ * (@see BufferPool). Queued payloads don't block file scans waiting for memory:
+ * they run in slots of waiting scans and release their memory.
+ *
+ * Methods with "In" suffix scan by comma separated databases hosted by the server
+ * (@see Manager::databaseMask), the rest ones scan by all databases. Methods with
+ * "PerDatabase" suffix also reply results split by requested databases.
  */
 class ManagerDBusInterface: public QObject
 {
@@ -12,19 +42,164 @@ class ManagerDBusInterface: public QObject
     Q_CLASSINFO("D-Bus Interface", DBUS_INTERFACE_NAME)
 
 public:
-    ManagerDBusInterface(Manager &manager)
+    /**
+     * @brief LARGE_FILE_SIZE files starting from this size are scanned with low priority.
+     */
+    static const qint64 LARGE_FILE_SIZE = 64*1024*1024;
+
+    /**
+     * @brief PROGRESS_INTERVAL minimal interval between progress signals of job in milliseconds.
+     */
+    static const int PROGRESS_INTERVAL = 250;
+
+    ManagerDBusInterface(Manager &manager, RequestScheduler &scheduler)
         : manager(manager)
+        , scheduler(scheduler)
     {}
 
 public slots:
-    ScannerResults scanBytes(const QByteArray byteArray)
+    ScannerResults scanBytes(const QByteArray byteArray, const QDBusMessage &message)
+    {
+        submitScanBytes(byteArray, message, ALL_DATABASES);
+        return ScannerResults();
+    }
+
+    ScannerResults scanFile(const QString &filename, const QDBusMessage &message)
+    {
+        submitScanFile(filename, message, std::make_shared<ScanControl>());
+        return ScannerResults();
+    }
+
+    /**
+     * @brief scanFileJob scans file as cancellable job with progress signals.
+     * Cancelled job replies with CANCELLED error and results found before.
+     * ID of running job of the same client is InvalidArgs error.
+     */
+    ScannerResults scanFileJob(const QString &filename, quint64 jobId, const QDBusMessage &message)
+    {
+        submitScanFileJob(filename, jobId, message, std::make_shared<ScanControl>());
+        return ScannerResults();
+    }
+
+    /**
+     * @brief scanBytesIn scans bytes by databases, unknown database is InvalidArgs error.
+     */
+    ScannerResults scanBytesIn(const QString &databases, const QByteArray byteArray, const QDBusMessage &message)
     {
-        return manager.scanBytes(byteArray.data(), byteArray.size());
+        DatabaseMask mask;
+        if (requestedDatabases(databases, message, mask))
+        {
+            submitScanBytes(byteArray, message, mask);
+        }
+        return ScannerResults();
     }
 
-    ScannerResults scanFile(const QString &filename)
+    ScannerResults scanFileIn(const QString &databases, const QString &filename, const QDBusMessage &message)
     {
-        return manager.scanFile(filename.toStdString());
+        auto control = std::make_shared<ScanControl>();
+        if (requestedDatabases(databases, message, control->databases))
+        {
+            submitScanFile(filename, message, control);
+        }
+        return ScannerResults();
+    }
+
+    ScannerResults scanFileJobIn(const QString &databases, const QString &filename, quint64 jobId,
+                                 const QDBusMessage &message)
+    {
+        auto control = std::make_shared<ScanControl>();
+        if (requestedDatabases(databases, message, control->databases))
+        {
+            submitScanFileJob(filename, jobId, message, control);
+        }
+        return ScannerResults();
+    }
+
+    /**
+     * @brief scanBytesPerDatabase scans bytes by databases, empty databases are all ones.
+     * @param databaseResults GUIDs found by each requested database.
+     */
+    ScannerResults scanBytesPerDatabase(const QString &databases, const QByteArray byteArray,
+                                        const QDBusMessage &message, DatabaseResults &databaseResults)
+    {
+        DatabaseMask mask;
+        if (requestedDatabases(databases, message, mask))
+        {
+            submitScanBytes(byteArray, message, mask, std::make_shared<DatabaseResults>());
+        }
+        databaseResults = DatabaseResults();
+        return ScannerResults();
+    }
+
+    ScannerResults scanFilePerDatabase(const QString &databases, const QString &filename,
+                                       const QDBusMessage &message, DatabaseResults &databaseResults)
+    {
+        auto control = std::make_shared<ScanControl>();
+        if (requestedDatabases(databases, message, control->databases))
+        {
+            submitScanFile(filename, message, control, splitReply(control));
+        }
+        databaseResults = DatabaseResults();
+        return ScannerResults();
+    }
+
+    ScannerResults scanFileJobPerDatabase(const QString &databases, const QString &filename, quint64 jobId,
+                                          const QDBusMessage &message, DatabaseResults &databaseResults)
+    {
+        auto control = std::make_shared<ScanControl>();
+        if (requestedDatabases(databases, message, control->databases))
+        {
+            submitScanFileJob(filename, jobId, message, control, splitReply(control));
+        }
+        databaseResults = DatabaseResults();
+        return ScannerResults();
+    }
+
+    /**
+     * @brief databases names of databases hosted by the server.
+     */
+    QStringList databases()
+    {
+        QStringList result;
+        for (const auto &val : manager.databaseNames())
+        {
+            result << QString::fromStdString(val);
+        }
+        return result;
+    }
+
+    /**
+     * @brief scanFileProfiled scans file measuring reading and scanning phases
+     * by hardware counters (@see ScanProfile).
+     * @param report text report of the request (@see ScanProfile::report).
+     */
+    ScannerResults scanFileProfiled(const QString &filename, const QDBusMessage &message, QString &report)
+    {
+        auto control = std::make_shared<ScanControl>();
+        auto profile = std::make_shared<ScanProfile>();
+        control->profile = profile.get();
+        submitScanFile(filename, message, control, [profile](QDBusMessage &reply)
+        {
+            reply << QString::fromStdString(profile->report());
+        });
+        report = QString();
+        return ScannerResults();
+    }
+
+    /**
+     * @brief cancel cancels job of the calling client.
+     * @return false if there is no such job (e.g. it's already finished).
+     */
+    bool cancel(quint64 jobId, const QDBusMessage &message)
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        auto it = jobs.find(JobKey(message.service().toStdString(), jobId));
+        if (it == jobs.end())
+        {
+            return false;
+        }
+        it->second->cancelled = true;
+        return true;
     }
 
     void setChunkSize(uint64_t sizeInBytes)
@@ -32,6 +207,272 @@ public slots:
         return manager.setChunkSize(sizeInBytes);
     }
 
+    void setMaxConcurrentRequests(uint count)
+    {
+        return scheduler.setMaxConcurrentRequests(count);
+    }
+
+    void setParallelReaders(uint count)
+    {
+        return manager.setParallelReaders(count);
+    }
+
+    /**
+     * @brief setMemoryBudget (@see Manager::setMemoryBudget).
+     * @param reject rejects requests instead of waiting when budget is exhausted.
+     */
+    void setMemoryBudget(quint64 sizeInBytes, bool reject)
+    {
+        return manager.setMemoryBudget(sizeInBytes, reject ? BudgetPolicy::REJECT : BudgetPolicy::BLOCK);
+    }
+
+    /**
+     * @brief bufferPoolStatus occupancy of memory budget (@see BufferPool::report).
+     */
+    QString bufferPoolStatus()
+    {
+        return QString::fromStdString(manager.bufferPool().report());
+    }
+
+    /**
+     * @brief startTrace starts recording of scan requests to trace file,
+     * previous trace is finished.
+     * @param hashContent records hashes of scanned content: files are read twice.
+     * @return false if file can't be created.
+     */
+    bool startTrace(const QString &filename, bool hashContent)
+    {
+        return trace.start(filename.toStdString(), hashContent);
+    }
+
+    void stopTrace()
+    {
+        trace.stop();
+    }
+
+    /**
+     * @brief setProfiling enables profiling of all requests (@see Manager::setProfiling).
+     */
+    void setProfiling(bool enabled)
+    {
+        return manager.setProfiling(enabled);
+    }
+
+    /**
+     * @brief profileReport report of all requests profiled since the previous call,
+     * the profile is reset.
+     */
+    QString profileReport()
+    {
+        QString report = QString::fromStdString(manager.profile().report());
+        manager.profile().reset();
+        return report;
+    }
+
+signals:
+    /**
+     * @brief progress of job started by scanFileJob. Declared for introspection only:
+     * it's sent as targeted signal to the client of job.
+     */
+    void progress(quint64 jobId, quint64 bytesDone, quint64 bytesTotal);
+
 private:
+    typedef std::pair<std::string, quint64> JobKey;
+
+    /**
+     * @brief requestedDatabases finds mask of databases requested by client,
+     * unknown database is replied with InvalidArgs error.
+     * @return false if error is replied.
+     */
+    bool requestedDatabases(const QString &databases, const QDBusMessage &message, DatabaseMask &mask)
+    {
+        if (manager.databaseMask(databases.toStdString(), mask))
+        {
+            return true;
+        }
+        message.setDelayedReply(true);
+        QDBusConnection::sessionBus().send(message.createErrorReply(QDBusError::InvalidArgs,
+                                                                    "Unknown database: " + databases));
+        return false;
+    }
+
+    /**
+     * @brief splitReply makes file scan fill results per database and appends them to reply.
+     */
+    static std::function<void(QDBusMessage &)> splitReply(std::shared_ptr<ScanControl> control)
+    {
+        auto databaseResults = std::make_shared<DatabaseResults>();
+        control->databaseResults = databaseResults.get();
+        return [databaseResults](QDBusMessage &reply)
+        {
+            reply << QVariant::fromValue(*databaseResults);
+        };
+    }
+
+    /**
+     * @param databaseResults optional results per database appended to reply.
+     */
+    void submitScanBytes(const QByteArray &byteArray, const QDBusMessage &message, DatabaseMask databases,
+                         std::shared_ptr<DatabaseResults> databaseResults = nullptr)
+    {
+        message.setDelayedReply(true);
+        QDBusConnection connection = QDBusConnection::sessionBus();
+        const auto started = TraceRecorder::now();
+        // the payload is already received: it's held till reply
+        auto reservation = std::make_shared<PooledBuffer>(
+                    manager.bufferPool().tryReserve(static_cast<uint64_t>(byteArray.size())));
+        if (!*reservation)
+        {
+            ScannerResults results(ResultError::OUT_OF_MEMORY, std::set<Guid>());
+            QDBusMessage reply = message.createReply(QVariant::fromValue(results));
+            if (databaseResults)
+            {
+                reply << QVariant::fromValue(DatabaseResults());
+            }
+            connection.send(reply);
+            return;
+        }
+        scheduler.submit(message.service().toStdString(), RequestPriority::HIGH,
+                         [this, byteArray, message, connection, started, databases, databaseResults, reservation]()
+        {
+            ScannerResults results = manager.scanBytes(byteArray.data(), byteArray.size(), databases,
+                                                       databaseResults.get());
+            QDBusMessage reply = message.createReply(QVariant::fromValue(results));
+            if (databaseResults)
+            {
+                reply << QVariant::fromValue(*databaseResults);
+            }
+            connection.send(reply);
+            const auto finished = TraceRecorder::now();
+            if (trace.isRecording())
+            {
+                TraceRecord record;
+                record.method = TraceMethod::SCAN_BYTES;
+                record.priority = RequestPriority::HIGH;
+                record.size = byteArray.size();
+                record.contentHash = trace.hashesContent()
+                        ? contentHash(byteArray.data(), byteArray.size())
+                        : 0;
+                recordTrace(message, started, finished, record, results);
+            }
+        }, droppedReply(message, connection));
+    }
+
+    void submitScanFileJob(const QString &filename, quint64 jobId, const QDBusMessage &message,
+                           std::shared_ptr<ScanControl> control,
+                           std::function<void(QDBusMessage &reply)> onFinished = std::function<void(QDBusMessage &)>())
+    {
+        const JobKey key(message.service().toStdString(), jobId);
+        {
+            // running job of the client can't be replaced: it couldn't be cancelled anymore
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            if (!jobs.insert({key, control}).second)
+            {
+                message.setDelayedReply(true);
+                QDBusConnection::sessionBus().send(message.createErrorReply(QDBusError::InvalidArgs,
+                                                                            "Job ID is already in use: "
+                                                                            + QString::number(jobId)));
+                return;
+            }
+        }
+
+        QDBusConnection connection = QDBusConnection::sessionBus();
+        QString client = message.service();
+        auto lastProgress = std::make_shared<std::chrono::steady_clock::time_point>();
+        control->onProgress = [connection, client, jobId, lastProgress](uint64_t bytesDone, uint64_t bytesTotal)
+        {
+            // throttled not to flood the bus, the last progress is always sent
+            const std::chrono::milliseconds interval(static_cast<int>(PROGRESS_INTERVAL));
+            auto now = std::chrono::steady_clock::now();
+            if (bytesDone < bytesTotal && now - *lastProgress < interval)
+            {
+                return;
+            }
+            *lastProgress = now;
+
+            QDBusMessage signal = QDBusMessage::createTargetedSignal(client, DBUS_PATH,
+                                                                     DBUS_INTERFACE_NAME, "progress");
+            signal << jobId << static_cast<quint64>(bytesDone) << static_cast<quint64>(bytesTotal);
+            connection.send(signal);
+        };
+
+        submitScanFile(filename, message, control, [this, key, onFinished](QDBusMessage &reply)
+        {
+            {
+                std::lock_guard<std::mutex> lock(jobsMutex);
+                jobs.erase(key);
+            }
+            if (onFinished)
+            {
+                onFinished(reply);
+            }
+        });
+    }
+
+    void submitScanFile(const QString &filename, const QDBusMessage &message,
+                        std::shared_ptr<ScanControl> control,
+                        std::function<void(QDBusMessage &reply)> onFinished = std::function<void(QDBusMessage &)>())
+    {
+        message.setDelayedReply(true);
+        QDBusConnection connection = QDBusConnection::sessionBus();
+        const auto started = TraceRecorder::now();
+        const qint64 fileSize = QFileInfo(filename).size();
+        RequestPriority priority = fileSize < LARGE_FILE_SIZE
+                ? RequestPriority::NORMAL
+                : RequestPriority::LOW;
+        control->onChunk = [this, priority]()
+        {
+            scheduler.yield(priority);
+        };
+        scheduler.submit(message.service().toStdString(), priority,
+                         [this, filename, message, connection, control, onFinished, started, priority, fileSize]()
+        {
+            ScannerResults results = manager.scanFile(filename.toStdString(), *control);
+            QDBusMessage reply = message.createReply(QVariant::fromValue(results));
+            if (onFinished)
+            {
+                onFinished(reply);
+            }
+            connection.send(reply);
+            const auto finished = TraceRecorder::now();
+            if (trace.isRecording())
+            {
+                TraceRecord record;
+                record.method = TraceMethod::SCAN_FILE;
+                record.priority = priority;
+                record.size = static_cast<uint64_t>(fileSize);
+                record.contentHash = trace.hashesContent() ? fileContentHash(filename.toStdString()) : 0;
+                recordTrace(message, started, finished, record, results);
+            }
+        }, droppedReply(message, connection));
+    }
+
+    /**
+     * @brief droppedReply replies to request dropped by stopped scheduler.
+     */
+    static RequestScheduler::Task droppedReply(const QDBusMessage &message, QDBusConnection connection)
+    {
+        return [message, connection]()
+        {
+            connection.send(message.createErrorReply(QDBusError::Failed, "Server is shutting down"));
+        };
+    }
+
+    /**
+     * @brief recordTrace records replied request (@see TraceRecorder::record).
+     */
+    void recordTrace(const QDBusMessage &message, std::chrono::steady_clock::time_point started,
+                     std::chrono::steady_clock::time_point finished, TraceRecord record,
+                     const ScannerResults &results)
+    {
+        record.error = results.error;
+        record.resultsCount = static_cast<uint32_t>(results.results.size());
+        trace.record(message.service().toStdString(), started, finished, record);
+    }
+
     Manager &manager;
+    RequestScheduler &scheduler;
+    std::mutex jobsMutex;
+    std::map<JobKey, std::shared_ptr<ScanControl>> jobs;
+    TraceRecorder trace;
 };
@@ -1,43 +1,23 @@
 #include <interface.h>
+#include <sequencesfile.h>
 #include <QCoreApplication>
 #include <QtDBus/QtDBus>
+#include <cstdlib>
 #include <iostream>
-#include <fstream>
 
-void updateSequencesFromFile(const std::string &filename,
-                             std::vector<ByteSequence> &byteSequences)
-{
-    byteSequences.clear();
-
-    std::cout << "updating byte sequences from file: " << filename << std::endl;
-
-    std::ifstream ifs(filename);
-    while (ifs)
-    {
-        std::string line;
-        if (!getline(ifs, line))
-        {
-            break;
-        }
-
-        size_t index = line.find(".{");
-        if (index > 0 && index != std::string::npos && line.back() == '}')
-        {
-            line.pop_back();
-            Guid guid = line.substr(index + 2);
-            Bytes bytes = line.erase(index);
-            byteSequences.push_back({bytes, guid});
-        }
-    }
+// default number of requests processed simultaneously
+const unsigned DEFAULT_MAX_CONCURRENT_REQUESTS = 2;
 
-    std::cout << "number of byte sequences = " << byteSequences.size() << std::endl;
-}
+// environment variables of memory budget in bytes and its policy ("block" or "reject")
+const char *MEMORY_BUDGET_VARIABLE = "SCANNER_MEMORY_BUDGET";
+const char *MEMORY_POLICY_VARIABLE = "SCANNER_MEMORY_POLICY";
 
 int main(int argc, char *argv[])
 {
     QCoreApplication application(argc, argv);
 
     qDBusRegisterMetaType<ScannerResults>();
+    qDBusRegisterMetaType<DatabaseResults>();
 
     if(!QDBusConnection::sessionBus().isConnected())
     {
@@ -48,27 +28,46 @@ int main(int argc, char *argv[])
     if (argc < 2)
     {
         std::cout << "please pass sequences file name in arguments" << std::endl;
+        std::cout << "usage: scanner <sequences file | name=file[,name=file...]> [policy file]" << std::endl;
+        std::cout << "memory budget: " << MEMORY_BUDGET_VARIABLE << "=<bytes> "
+                  << MEMORY_POLICY_VARIABLE << "=block|reject" << std::endl;
         return 1;
     }
 
-    if(!QFile(argv[1]).exists())
+    std::vector<SignatureDatabase> databases;
+    if (!loadDatabases(argv[1], databases))
     {
-        std::cout << "File doesn't exist!" << std::endl;
+        std::cout << "Empty sequences or not supported file!" << std::endl;
         return 1;
     }
 
-    std::vector<ByteSequence> byteSequences;
-    updateSequencesFromFile(argv[1], byteSequences);
-    if (byteSequences.empty())
+    Manager scannerManager(std::move(databases));
+
+    if (argc > 2)
     {
-        std::cout << "Empty sequences or not supported file!" << std::endl;
-        return 1;
+        ScanPolicy policy;
+        if (!policy.load(argv[2]))
+        {
+            std::cout << "Can't load policy file!" << std::endl;
+            return 1;
+        }
+        scannerManager.setPolicy(policy);
+    }
+
+    const char *budgetString = std::getenv(MEMORY_BUDGET_VARIABLE);
+    if (budgetString != nullptr)
+    {
+        const char *policyString = std::getenv(MEMORY_POLICY_VARIABLE);
+        const bool reject = policyString != nullptr && std::string(policyString) == asString(BudgetPolicy::REJECT);
+        scannerManager.setMemoryBudget(std::strtoull(budgetString, nullptr, 10),
+                                       reject ? BudgetPolicy::REJECT : BudgetPolicy::BLOCK);
     }
 
-    Manager scannerManager(std::move(byteSequences));
-    ManagerDBusInterface wrapper(scannerManager);
+    RequestScheduler scheduler(DEFAULT_MAX_CONCURRENT_REQUESTS);
+    ManagerDBusInterface wrapper(scannerManager, scheduler);
     if (QDBusConnection::sessionBus().registerObject(DBUS_PATH, &wrapper,
-                                                     QDBusConnection::ExportAllSlots))
+                                                     QDBusConnection::ExportAllSlots
+                                                     | QDBusConnection::ExportAllSignals))
     {
         std::cout << "object registered successfully!.." << std::endl;
     }
@@ -91,6 +90,8 @@ int main(int argc, char *argv[])
     }
 
     application.exec();
+    // tasks use the wrapper: they are finished or replied with error before it's destroyed
+    scheduler.stop();
     return 0;
 }
 
@@ -1,12 +1,134 @@
 #include <manager.h>
+#include <algorithm>
 #include <iostream>
 #include <limits>
 #include <sstream>
 #include <cassert>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <unistd.h>
 
 namespace
 {
+// size of the first read of file: enough for file type and container sniffing
+const size_t PRE_READ_SIZE = 4096;
+static_assert(PRE_READ_SIZE >= FILE_TYPE_SNIFF_SIZE && PRE_READ_SIZE >= CONTAINER_SNIFF_SIZE,
+              "pre-read is too small for sniffing");
+
+// regions closer than this gap are read from file at once
+const uint64_t REGION_MERGE_GAP = 64*1024;
+
+/**
+ * @brief groupWindow calculates bytes range [first, last) of data
+ * which may contain sequences of the group.
+ * @return false if there is no such range.
+ */
+bool groupWindow(const AnchoredGroup &group, uint64_t dataSize, uint64_t &first, uint64_t &last)
+{
+    bool found = false;
+    for (const auto &val : group.signatures)
+    {
+        uint64_t positionFirst, positionLast;
+        if (group.anchor.positions(dataSize, val.size(), positionFirst, positionLast))
+        {
+            first = found ? std::min(first, positionFirst) : positionFirst;
+            last = found ? std::max(last, positionLast + val.size()) : positionLast + val.size();
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief scanWindow checks sequences of the group in window of data.
+ * Only positions where sequence fits in the window entirely are checked.
+ * @param window bytes of data starting from windowOffset.
+ */
+void scanWindow(const AnchoredGroup &group, const SignatureStore &store, const char *window,
+                uint64_t windowOffset, uint64_t windowSize, uint64_t dataSize,
+                const SignatureFilter &filter, FoundGuids &results)
+{
+    for (const auto &val : group.signatures)
+    {
+        uint64_t first, last;
+        if (windowSize < val.size() || !val.appliesTo(filter)
+                || !group.anchor.positions(dataSize, val.size(), first, last))
+        {
+            continue;
+        }
+
+        first = std::max(first, windowOffset);
+        last = std::min(last, windowOffset + windowSize - val.size());
+        for (uint64_t position = first; position <= last; position ++)
+        {
+            uint64_t offset = position - windowOffset;
+            if (val.find(window + offset, windowSize - offset))
+            {
+                results[store.guid(val.guidId)] |= val.databases & filter.databases;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief singleDatabase makes database named DEFAULT_DATABASE_NAME of sequences.
+ */
+std::vector<SignatureDatabase> singleDatabase(std::vector<ByteSequence> &&byteSequences)
+{
+    std::vector<SignatureDatabase> databases(1);
+    databases[0].name = DEFAULT_DATABASE_NAME;
+    databases[0].byteSequences = std::move(byteSequences);
+    return databases;
+}
+
+bool lessSequence(const ByteSequence &a, const ByteSequence &b)
+{
+    if (a.bytes() != b.bytes())
+    {
+        return a.bytes() < b.bytes();
+    }
+    if (a.guid() != b.guid())
+    {
+        return a.guid() < b.guid();
+    }
+    if (!(a.anchor() == b.anchor()))
+    {
+        return a.anchor() < b.anchor();
+    }
+    return a.fileTypes() < b.fileTypes();
+}
+
+/**
+ * @brief preadChunk reads up to size bytes at offset, short read means end of file.
+ * @return bytes count read or -1 on error.
+ */
+ssize_t preadChunk(int fd, char *buffer, size_t size, uint64_t offset)
+{
+    size_t total = 0;
+    while (total < size)
+    {
+        ssize_t actuallyRead = pread(fd, buffer + total, size - total, static_cast<off_t>(offset + total));
+        if (actuallyRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (actuallyRead < 0)
+        {
+            return -1;
+        }
+        if (actuallyRead == 0)
+        {
+            break;
+        }
+        total += static_cast<size_t>(actuallyRead);
+    }
+    return static_cast<ssize_t>(total);
+}
+
 std::string generateOutput(const ScannerResults &scannerResults)
 {
     std::stringstream resultString;
@@ -27,175 +149,900 @@ std::string generateOutput(const ScannerResults &scannerResults)
 }
 }
 
-Manager::Manager(std::vector<ByteSequence> &&byteSequences)
-    : m_byteSequences(byteSequences)
+const uint64_t Manager::MIN_CHUNK_SIZE;
+
+Manager::Manager(std::vector<ByteSequence> &&byteSequences, unsigned threadsCount)
+    : Manager(singleDatabase(std::move(byteSequences)), threadsCount)
 {
-    if (m_byteSequences.size() == 0)
+}
+
+Manager::Manager(std::vector<SignatureDatabase> &&databases, unsigned threadsCount)
+    : m_maxSequenceSize(0)
+    , m_parallelReaders(0)
+    , m_profiling(false)
+{
+    std::vector<DatabaseMask> masks;
+    std::vector<ByteSequence> byteSequences = mergeDatabases(databases, masks);
+    std::vector<SignatureDatabase>().swap(databases);
+
+    if (byteSequences.size() == 0)
     {
         assert(false);
         std::cout << "zero sequences - initialization finished!" << std::endl;
         return;
     }
 
-    unsigned cores = std::min(std::thread::hardware_concurrency(),
-                              m_byteSequences.size());
-    assert(cores > 0);
-    std::cout << "number of cores = " << cores << std::endl;
+    // bytes and GUIDs are stored once: definitions aren't needed anymore
+    std::vector<Signature> signatures;
+    m_signatureStore.reset(new SignatureStore(byteSequences, signatures));
+    for (size_t i = 0; i < signatures.size(); i ++)
+    {
+        signatures[i].databases = masks[i];
+    }
+    std::vector<Anchor> anchors;
+    anchors.reserve(byteSequences.size());
+    for (const auto &val : byteSequences)
+    {
+        anchors.push_back(val.anchor());
+    }
+    std::vector<ByteSequence>().swap(byteSequences);
 
     //sort array such that first was the longest bytes array
-    std::sort(m_byteSequences.begin(), m_byteSequences.end(),
-              [](const ByteSequence &a, const ByteSequence &b)->bool
+    std::vector<size_t> order(signatures.size());
+    for (size_t i = 0; i < order.size(); i ++)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&signatures](size_t a, size_t b)->bool
     {
-        return a.size() > b.size();
+        return signatures[a].size() > signatures[b].size();
     });
+    m_maxSequenceSize = signatures[order[0]].size();
     std::cout << "byte arrays initialized" << std::endl;
 
-    // create groups of byte arrays such way that total size of array sums
-    // in different groups were more or less equal.
-    m_scannersPool.resize(cores);
-    for (size_t index = 0; index < m_byteSequences.size(); index ++)
+    // anchored sequences are checked in their regions only: group them by anchor
+    std::vector<Signature> unanchoredSequences;
+    std::map<Anchor, size_t> anchoredGroupsIndex;
+    for (auto index : order)
     {
-        unsigned minimalGroup = std::numeric_limits<unsigned>::max();
-        unsigned minimalSize = std::numeric_limits<unsigned>::max();
-        for (unsigned i = 0; i < cores; i ++)
+        const Anchor &anchor = anchors[index];
+        if (anchor.type == Anchor::Type::NONE)
         {
-            std::vector<ByteSequence> &currentGroup = m_scannersPool[i].byteSequences;
-            unsigned totalSize = 0;
-            for (auto it : currentGroup)
-            {
-                totalSize += it.size();
-            }
+            unanchoredSequences.push_back(signatures[index]);
+            continue;
+        }
 
-            if (minimalSize > totalSize)
-            {
-                minimalSize = totalSize;
-                minimalGroup = i;
-            }
+        auto it = anchoredGroupsIndex.find(anchor);
+        if (it == anchoredGroupsIndex.end())
+        {
+            it = anchoredGroupsIndex.insert({anchor, m_anchoredGroups.size()}).first;
+            m_anchoredGroups.push_back({anchor, {}});
         }
+        m_anchoredGroups[it->second].signatures.push_back(signatures[index]);
+    }
+    std::cout << "anchored groups = " << m_anchoredGroups.size()
+              << ", unanchored arrays = " << unanchoredSequences.size() << std::endl;
 
-        assert(minimalGroup != std::numeric_limits<unsigned>::max());
-        m_scannersPool[minimalGroup].byteSequences.push_back(m_byteSequences[index]);
+    if (threadsCount == 0)
+    {
+        threadsCount = std::thread::hardware_concurrency();
+    }
+    unsigned cores = std::min<size_t>(threadsCount, unanchoredSequences.size());
+    std::cout << "number of cores = " << cores << std::endl;
+
+    // create groups of byte arrays such way that total size of array sums
+    // in different groups were more or less equal.
+    m_scannersPool.resize(cores);
+    std::vector<uint64_t> groupSizes(cores, 0);
+    for (const auto &val : unanchoredSequences)
+    {
+        size_t minimalGroup = std::min_element(groupSizes.begin(), groupSizes.end()) - groupSizes.begin();
+        m_scannersPool[minimalGroup].signatures.push_back(val);
+        groupSizes[minimalGroup] += val.size();
+    }
+    for (auto &val : m_scannersPool)
+    {
+        val.prepare();
+    }
+    // the first scanner works in calling thread
+    for (size_t i = 1; i < cores; i ++)
+    {
+        m_scannerThreads.emplace_back(new ScannerThread(m_scannersPool[i]));
     }
 
     // printout grouping results
     std::cout << "created scanner pool in size = " << cores << ": " << std::endl;
     for (size_t i = 0; i < cores; i ++)
     {
-        std::vector<ByteSequence> &current = m_scannersPool[i].byteSequences;
-        uint64_t totalSize = 0;
-        for (const auto &val : current)
+        std::cout << i << ": arrays = " << m_scannersPool[i].signatures.size()
+                  << ", total size = " << groupSizes[i] << std::endl;
+    }
+
+    const SignatureFootprint &footprint = m_signatureStore->footprint();
+    std::cout << "sequences memory: " << footprint.sequencesCount << " sequences of "
+              << footprint.sequencesBytes << " bytes stored in " << footprint.storedBytes
+              << " bytes (" << footprint.sharedSequences << " shared), "
+              << footprint.guidsCount << " GUIDs; footprint before = " << footprint.before
+              << " bytes, after = " << footprint.after << " bytes" << std::endl;
+
+    setChunkSize(16*1024*1024); // default: 16 MB
+}
+
+std::vector<ByteSequence> Manager::mergeDatabases(std::vector<SignatureDatabase> &databases,
+                                                  std::vector<DatabaseMask> &masks)
+{
+    struct Entry
+    {
+        ByteSequence *sequence;
+        DatabaseMask mask;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t sequencesCount = 0;
+    for (auto &val : databases)
+    {
+        if (m_databaseNames.size() == MAX_DATABASES_COUNT
+                || std::find(m_databaseNames.begin(), m_databaseNames.end(), val.name) != m_databaseNames.end())
         {
-            totalSize += val.size();
+            std::cout << "too many databases or duplicate name, database skipped: " << val.name << std::endl;
+            continue;
         }
-        std::cout << i << ": arrays = " << current.size() << ", total size = " << totalSize << std::endl;
+        const DatabaseMask mask = DatabaseMask(1) << m_databaseNames.size();
+        m_databaseNames.push_back(val.name);
+        for (auto &sequence : val.byteSequences)
+        {
+            entries.push_back({&sequence, mask});
+        }
+        sequencesCount += val.byteSequences.size();
     }
 
-    setChunkSize(16*1024*1024); // default: 16 MB
+    // equal sequences are adjacent in sorted order: the first one in order of
+    // databases takes masks of equal ones from other databases. Duplicates inside
+    // one database are kept as they are, like in single set.
+    std::vector<size_t> order(entries.size());
+    for (size_t i = 0; i < order.size(); i ++)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&entries](size_t a, size_t b)
+    {
+        return lessSequence(*entries[a].sequence, *entries[b].sequence);
+    });
+    std::vector<bool> duplicates(entries.size(), false);
+    for (size_t i = 1, owner = 0; i < order.size(); i ++)
+    {
+        if (lessSequence(*entries[order[owner]].sequence, *entries[order[i]].sequence))
+        {
+            owner = i;
+        }
+        else if ((entries[order[owner]].mask & entries[order[i]].mask) == 0)
+        {
+            entries[order[owner]].mask |= entries[order[i]].mask;
+            duplicates[order[i]] = true;
+        }
+    }
+
+    std::vector<ByteSequence> result;
+    for (size_t i = 0; i < entries.size(); i ++)
+    {
+        if (!duplicates[i])
+        {
+            result.push_back(std::move(*entries[i].sequence));
+            masks.push_back(entries[i].mask);
+        }
+    }
+
+    std::cout << "databases = " << m_databaseNames.size() << ", sequences = " << sequencesCount
+              << ", after merging equal ones = " << result.size() << std::endl;
+    return result;
 }
 
-ScannerResults Manager::scanBytes(const void *firstByte, uint64_t sizeInBytes)
+bool Manager::databaseMask(const std::string &names, DatabaseMask &mask) const
+{
+    if (names.empty())
+    {
+        mask = ALL_DATABASES;
+        return true;
+    }
+
+    mask = 0;
+    std::stringstream stream(names);
+    std::string name;
+    while (getline(stream, name, ','))
+    {
+        auto it = std::find(m_databaseNames.begin(), m_databaseNames.end(), name);
+        if (it == m_databaseNames.end())
+        {
+            return false;
+        }
+        mask |= DatabaseMask(1) << (it - m_databaseNames.begin());
+    }
+    return mask != 0;
+}
+
+ScannerResults Manager::scanBytes(const void *firstByte, uint64_t sizeInBytes,
+                                  DatabaseMask databases, DatabaseResults *databaseResults)
 {
     std::cout << "scanning memory block of size " << sizeInBytes << " bytes.. ";
-    ScannerResults results = scanMemoryBlock({firstByte, sizeInBytes});
+
+    const char *bytes = reinterpret_cast<const char *>(firstByte);
+    const SignatureFilter filter = {fileTypeBit(sniffFileType(bytes,
+            std::min<uint64_t>(sizeInBytes, FILE_TYPE_SNIFF_SIZE))), databases};
+    ScanProfile *profile = m_profiling ? &m_profile : nullptr;
+    ScannerResults results;
+    results.size = sizeInBytes;
+    FoundGuids found = scanMemoryBlock({firstByte, sizeInBytes}, filter, profile);
+
+    {
+        ProfileScope profileScope(profile, ProfilePhase::SCAN);
+        for (const auto &val : m_anchoredGroups)
+        {
+            scanWindow(val, *m_signatureStore, bytes, 0, sizeInBytes, sizeInBytes, filter, found);
+        }
+    }
+
+    if (m_unpackLimits.maxDepth > 0 && !m_scannersPool.empty()
+            && sniffContainer(bytes, sizeInBytes) != ContainerType::NONE)
+    {
+        std::mutex resultsMutex;
+        UnpackContext unpackContext(m_unpackLimits, sizeInBytes, chunkSize, overlap(), m_bufferPool,
+                                    collectResults(found, resultsMutex, databases, nullptr, profile));
+        std::unique_ptr<DataSink> unpackSink = unpackContext.createSink(0, false);
+        unpackSink->write(bytes, sizeInBytes);
+        unpackSink->finish();
+        if (unpackContext.outOfMemory())
+        {
+            results.error = ResultError::OUT_OF_MEMORY;
+        }
+        else if (unpackContext.limitExceeded())
+        {
+            results.error = ResultError::ARCHIVE_LIMIT_EXCEEDED;
+        }
+    }
+
+    splitResults(found, databases, results.results, databaseResults);
     std::cout << generateOutput(results) << std::endl;
     return results;
 }
 
-ScannerResults Manager::scanFile(const std::string &filename)
+ScannerResults Manager::scanFile(const std::string &filename, const ScanControl &control)
 {
     std::cout << "scanning file: " << filename << ".. ";
 
+    if (control.cancelled)
+    {
+        // cancelled before start (e.g. waiting in queue)
+        std::cout << "cancelled" << std::endl;
+        return ScannerResults(ResultError::CANCELLED, std::set<Guid>());
+    }
+
+    // take local copies: chunk size may be changed by another request
+    const uint64_t chunkSize = this->chunkSize;
+    const uint64_t overlap = this->overlap();
+
     ScannerResults resultsCollector;
-    char *buffer = new char[readSize];
+    // results of requested databases: split at exit
+    FoundGuids found;
+    SignatureFilter filter = {ALL_FILE_TYPES, control.databases};
+    // taken from pool when file size is known
+    PooledBuffer buffer;
     bool readMore = true;
     FILE *file = nullptr;
     uint32_t counter = 0;
 
+    // archives and compressed files are unpacked in parallel with reading
+    ContainerType containerType = ContainerType::NONE;
+    std::mutex resultsMutex;
+    std::unique_ptr<UnpackContext> unpackContext;
+    std::unique_ptr<DataSink> unpackSink;
+
+    // request is measured separately and added to requested profiles at exit
+    ScanProfile requestProfile;
+    ScanProfile *profile = control.profile != nullptr || m_profiling ? &requestProfile : nullptr;
+
+    // empty output string means results
     auto destroyAndExit = [&](const std::string &outputString)
     {
+        splitResults(found, control.databases, resultsCollector.results, control.databaseResults);
         if (file != nullptr)
         {
             fclose(file);
         }
-        if (buffer != nullptr)
+        buffer.release();
+        if (control.profile != nullptr)
         {
-            delete [] buffer;
+            control.profile->merge(requestProfile);
         }
-        std::cout << outputString << std::endl;
+        if (m_profiling)
+        {
+            m_profile.merge(requestProfile);
+        }
+        std::cout << (outputString.empty() ? generateOutput(resultsCollector) : outputString) << std::endl;
     };
 
     file = fopen(filename.c_str(), "rb");
     if (file == nullptr)
     {
+        resultsCollector.error = ResultError::CAN_NOT_OPEN_FILE;
         destroyAndExit("can't open file!");
         return resultsCollector;
     }
 
-    do
+    const long endPosition = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (endPosition < 0)
+    {
+        resultsCollector.error = ResultError::FILE_READ_ERROR;
+        destroyAndExit("can't get file size!");
+        return resultsCollector;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(endPosition);
+    resultsCollector.size = fileSize;
+
+    // one small read of file start is enough for file type, policy decision and container type:
+    // skipped files take no read buffer from pool
+    char header[PRE_READ_SIZE];
+    size_t headerSize = 0;
+    bool positioned;
     {
-        if (fseek(file, counter*chunkSize, SEEK_SET) != 0)
+        ProfileScope profileScope(profile, ProfilePhase::READ);
+        positioned = fseek(file, 0, SEEK_SET) == 0;
+        if (positioned)
+        {
+            headerSize = fread(header, 1, sizeof(header), file);
+        }
+    }
+    if (!positioned)
+    {
+        resultsCollector.error = ResultError::FILE_READ_ERROR;
+        destroyAndExit("SEEK ERROR on reading header");
+        return resultsCollector;
+    }
+    const FileType fileType = sniffFileType(header, std::min(headerSize, FILE_TYPE_SNIFF_SIZE));
+    filter.fileTypes = fileTypeBit(fileType);
+    const ScanAction action = m_policy.decide(filename, fileSize, fileType);
+    if (action == ScanAction::SKIP)
+    {
+        destroyAndExit(std::string("skipped by policy, file type: ") + asString(fileType));
+        return resultsCollector;
+    }
+
+    // bytes count from file start to scan
+    uint64_t scanSize = std::numeric_limits<uint64_t>::max();
+    if (action == ScanAction::HEADERS_ONLY)
+    {
+        scanSize = std::min(fileSize, m_policy.headerSize());
+    }
+
+    // read buffer is not longer than scanned part of file, under memory pressure it's shrunk:
+    // chunks of reading are smaller then
+    const uint64_t wantedChunkSize = std::max<uint64_t>(std::min(chunkSize, std::min(fileSize, scanSize)), 1);
+    // the waiting request lets others run in its scheduler slot
+    buffer = m_bufferPool.acquire(wantedChunkSize + overlap, std::min(wantedChunkSize, MIN_CHUNK_SIZE) + overlap,
+                                  &control.cancelled, control.onChunk);
+    if (!buffer)
+    {
+        resultsCollector.error = control.cancelled ? ResultError::CANCELLED : ResultError::OUT_OF_MEMORY;
+        destroyAndExit(control.cancelled ? "cancelled" : "out of memory budget");
+        return resultsCollector;
+    }
+    const uint64_t readChunkSize = buffer.size() - overlap;
+    const size_t readSize = buffer.size();
+
+    if (!scanRegions(file, fileSize, readChunkSize, buffer.data(), filter, found, profile))
+    {
+        resultsCollector.error = ResultError::SEEK_ERROR;
+        destroyAndExit("SEEK ERROR on reading regions");
+        return resultsCollector;
+    }
+
+    if (m_scannersPool.empty())
+    {
+        // all sequences are anchored: the rest of file is not needed
+        destroyAndExit(std::string());
+        return resultsCollector;
+    }
+
+    if (scanSize <= headerSize)
+    {
+        // already read
+        ResultsAggregator aggregator = createAggregator();
+        scanMemoryBlock({header, scanSize}, filter, aggregator, nullptr, profile);
+        collectGuids(aggregator, control.databases, found);
+        destroyAndExit(std::string());
+        return resultsCollector;
+    }
+
+    if (m_unpackLimits.maxDepth > 0 && action == ScanAction::FULL)
+    {
+        containerType = sniffContainer(header, headerSize);
+        if (containerType != ContainerType::NONE)
+        {
+            // zip members are unpacked in parallel already: their blocks don't start pool threads
+            unpackContext.reset(new UnpackContext(m_unpackLimits, fileSize, chunkSize, overlap, m_bufferPool,
+                                                  collectResults(found, resultsMutex, control.databases,
+                                                                 &control.cancelled, profile,
+                                                                 containerType == ContainerType::ZIP),
+                                                  &control.cancelled));
+            // zip members are unpacked after reading using central directory
+            if (containerType != ContainerType::ZIP)
+            {
+                unpackSink = unpackContext->createSink(0, false);
+            }
+        }
+    }
+
+    const uint64_t totalSize = std::min(fileSize, scanSize);
+    const unsigned parallelReaders = m_parallelReaders;
+    if (parallelReaders > 1 && !unpackSink && totalSize > readChunkSize)
+    {
+        // chunk ranges are read and scanned by several workers at once
+        if (!scanChunksParallel(fileno(file), totalSize, readChunkSize, filter, parallelReaders,
+                                buffer.data(), control, found, profile))
+        {
+            resultsCollector.error = ResultError::SEEK_ERROR;
+            destroyAndExit("READ ERROR in parallel reading");
+            return resultsCollector;
+        }
+        readMore = false;
+    }
+
+    // results of all chunks are collected at once after reading
+    ResultsAggregator aggregator = createAggregator();
+    while (readMore)
+    {
+        if (fseek(file, counter*readChunkSize, SEEK_SET) != 0)
         {
             destroyAndExit(std::string("SEAK ERROR on teration No.") + std::to_string(counter));
             return resultsCollector;
         }
+        uint64_t offset = static_cast<uint64_t>(counter)*readChunkSize;
         counter ++;
 
-        size_t actuallyRead = fread(buffer, 1, readSize, file);
-        if (actuallyRead < readSize)
+        size_t toRead = static_cast<size_t>(std::min<uint64_t>(readSize, scanSize - offset));
+        size_t actuallyRead;
+        {
+            ProfileScope profileScope(profile, ProfilePhase::READ);
+            actuallyRead = fread(buffer.data(), 1, toRead, file);
+        }
+        if (actuallyRead < readSize || offset + readChunkSize >= scanSize)
         {
             readMore = false;
         }
 
-        ScannerResults tempResults = scanMemoryBlock({buffer, static_cast<uint64_t>(actuallyRead)});
-        resultsCollector.error = tempResults.error;
-        if (resultsCollector.error != ResultError::SUCCESS)
+        scanMemoryBlock({buffer.data(), static_cast<uint64_t>(actuallyRead)}, filter, aggregator,
+                        &control.cancelled, profile);
+
+        // only new bytes: overlapped ones have been passed with previous chunk
+        if (unpackSink && !unpackSink->write(buffer.data(), readMore ? readChunkSize : actuallyRead))
         {
-            destroyAndExit("EMPTY");
-            return resultsCollector;
+            unpackSink->finish();
+            unpackSink.reset();
         }
 
-        resultsCollector.results.insert(tempResults.results.begin(), tempResults.results.end());
+        if (control.onProgress)
+        {
+            control.onProgress(readMore ? offset + readChunkSize : offset + actuallyRead, totalSize);
+        }
+
+        if (control.cancelled)
+        {
+            resultsCollector.error = ResultError::CANCELLED;
+            readMore = false;
+        }
+
+        if (readMore && control.onChunk)
+        {
+            control.onChunk();
+        }
     }
-    while (readMore);
 
-    destroyAndExit(generateOutput(resultsCollector));
+    collectGuids(aggregator, control.databases, found);
+
+    if (unpackSink)
+    {
+        unpackSink->finish();
+    }
+
+    if (containerType == ContainerType::ZIP && !control.cancelled
+            && !unpackZipFile(*unpackContext, filename, m_scannersPool.size()))
+    {
+        // no central directory: unpack members sequentially by local headers,
+        // nothing is unpacked yet, so context is replaced by one scanning with pool threads
+        unpackContext.reset(new UnpackContext(m_unpackLimits, fileSize, chunkSize, overlap, m_bufferPool,
+                                              collectResults(found, resultsMutex, control.databases,
+                                                             &control.cancelled, profile),
+                                              &control.cancelled));
+        unpackSink = unpackContext->createSink(0, false);
+        if (fseek(file, 0, SEEK_SET) != 0)
+        {
+            resultsCollector.error = ResultError::FILE_READ_ERROR;
+        }
+        size_t actuallyRead;
+        while (resultsCollector.error == ResultError::SUCCESS
+               && (actuallyRead = fread(buffer.data(), 1, readChunkSize, file)) > 0
+               && unpackSink->write(buffer.data(), actuallyRead))
+        {
+        }
+        unpackSink->finish();
+    }
+
+    if (control.cancelled)
+    {
+        // unpacked blocks may have been skipped too
+        resultsCollector.error = ResultError::CANCELLED;
+    }
+    else if (unpackContext && unpackContext->outOfMemory())
+    {
+        resultsCollector.error = ResultError::OUT_OF_MEMORY;
+    }
+    else if (unpackContext && unpackContext->limitExceeded())
+    {
+        resultsCollector.error = ResultError::ARCHIVE_LIMIT_EXCEEDED;
+    }
+
+    destroyAndExit(std::string());
     return resultsCollector;
 }
 
+void Manager::setPolicy(const ScanPolicy &policy)
+{
+    m_policy = policy;
+}
+
+void Manager::setUnpackLimits(const UnpackLimits &limits)
+{
+    m_unpackLimits = limits;
+}
+
+void Manager::setParallelReaders(unsigned readers)
+{
+    std::cout << "Set parallel readers count to " << readers << std::endl;
+    m_parallelReaders = readers;
+}
+
+void Manager::setMemoryBudget(uint64_t sizeInBytes, BudgetPolicy policy)
+{
+    std::cout << "Set memory budget to " << sizeInBytes << " bytes, " << asString(policy)
+              << " requests on exhaustion" << std::endl;
+    m_bufferPool.setBudget(sizeInBytes, policy);
+}
+
+void Manager::setProfiling(bool enabled)
+{
+    std::cout << (enabled ? "Enable" : "Disable") << " profiling" << std::endl;
+    m_profiling = enabled;
+}
+
+const SignatureFootprint &Manager::signatureFootprint() const
+{
+    static const SignatureFootprint empty;
+    return m_signatureStore ? m_signatureStore->footprint() : empty;
+}
+
+uint64_t Manager::overlap() const
+{
+    return m_maxSequenceSize > 0 ? m_maxSequenceSize - 1 : 0;
+}
+
 void Manager::setChunkSize(uint64_t sizeInBytes)
 {
     std::cout << "Set chunk size to " << sizeInBytes << " bytes" << std::endl;
     chunkSize = sizeInBytes;
-    readSize = chunkSize + m_byteSequences[0].size() - 1;
 }
 
-ScannerResults Manager::scanMemoryBlock(MemoryBlock memoryBlock)
+bool Manager::scanRegions(FILE *file, uint64_t fileSize, uint64_t chunkSize, char *buffer,
+                          const SignatureFilter &filter, FoundGuids &results,
+                          ScanProfile *profile) const
 {
-    std::set<Guid> collectedResults;
-    collectedResults.clear();
+    struct Window
+    {
+        uint64_t first;
+        uint64_t last;
+        size_t group;
+    };
 
-    std::vector<std::thread> threads;
-    threads.reserve(m_scannersPool.size());
+    std::vector<Window> windows;
+    for (size_t i = 0; i < m_anchoredGroups.size(); i ++)
+    {
+        Window window;
+        window.group = i;
+        if (groupWindow(m_anchoredGroups[i], fileSize, window.first, window.last))
+        {
+            windows.push_back(window);
+        }
+    }
+    std::sort(windows.begin(), windows.end(), [](const Window &a, const Window &b)
+    {
+        return a.first < b.first;
+    });
 
-    for (auto &val : m_scannersPool)
+    const uint64_t overlap = this->overlap();
+    for (size_t i = 0; i < windows.size();)
+    {
+        // merge close windows to read them at once
+        uint64_t first = windows[i].first;
+        uint64_t last = windows[i].last;
+        size_t next = i + 1;
+        while (next < windows.size() && windows[next].first <= last + REGION_MERGE_GAP)
+        {
+            last = std::max(last, windows[next].last);
+            next ++;
+        }
+
+        // big ranges are read by chunks the same way as whole file
+        for (uint64_t offset = first; offset < last; offset += chunkSize)
+        {
+            const size_t bufferSize = static_cast<size_t>(std::min(chunkSize + overlap, last - offset));
+            {
+                ProfileScope profileScope(profile, ProfilePhase::READ);
+                if (fseek(file, offset, SEEK_SET) != 0
+                        || fread(buffer, 1, bufferSize, file) != bufferSize)
+                {
+                    return false;
+                }
+            }
+
+            ProfileScope profileScope(profile, ProfilePhase::SCAN);
+            for (size_t j = i; j < next; j ++)
+            {
+                scanWindow(m_anchoredGroups[windows[j].group], *m_signatureStore, buffer, offset,
+                           bufferSize, fileSize, filter, results);
+            }
+
+            if (offset + bufferSize == last)
+            {
+                break;
+            }
+        }
+        i = next;
+    }
+    return true;
+}
+
+cb_block Manager::collectResults(FoundGuids &collector, std::mutex &mutex, DatabaseMask databases,
+                                 const std::atomic<bool> *cancelled, ScanProfile *profile,
+                                 bool inCurrentThread)
+{
+    return [this, &collector, &mutex, databases, cancelled, profile, inCurrentThread](MemoryBlock memoryBlock)
+    {
+        if (cancelled && cancelled->load())
+        {
+            return;
+        }
+        ResultsAggregator aggregator = createAggregator();
+        scanMemoryBlock(memoryBlock, {ALL_FILE_TYPES, databases}, aggregator, cancelled, profile,
+                        inCurrentThread);
+        FoundGuids results;
+        collectGuids(aggregator, databases, results);
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto &val : results)
+        {
+            collector[val.first] |= val.second;
+        }
+    };
+}
+
+bool Manager::scanChunksParallel(int fd, uint64_t scanSize, uint64_t chunkSize, const SignatureFilter &filter,
+                                 unsigned readers, char *buffer, const ScanControl &control,
+                                 FoundGuids &results, ScanProfile *profile)
+{
+    const uint64_t overlap = this->overlap();
+    const uint64_t chunksCount = (scanSize + chunkSize - 1)/chunkSize;
+    // readers count is device queue depth, workers keep all cores busy by scanning
+    unsigned workers = std::max(readers, static_cast<unsigned>(m_scannersPool.size()));
+    workers = static_cast<unsigned>(std::min<uint64_t>(workers, chunksCount));
+
+    // the first worker uses buffer of request, the others get ones which fit into budget now
+    std::vector<PooledBuffer> buffers;
+    for (unsigned i = 1; i < workers; i ++)
     {
-        auto scannerResult = [this, &collectedResults](ResultError error, std::set<Guid> &&results)
+        PooledBuffer pooledBuffer = m_bufferPool.tryAcquire(chunkSize + overlap);
+        if (!pooledBuffer)
         {
-            if (error == ResultError::SUCCESS)
+            break;
+        }
+        buffers.push_back(std::move(pooledBuffer));
+    }
+    workers = static_cast<unsigned>(buffers.size()) + 1;
+    readers = std::min(readers, workers);
+
+    // every worker has own aggregator: results are merged after join
+    std::vector<ResultsAggregator> aggregators;
+    aggregators.reserve(workers);
+    for (unsigned i = 0; i < workers; i ++)
+    {
+        aggregators.push_back(createAggregator());
+    }
+    std::mutex readMutex;
+    std::condition_variable readCondition;
+    unsigned freeReaders = readers;
+    std::atomic<bool> failed(false);
+    std::mutex progressMutex;
+    std::condition_variable progressCondition;
+    uint64_t bytesDone = 0;
+    unsigned finishedWorkers = 0;
+
+    auto worker = [&](unsigned index)
+    {
+        // disjoint ranges of chunks: every chunk reads overlap of the next one
+        const uint64_t firstChunk = chunksCount*index/workers;
+        const uint64_t lastChunk = chunksCount*(index + 1)/workers;
+        char *workerBuffer = index == 0 ? buffer : buffers[index - 1].data();
+        for (uint64_t chunk = firstChunk; chunk < lastChunk && !failed && !control.cancelled; chunk ++)
+        {
+            const uint64_t offset = chunk*chunkSize;
+            const size_t toRead = static_cast<size_t>(std::min(chunkSize + overlap, scanSize - offset));
+            ssize_t actuallyRead;
             {
-                collectedResults.insert(results.begin(), results.end());
+                // no more than readers reads are in flight
+                std::unique_lock<std::mutex> lock(readMutex);
+                readCondition.wait(lock, [&freeReaders]() { return freeReaders > 0; });
+                freeReaders --;
+            }
+            {
+                ProfileScope profileScope(profile, ProfilePhase::READ);
+                actuallyRead = preadChunk(fd, workerBuffer, toRead, offset);
+            }
+            {
+                std::lock_guard<std::mutex> lock(readMutex);
+                freeReaders ++;
+                readCondition.notify_one();
+            }
+            if (actuallyRead < 0)
+            {
+                failed = true;
+                break;
             }
-        };
 
-        threads.push_back(val.scanMemoryBlockAsync(memoryBlock, scannerResult));
+            // pool threads would compete with other workers: scanners run in this one
+            scanMemoryBlock({workerBuffer, static_cast<uint64_t>(actuallyRead)}, filter, aggregators[index],
+                            &control.cancelled, profile, true);
+
+            std::lock_guard<std::mutex> lock(progressMutex);
+            bytesDone += std::min<uint64_t>(chunkSize, static_cast<uint64_t>(actuallyRead));
+            progressCondition.notify_one();
+        }
+
+        std::lock_guard<std::mutex> lock(progressMutex);
+        finishedWorkers ++;
+        progressCondition.notify_one();
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < workers; i ++)
+    {
+        threads.emplace_back(worker, i);
+    }
+
+    // progress is reported from calling thread
+    {
+        std::unique_lock<std::mutex> lock(progressMutex);
+        uint64_t reported = 0;
+        while (finishedWorkers < workers)
+        {
+            progressCondition.wait(lock);
+            if (control.onProgress && bytesDone != reported && finishedWorkers < workers)
+            {
+                reported = bytesDone;
+                lock.unlock();
+                control.onProgress(reported, scanSize);
+                lock.lock();
+            }
+        }
+        if (control.onProgress && bytesDone != reported)
+        {
+            control.onProgress(bytesDone, scanSize);
+        }
     }
 
-    // wait for all threads finish
     for (auto &val : threads)
     {
         val.join();
     }
 
-    // return collected results
-    return ScannerResults(ResultError::SUCCESS, std::move(collectedResults));
+    for (const auto &val : aggregators)
+    {
+        collectGuids(val, filter.databases, results);
+    }
+    return !failed;
+}
+
+ResultsAggregator Manager::createAggregator() const
+{
+    std::vector<size_t> slotSizes;
+    slotSizes.reserve(m_scannersPool.size());
+    for (const auto &val : m_scannersPool)
+    {
+        slotSizes.push_back(val.signatures.size());
+    }
+    return ResultsAggregator(slotSizes);
+}
+
+void Manager::collectGuids(const ResultsAggregator &aggregator, DatabaseMask databases,
+                           FoundGuids &results) const
+{
+    aggregator.forEachMarked([this, databases, &results](size_t slot, size_t index)
+    {
+        const Signature &signature = m_scannersPool[slot].signatures[index];
+        results[m_signatureStore->guid(signature.guidId)] |= signature.databases & databases;
+    });
+}
+
+void Manager::splitResults(const FoundGuids &found, DatabaseMask databases, std::set<Guid> &results,
+                           DatabaseResults *databaseResults) const
+{
+    for (const auto &val : found)
+    {
+        results.insert(val.first);
+    }
+    if (databaseResults == nullptr)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < m_databaseNames.size(); i ++)
+    {
+        const DatabaseMask mask = DatabaseMask(1) << i;
+        if ((databases & mask) == 0)
+        {
+            continue;
+        }
+        std::set<Guid> &databaseGuids = (*databaseResults)[m_databaseNames[i]];
+        for (const auto &val : found)
+        {
+            if ((val.second & mask) != 0)
+            {
+                databaseGuids.insert(val.first);
+            }
+        }
+    }
+}
+
+FoundGuids Manager::scanMemoryBlock(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                                    ScanProfile *profile)
+{
+    ResultsAggregator aggregator = createAggregator();
+    scanMemoryBlock(memoryBlock, filter, aggregator, nullptr, profile);
+
+    FoundGuids results;
+    collectGuids(aggregator, filter.databases, results);
+    return results;
+}
+
+void Manager::scanMemoryBlock(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                              ResultsAggregator &aggregator,
+                              const std::atomic<bool> *cancelled, ScanProfile *profile,
+                              bool inCurrentThread) const
+{
+    if (m_scannersPool.empty())
+    {
+        return;
+    }
+
+    if (inCurrentThread)
+    {
+        for (size_t i = 0; i < m_scannersPool.size(); i ++)
+        {
+            m_scannersPool[i].scanMemoryBlock(memoryBlock, filter, aggregator, i, cancelled, profile);
+        }
+        return;
+    }
+
+    std::vector<std::future<void>> scans;
+    scans.reserve(m_scannerThreads.size());
+
+    // every scanner writes to its own slot of aggregator
+    for (size_t i = 1; i < m_scannersPool.size(); i ++)
+    {
+        scans.push_back(m_scannerThreads[i - 1]->scanMemoryBlockAsync(memoryBlock, filter, aggregator, i,
+                                                                      cancelled, profile));
+    }
+    // the first scanner works in current thread
+    m_scannersPool[0].scanMemoryBlock(memoryBlock, filter, aggregator, 0, cancelled, profile);
+
+    // wait for all scanners finish
+    for (auto &val : scans)
+    {
+        val.get();
+    }
 }
@@ -1,57 +1,350 @@
 #pragma once
 
+#include <bufferpool.h>
 #include <scanner.h>
+#include <unpacker.h>
+#include <policy.h>
+#include <atomic>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <set>
 
+/**
+ * @brief The SignatureDatabase struct is named set of sequences hosted by Manager.
+ */
+struct SignatureDatabase
+{
+    std::string name;
+    std::vector<ByteSequence> byteSequences;
+};
+
+/**
+ * @brief DEFAULT_DATABASE_NAME name of the only database of Manager created from sequences.
+ */
+const char *const DEFAULT_DATABASE_NAME = "default";
+
+/**
+ * @brief FoundGuids found GUIDs with requested databases of signatures found for them.
+ */
+typedef std::map<Guid, DatabaseMask> FoundGuids;
+
+/**
+ * @brief cb_chunk is called by scanFile between chunks.
+ * Used by scheduler for giving way to requests with higher priority.
+ */
+typedef std::function<void()> cb_chunk;
+
+/**
+ * @brief cb_progress is called by scanFile after every chunk with scanned
+ * and total bytes counts of the file.
+ */
+typedef std::function<void(uint64_t bytesDone, uint64_t bytesTotal)> cb_progress;
+
+/**
+ * @brief The ScanControl struct is used for observing and cancelling scanFile
+ * from another thread.
+ */
+struct ScanControl
+{
+    /**
+     * @brief cancelled may be set from any thread: it's checked between chunks
+     * and by scanners inside chunks. Cancelled scan returns results found before.
+     */
+    std::atomic<bool> cancelled{false};
+    cb_chunk onChunk;
+    cb_progress onProgress;
+    /**
+     * @brief profile optional per request profiling: measurements of reading and
+     * scanning phases are added to it when scan finishes (@see ScanProfile).
+     */
+    ScanProfile *profile = nullptr;
+    /**
+     * @brief databases requested databases: results contain GUIDs of their signatures only.
+     */
+    DatabaseMask databases = ALL_DATABASES;
+    /**
+     * @brief databaseResults optional results per requested database found by the same pass.
+     */
+    DatabaseResults *databaseResults = nullptr;
+};
+
+/**
+ * @brief The AnchoredGroup struct stores sequences with the same anchor (@see Anchor).
+ */
+struct AnchoredGroup
+{
+    Anchor anchor;
+    std::vector<Signature> signatures;
+};
+
+/**
+ * @brief The Manager class scans data by sequences of one or several named databases.
+ *
+ * All databases share one scanners pool and one SignatureStore: sequences equal in
+ * several databases are stored and searched once, their signatures have bits of all
+ * these databases (@see DatabaseMask). A request selects databases, signatures of
+ * other ones are skipped, results of every selected one are got by the same pass.
+ */
 class Manager
 {
 public:
-    Manager(std::vector<ByteSequence> &&byteSequences);
+    /**
+     * @param byteSequences are moved into SignatureStore, the vector is released.
+     * They make the only database named DEFAULT_DATABASE_NAME.
+     * @param threadsCount size of scanners pool, 0 means count of CPU cores.
+     */
+    Manager(std::vector<ByteSequence> &&byteSequences, unsigned threadsCount = 0);
+
+    /**
+     * @param databases up to MAX_DATABASES_COUNT databases with unique names,
+     * the rest ones are ignored. Sequences are moved, the vector is released.
+     */
+    Manager(std::vector<SignatureDatabase> &&databases, unsigned threadsCount = 0);
+
+    /**
+     * @brief databaseNames names of databases: database with index N has bit N in DatabaseMask.
+     */
+    const std::vector<std::string> &databaseNames() const { return m_databaseNames; }
+
+    /**
+     * @brief databaseMask finds mask of comma separated database names.
+     * Empty names select all databases.
+     * @return false if some name is unknown.
+     */
+    bool databaseMask(const std::string &names, DatabaseMask &mask) const;
 
     /**
      * @brief scanBytes scans bytes into memory block.
+     * The block is owned by caller: it's accounted in buffer pool by caller if needed
+     * (@see BufferPool::tryReserve).
+     * @param databases requested databases (@see ScanControl::databases).
+     * @param databaseResults optional results per requested database.
      */
-    ScannerResults scanBytes(const void *firstByte, uint64_t sizeInBytes);
+    ScannerResults scanBytes(const void *firstByte, uint64_t sizeInBytes,
+                             DatabaseMask databases = ALL_DATABASES,
+                             DatabaseResults *databaseResults = nullptr);
 
     /**
      * @brief scanFile scans file.
+     * Read buffers are taken from buffer pool (@see setMemoryBudget) after policy decision,
+     * files skipped by policy take none. File is rejected with OUT_OF_MEMORY error if pool
+     * has no room and rejects requests or waiting times out.
+     * @param control optional callbacks invoked after every scanned chunk and cancellation flag,
+     * onChunk is also invoked while waiting for read buffer.
      */
-    ScannerResults scanFile(const std::string &filename);
+    ScannerResults scanFile(const std::string &filename, const ScanControl &control = ScanControl());
+
+    /**
+     * @brief setPolicy sets pre-scan policy of files (@see ScanPolicy).
+     * Not thread safe: call it before scanning.
+     */
+    void setPolicy(const ScanPolicy &policy);
+
+    /**
+     * @brief setUnpackLimits sets limits of unpacking archives and compressed files.
+     * Zero maxDepth disables unpacking. Not thread safe: call it before scanning.
+     */
+    void setUnpackLimits(const UnpackLimits &limits);
 
     /**
      * @brief setChunkSize (@see chunkSize).
      */
     void setChunkSize(uint64_t sizeInBytes);
 
+    /**
+     * @brief setParallelReaders enables throughput mode for files longer than chunk:
+     * workers read disjoint ranges of chunks by pread and scan them at once, up to
+     * readers reads are in flight. Values 0 and 1 mean sequential reading. Count up to
+     * storage queue depth gives more I/O concurrency, scanning uses all cores anyway.
+     * Files which are unpacked are read sequentially.
+     * In this mode scan doesn't give way to requests with higher priority (@see ScanControl::onChunk).
+     */
+    void setParallelReaders(unsigned readers);
+
+    /**
+     * @brief signatureFootprint memory used by sequences (@see SignatureFootprint).
+     */
+    const SignatureFootprint &signatureFootprint() const;
+
+    /**
+     * @brief setProfiling enables global profiling: every request is measured
+     * (@see ScanProfile) and results are accumulated till resetProfile.
+     */
+    void setProfiling(bool enabled);
+
+    /**
+     * @brief profile global profile of requests (@see setProfiling).
+     */
+    ScanProfile &profile() { return m_profile; }
+
+    /**
+     * @brief setMemoryBudget bounds memory of read buffers and unpack windows of all requests
+     * (@see UnpackContext), zero means unlimited. Under pressure chunks are shrunk down to
+     * MIN_CHUNK_SIZE, then requests wait for released buffers or are rejected according
+     * to policy. Waiting requests let queued ones run in their scheduler slots
+     * (@see ScanControl::onChunk) and fail after BufferPool::setMaxWait.
+     */
+    void setMemoryBudget(uint64_t sizeInBytes, BudgetPolicy policy = BudgetPolicy::BLOCK);
+
+    /**
+     * @brief bufferPool pool of read buffers, it also accounts payloads of requests
+     * received by the server (@see BufferPool::tryReserve).
+     */
+    BufferPool &bufferPool() { return m_bufferPool; }
+
+    /**
+     * @brief MIN_CHUNK_SIZE chunks are not shrunk below this size under memory pressure.
+     */
+    static const uint64_t MIN_CHUNK_SIZE = 1024*1024;
+
 protected:
     /**
      * @brief scanMemoryBlock base function for both scanBytes and scanFile.
-     * This method invokes threads using scanner pool (@see m_scannersPool).
+     * This method runs scanners of pool in their threads (@see m_scannerThreads).
      * @param memoryBlock The memory block object to scan.
+     * @param filter types of scanned data and requested databases: sequences restricted
+     * to other types or belonging to other databases are skipped.
+     * @param aggregator collects results of scanners: slot per scanner (@see createAggregator).
+     * Sequences found before (e.g. in previous chunks) are not searched again.
+     * @param cancelled optional cancellation flag passed to scanners.
+     * @param profile optional profile: every scanner is measured in its thread.
+     * @param inCurrentThread scanners run one after another in current thread,
+     * used by callers which scan several blocks in their own threads at once.
+     */
+    void scanMemoryBlock(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                         ResultsAggregator &aggregator,
+                         const std::atomic<bool> *cancelled = nullptr,
+                         ScanProfile *profile = nullptr,
+                         bool inCurrentThread = false) const;
+
+    /**
+     * @brief scanMemoryBlock scans single memory block.
      * @return Total results from all scanners in pool.
      */
-    ScannerResults scanMemoryBlock(MemoryBlock memoryBlock);
+    FoundGuids scanMemoryBlock(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                               ScanProfile *profile = nullptr);
+
+    /**
+     * @brief createAggregator creates results aggregator with slots for scanners pool.
+     */
+    ResultsAggregator createAggregator() const;
+
+    /**
+     * @brief collectGuids inserts GUIDs of sequences marked in aggregator into results
+     * with requested databases of these sequences.
+     */
+    void collectGuids(const ResultsAggregator &aggregator, DatabaseMask databases,
+                      FoundGuids &results) const;
+
+    /**
+     * @brief splitResults fills results by found GUIDs and optional databaseResults
+     * by GUIDs of every requested database.
+     */
+    void splitResults(const FoundGuids &found, DatabaseMask databases, std::set<Guid> &results,
+                      DatabaseResults *databaseResults) const;
+
+    /**
+     * @brief scanRegions checks anchored sequences reading from file to buffer
+     * of chunkSize + overlap() bytes
+     * only byte ranges where they may be placed.
+     * @return false if file read error occured.
+     */
+    bool scanRegions(FILE *file, uint64_t fileSize, uint64_t chunkSize, char *buffer,
+                     const SignatureFilter &filter, FoundGuids &results,
+                     ScanProfile *profile = nullptr) const;
+
+    /**
+     * @brief scanChunksParallel scans first scanSize bytes of file by chunks in workers:
+     * as many as scanners in pool (cores) or readers if they are more. Every worker
+     * reads its chunks and scans them with all scanners of pool in its own thread,
+     * no more than readers reads are in flight at once.
+     * The first worker reads to buffer of chunkSize + overlap() bytes, the others take
+     * buffers from pool: workers are fewer if pool has no room for them.
+     * @return false if file read error occured.
+     */
+    bool scanChunksParallel(int fd, uint64_t scanSize, uint64_t chunkSize, const SignatureFilter &filter,
+                            unsigned readers, char *buffer, const ScanControl &control,
+                            FoundGuids &results, ScanProfile *profile = nullptr);
+
+    /**
+     * @brief collectResults creates callback for unpackers which scans unpacked
+     * memory blocks of any type by requested databases and inserts results into
+     * collector under mutex. Blocks are skipped after cancellation.
+     * @param inCurrentThread blocks are scanned in calling thread (@see scanMemoryBlock).
+     */
+    cb_block collectResults(FoundGuids &collector, std::mutex &mutex, DatabaseMask databases,
+                            const std::atomic<bool> *cancelled = nullptr,
+                            ScanProfile *profile = nullptr,
+                            bool inCurrentThread = false);
+
+    /**
+     * @brief overlap bytes count read twice by adjacent chunks.
+     */
+    uint64_t overlap() const;
 
 private:
-    std::vector<ByteSequence> m_byteSequences;
+    /**
+     * @brief mergeDatabases merges sequences of databases: equal ones of different databases
+     * become one sequence with bits of all these databases in masks. Fills m_databaseNames.
+     */
+    std::vector<ByteSequence> mergeDatabases(std::vector<SignatureDatabase> &databases,
+                                             std::vector<DatabaseMask> &masks);
+
+    std::vector<std::string> m_databaseNames;
+
+    /**
+     * @brief m_signatureStore stores bytes and GUIDs of all sequences once,
+     * scanners and anchored groups keep views of them.
+     */
+    std::unique_ptr<SignatureStore> m_signatureStore;
+
+    uint64_t m_maxSequenceSize;
+
+    /**
+     * @brief m_anchoredGroups stores anchored sequences grouped by anchor.
+     * They are not included in scanners pool.
+     */
+    std::vector<AnchoredGroup> m_anchoredGroups;
 
     /**
      * @brief m_scannersPool stores Scanner objects.
-     * Size of this pool is set in constructor equal to CPU cores count.
+     * Size of this pool is set in constructor equal to CPU cores count
+     * (or to requested threads count).
      */
     std::vector<Scanner> m_scannersPool;
 
+    /**
+     * @brief m_scannerThreads persistent threads of scanners of pool except the first one
+     * which works in calling thread. Blocks of concurrent requests are queued to them.
+     */
+    std::vector<std::unique_ptr<ScannerThread>> m_scannerThreads;
+
     /**
      * @brief chunkSize in bytes.
      * Used by scanFile method to read from file by chunks
      * less or equal to this value.
+     * Atomic because it can be changed while other requests are running.
      */
-    uint64_t chunkSize;
+    std::atomic<uint64_t> chunkSize;
 
     /**
-     * @brief readSize in bytes.
-     * For algorithmic use: store actual read bytes size.
+     * @brief m_parallelReaders workers count of parallel reading (@see setParallelReaders).
      */
-    size_t readSize;
+    std::atomic<unsigned> m_parallelReaders;
+
+    UnpackLimits m_unpackLimits;
+
+    ScanPolicy m_policy;
+
+    /**
+     * @brief m_profiling global profiling mode (@see setProfiling),
+     * m_profile accumulates measurements of all requests.
+     */
+    std::atomic<bool> m_profiling;
+    ScanProfile m_profile;
+
+    BufferPool m_bufferPool;
 };
@@ -0,0 +1,215 @@
+#include <policy.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+// default size of scanned file headers
+const uint64_t DEFAULT_HEADER_SIZE = 64*1024;
+
+std::string toLower(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c)
+    {
+        return static_cast<char>(std::tolower(c));
+    });
+    return text;
+}
+
+std::string fileExtension(const std::string &filename)
+{
+    size_t dot = filename.rfind('.');
+    size_t slash = filename.rfind('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return std::string();
+    }
+    return toLower(filename.substr(dot + 1));
+}
+
+bool parseSize(const std::string &text, uint64_t &size)
+{
+    if (text.empty())
+    {
+        return false;
+    }
+    char *end = nullptr;
+    size = std::strtoull(text.c_str(), &end, 10);
+    switch (std::toupper(static_cast<unsigned char>(*end)))
+    {
+    case 'G':
+        size *= 1024;
+        // fall through
+    case 'M':
+        size *= 1024;
+        // fall through
+    case 'K':
+        size *= 1024;
+        end ++;
+        break;
+    default:
+        break;
+    }
+    return end != text.c_str() && *end == '\0';
+}
+
+bool parseRule(std::stringstream &stream, PolicyRule &rule)
+{
+    std::string condition;
+    while (stream >> condition)
+    {
+        size_t equal = condition.find('=');
+        if (equal == std::string::npos)
+        {
+            return false;
+        }
+        std::string key = condition.substr(0, equal);
+        std::string value = condition.substr(equal + 1);
+
+        if (key == "type")
+        {
+            if (!parseFileTypes(value, rule.types))
+            {
+                return false;
+            }
+        }
+        else if (key == "ext")
+        {
+            std::stringstream extensions(toLower(value));
+            std::string extension;
+            while (std::getline(extensions, extension, ','))
+            {
+                rule.extensions.push_back(extension);
+            }
+        }
+        else if (key == "minsize")
+        {
+            if (!parseSize(value, rule.minSize))
+            {
+                return false;
+            }
+        }
+        else if (key == "maxsize")
+        {
+            if (!parseSize(value, rule.maxSize))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+}
+
+const char *asString(ScanAction action)
+{
+    switch (action)
+    {
+    case ScanAction::SKIP:
+        return "SKIP";
+    case ScanAction::HEADERS_ONLY:
+        return "HEADERS_ONLY";
+    case ScanAction::FULL:
+        return "FULL";
+    }
+    return "";
+}
+
+bool PolicyRule::matches(const std::string &extension, uint64_t fileSize, FileType type) const
+{
+    if (types != 0 && (types & fileTypeBit(type)) == 0)
+    {
+        return false;
+    }
+    if (!extensions.empty()
+            && std::find(extensions.begin(), extensions.end(), extension) == extensions.end())
+    {
+        return false;
+    }
+    return fileSize >= minSize && fileSize <= maxSize;
+}
+
+ScanPolicy::ScanPolicy()
+    : m_headerSize(DEFAULT_HEADER_SIZE)
+{
+}
+
+bool ScanPolicy::load(const std::string &filename)
+{
+    std::cout << "loading scan policy from file: " << filename << std::endl;
+
+    std::ifstream ifs(filename);
+    if (!ifs)
+    {
+        return false;
+    }
+
+    std::string line;
+    while (getline(ifs, line))
+    {
+        std::stringstream stream(line);
+        std::string command;
+        if (!(stream >> command) || command[0] == '#')
+        {
+            continue;
+        }
+
+        PolicyRule rule;
+        bool correct = true;
+        if (command == "headersize")
+        {
+            std::string value;
+            correct = (stream >> value) && parseSize(value, m_headerSize);
+        }
+        else if (command == "skip" || command == "headers" || command == "full")
+        {
+            rule.action = command == "skip"
+                    ? ScanAction::SKIP
+                    : (command == "headers" ? ScanAction::HEADERS_ONLY : ScanAction::FULL);
+            correct = parseRule(stream, rule);
+            if (correct)
+            {
+                addRule(rule);
+            }
+        }
+        else
+        {
+            correct = false;
+        }
+
+        if (!correct)
+        {
+            std::cout << "wrong policy line: " << line << std::endl;
+            return false;
+        }
+    }
+
+    std::cout << "number of policy rules = " << m_rules.size() << std::endl;
+    return true;
+}
+
+void ScanPolicy::addRule(const PolicyRule &rule)
+{
+    m_rules.push_back(rule);
+}
+
+ScanAction ScanPolicy::decide(const std::string &filename, uint64_t fileSize, FileType type) const
+{
+    std::string extension = fileExtension(filename);
+    for (const auto &val : m_rules)
+    {
+        if (val.matches(extension, fileSize, type))
+        {
+            return val.action;
+        }
+    }
+    return ScanAction::FULL;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <filetype.h>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The ScanAction enum is decision of policy about a file.
+ */
+enum class ScanAction : uint8_t
+{
+    SKIP = 0,
+    HEADERS_ONLY,
+    FULL,
+};
+
+const char *asString(ScanAction action);
+
+/**
+ * @brief The PolicyRule struct matches files by type, extension and size.
+ * Empty conditions match any file.
+ */
+struct PolicyRule
+{
+    PolicyRule()
+        : action(ScanAction::FULL)
+        , types(0)
+        , minSize(0)
+        , maxSize(std::numeric_limits<uint64_t>::max())
+    {}
+
+    bool matches(const std::string &extension, uint64_t fileSize, FileType type) const;
+
+    ScanAction action;
+    FileTypeMask types;
+    // lower case extensions without dot
+    std::vector<std::string> extensions;
+    uint64_t minSize;
+    uint64_t maxSize;
+};
+
+/**
+ * @brief The ScanPolicy class decides how to scan a file before scanning.
+ *
+ * Rules are checked in order, the first matched one wins; files matched
+ * by no rule are scanned fully. Policy file consists of lines:
+ *   <skip|headers|full> [type=pe,elf,..] [ext=mp4,mkv,..] [minsize=N] [maxsize=N]
+ *   headersize N
+ * Sizes may have K, M or G suffix. Lines started with '#' are comments.
+ */
+class ScanPolicy
+{
+public:
+    ScanPolicy();
+
+    /**
+     * @brief load reads rules from policy file.
+     * @return false if file can't be read or has wrong line.
+     */
+    bool load(const std::string &filename);
+
+    void addRule(const PolicyRule &rule);
+
+    ScanAction decide(const std::string &filename, uint64_t fileSize, FileType type) const;
+
+    /**
+     * @brief headerSize bytes from file start are scanned for ScanAction::HEADERS_ONLY.
+     */
+    uint64_t headerSize() const { return m_headerSize; }
+    void setHeaderSize(uint64_t sizeInBytes) { m_headerSize = sizeInBytes; }
+
+private:
+    std::vector<PolicyRule> m_rules;
+    uint64_t m_headerSize;
+};
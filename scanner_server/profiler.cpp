@@ -0,0 +1,335 @@
+#include <profiler.h>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#ifdef __linux__
+/**
+ * @brief openCounter opens counter of user space events of current thread.
+ * @param group leader of group or -1 to open disabled leader.
+ * @return file descriptor or -1.
+ */
+int openCounter(HardwareCounter counter, int group)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    // members follow the leader
+    attr.disabled = group < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // group may be multiplexed: values are scaled by running time
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (counter)
+    {
+    case HardwareCounter::CYCLES:
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+    case HardwareCounter::INSTRUCTIONS:
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+    case HardwareCounter::BRANCH_MISSES:
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+    case HardwareCounter::L1D_MISSES:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        break;
+    case HardwareCounter::LLC_MISSES:
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+    }
+
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC));
+}
+
+/**
+ * @brief The ThreadCounters class is group of counters of current thread, it's opened
+ * by the first measurement in thread and closed at thread exit. Nested measurements
+ * share enabled group.
+ */
+class ThreadCounters
+{
+public:
+    ThreadCounters()
+        : m_leader(-1)
+        , m_count(0)
+        , m_depth(0)
+    {
+        for (size_t i = 0; i < HARDWARE_COUNTERS_COUNT; i ++)
+        {
+            m_descriptors[i] = openCounter(static_cast<HardwareCounter>(i), m_leader);
+            m_positions[i] = m_descriptors[i] >= 0 ? static_cast<int>(m_count ++) : -1;
+            if (m_leader < 0)
+            {
+                m_leader = m_descriptors[i];
+            }
+        }
+    }
+
+    ~ThreadCounters()
+    {
+        for (auto val : m_descriptors)
+        {
+            if (val >= 0)
+            {
+                close(val);
+            }
+        }
+    }
+
+    ThreadCounters(const ThreadCounters &) = delete;
+    ThreadCounters &operator=(const ThreadCounters &) = delete;
+
+    void begin(CounterSnapshot &snapshot)
+    {
+        if (m_leader >= 0 && m_depth ++ == 0)
+        {
+            ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+        read(snapshot);
+    }
+
+    void end(CounterSnapshot &snapshot)
+    {
+        read(snapshot);
+        if (m_leader >= 0 && -- m_depth == 0)
+        {
+            ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+private:
+    void read(CounterSnapshot &snapshot) const
+    {
+        // data: counters count, time enabled, time running, values
+        uint64_t data[3 + HARDWARE_COUNTERS_COUNT];
+        const ssize_t size = static_cast<ssize_t>((3 + m_count)*sizeof(uint64_t));
+        const bool valid = m_leader >= 0 && ::read(m_leader, data, sizeof(data)) == size;
+        snapshot.timeEnabled = valid ? data[1] : 0;
+        snapshot.timeRunning = valid ? data[2] : 0;
+        for (size_t i = 0; i < HARDWARE_COUNTERS_COUNT; i ++)
+        {
+            snapshot.available[i] = valid && m_positions[i] >= 0;
+            snapshot.values[i] = snapshot.available[i] ? data[3 + m_positions[i]] : 0;
+        }
+    }
+
+    int m_leader;
+    int m_descriptors[HARDWARE_COUNTERS_COUNT];
+    // position of counter in group read, -1 if it's not available
+    int m_positions[HARDWARE_COUNTERS_COUNT];
+    size_t m_count;
+    unsigned m_depth;
+};
+
+ThreadCounters &threadCounters()
+{
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+void beginCounters(CounterSnapshot &snapshot)
+{
+    threadCounters().begin(snapshot);
+}
+
+void endCounters(CounterSnapshot &snapshot)
+{
+    threadCounters().end(snapshot);
+}
+#else
+void beginCounters(CounterSnapshot &snapshot)
+{
+    snapshot = CounterSnapshot();
+}
+
+void endCounters(CounterSnapshot &snapshot)
+{
+    snapshot = CounterSnapshot();
+}
+#endif
+}
+
+const char *asString(ProfilePhase phase)
+{
+    switch (phase)
+    {
+    case ProfilePhase::READ:
+        return "read";
+    case ProfilePhase::SCAN:
+        return "scan";
+    }
+    return "";
+}
+
+const char *asString(HardwareCounter counter)
+{
+    switch (counter)
+    {
+    case HardwareCounter::CYCLES:
+        return "cycles";
+    case HardwareCounter::INSTRUCTIONS:
+        return "instructions";
+    case HardwareCounter::BRANCH_MISSES:
+        return "branch-misses";
+    case HardwareCounter::L1D_MISSES:
+        return "L1d-misses";
+    case HardwareCounter::LLC_MISSES:
+        return "LLC-misses";
+    }
+    return "";
+}
+
+PhaseCounters::PhaseCounters()
+    : calls(0)
+    , nanoseconds(0)
+{
+    for (size_t i = 0; i < HARDWARE_COUNTERS_COUNT; i ++)
+    {
+        values[i] = 0;
+        available[i] = true;
+    }
+}
+
+PhaseCounters &PhaseCounters::operator+=(const PhaseCounters &other)
+{
+    if (other.calls == 0)
+    {
+        return *this;
+    }
+    calls += other.calls;
+    nanoseconds += other.nanoseconds;
+    for (size_t i = 0; i < HARDWARE_COUNTERS_COUNT; i ++)
+    {
+        values[i] += other.values[i];
+        available[i] = available[i] && other.available[i];
+    }
+    return *this;
+}
+
+void ScanProfile::add(ProfilePhase phase, const PhaseCounters &counters)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phases[static_cast<size_t>(phase)] += counters;
+}
+
+void ScanProfile::merge(const ScanProfile &other)
+{
+    for (size_t i = 0; i < PROFILE_PHASES_COUNT; i ++)
+    {
+        add(static_cast<ProfilePhase>(i), other.phase(static_cast<ProfilePhase>(i)));
+    }
+}
+
+void ScanProfile::reset()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &val : m_phases)
+    {
+        val = PhaseCounters();
+    }
+}
+
+PhaseCounters ScanProfile::phase(ProfilePhase phase) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_phases[static_cast<size_t>(phase)];
+}
+
+std::string ScanProfile::report() const
+{
+    std::stringstream result;
+    result << std::left << std::setw(6) << "phase" << std::right
+           << std::setw(10) << "calls" << std::setw(12) << "time, ms";
+    for (size_t i = 0; i < HARDWARE_COUNTERS_COUNT; i ++)
+    {
+        result << std::setw(16) << asString(static_cast<HardwareCounter>(i));
+    }
+    result << std::setw(8) << "IPC";
+
+    for (size_t i = 0; i < PROFILE_PHASES_COUNT; i ++)
+    {
+        ProfilePhase current = static_cast<ProfilePhase>(i);
+        PhaseCounters counters = phase(current);
+        result << std::endl << std::left << std::setw(6) << asString(current) << std::right
+               << std::setw(10) << counters.calls << std::setw(12) << counters.nanoseconds/1000000;
+        for (size_t j = 0; j < HARDWARE_COUNTERS_COUNT; j ++)
+        {
+            if (counters.calls > 0 && counters.available[j])
+            {
+                result << std::setw(16) << counters.values[j];
+            }
+            else
+            {
+                result << std::setw(16) << "n/a";
+            }
+        }
+
+        const size_t cycles = static_cast<size_t>(HardwareCounter::CYCLES);
+        const size_t instructions = static_cast<size_t>(HardwareCounter::INSTRUCTIONS);
+        if (counters.calls > 0 && counters.available[cycles] && counters.available[instructions]
+                && counters.values[cycles] > 0)
+        {
+            result << std::setw(8) << std::fixed << std::setprecision(2)
+                   << static_cast<double>(counters.values[instructions])/counters.values[cycles];
+        }
+        else
+        {
+            result << std::setw(8) << "n/a";
+        }
+    }
+    return result.str();
+}
+
+ProfileScope::ProfileScope(ScanProfile *profile, ProfilePhase phase)
+    : m_profile(profile)
+    , m_phase(phase)
+{
+    if (m_profile == nullptr)
+    {
+        return;
+    }
+    beginCounters(m_begin);
+    m_start = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (m_profile == nullptr)
+    {
+        return;
+    }
+
+    PhaseCounters counters;
+    counters.calls = 1;
+    counters.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - m_start).count();
+    CounterSnapshot end;
+    endCounters(end);
+    const uint64_t enabled = end.timeEnabled - m_begin.timeEnabled;
+    const uint64_t running = end.timeRunning - m_begin.timeRunning;
+    for (size_t i = 0; i < HARDWARE_COUNTERS_COUNT; i ++)
+    {
+        // group which has not been scheduled has not counted
+        counters.available[i] = m_begin.available[i] && end.available[i] && running > 0;
+        const uint64_t delta = counters.available[i] ? end.values[i] - m_begin.values[i] : 0;
+        counters.values[i] = running > 0
+                ? static_cast<uint64_t>(static_cast<long double>(delta)*enabled/running)
+                : 0;
+    }
+    m_profile->add(m_phase, counters);
+}
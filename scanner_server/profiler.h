@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief The ProfilePhase enum phases of scanning measured separately:
+ * reading of file and searching of sequences in memory.
+ */
+enum class ProfilePhase : uint8_t
+{
+    READ = 0,
+    SCAN,
+};
+
+const size_t PROFILE_PHASES_COUNT = 2;
+
+/**
+ * @brief The HardwareCounter enum hardware events counted by perf_event_open.
+ */
+enum class HardwareCounter : uint8_t
+{
+    CYCLES = 0,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    L1D_MISSES,
+    LLC_MISSES,
+};
+
+const size_t HARDWARE_COUNTERS_COUNT = 5;
+
+const char *asString(ProfilePhase phase);
+const char *asString(HardwareCounter counter);
+
+/**
+ * @brief The PhaseCounters struct accumulated measurements of phase.
+ */
+struct PhaseCounters
+{
+    PhaseCounters();
+
+    PhaseCounters &operator+=(const PhaseCounters &other);
+
+    uint64_t calls;
+    uint64_t nanoseconds;
+    uint64_t values[HARDWARE_COUNTERS_COUNT];
+    // counter is available if it has been opened by all measurements
+    bool available[HARDWARE_COUNTERS_COUNT];
+};
+
+/**
+ * @brief The CounterSnapshot struct raw values of hardware counters of current thread.
+ */
+struct CounterSnapshot
+{
+    uint64_t values[HARDWARE_COUNTERS_COUNT];
+    // times of counting group for scaling of multiplexed counters
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+    bool available[HARDWARE_COUNTERS_COUNT];
+};
+
+/**
+ * @brief The ScanProfile class collects measurements of phases from several threads.
+ */
+class ScanProfile
+{
+public:
+    void add(ProfilePhase phase, const PhaseCounters &counters);
+    void merge(const ScanProfile &other);
+    void reset();
+
+    PhaseCounters phase(ProfilePhase phase) const;
+
+    /**
+     * @brief report text table: row per phase, column per counter.
+     * Counters not permitted by system (e.g. perf_event_paranoid) are "n/a".
+     */
+    std::string report() const;
+
+private:
+    mutable std::mutex m_mutex;
+    PhaseCounters m_phases[PROFILE_PHASES_COUNT];
+};
+
+/**
+ * @brief The ProfileScope class measures current thread from construction till
+ * destruction and adds results to profile. Null profile disables measuring.
+ *
+ * Counters are opened once per thread as one group: scope enables and reads them
+ * at start, reads and disables them at end, and adds the deltas.
+ */
+class ProfileScope
+{
+public:
+    ProfileScope(ScanProfile *profile, ProfilePhase phase);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+    ScanProfile *m_profile;
+    ProfilePhase m_phase;
+    CounterSnapshot m_begin;
+    std::chrono::steady_clock::time_point m_start;
+};
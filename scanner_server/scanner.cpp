@@ -1,85 +1,401 @@
 #include <scanner.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 
-ByteSequence::ByteSequence(const Bytes &_bytes, const Guid &_guid)
+namespace
+{
+/**
+ * @brief parseOffset parses decimal offset, out of range value is error.
+ * The minimal value is out of range too: its magnitude doesn't fit offset.
+ */
+bool parseOffset(const std::string &text, int64_t &offset)
+{
+    // strtoll skips spaces and accepts "+"
+    if (text.empty() || (text[0] != '-' && !std::isdigit(static_cast<unsigned char>(text[0]))))
+    {
+        return false;
+    }
+    char *end = nullptr;
+    errno = 0;
+    offset = std::strtoll(text.c_str(), &end, 10);
+    return *end == '\0' && errno != ERANGE && offset != std::numeric_limits<int64_t>::min();
+}
+
+/**
+ * @brief resolveOffset converts offset of anchor to offset from start of data.
+ */
+uint64_t resolveOffset(int64_t offset, uint64_t dataSize)
+{
+    if (offset >= 0)
+    {
+        return std::min<uint64_t>(offset, dataSize);
+    }
+    uint64_t fromEnd = static_cast<uint64_t>(-(offset + 1)) + 1;
+    return fromEnd < dataSize ? dataSize - fromEnd : 0;
+}
+
+inline uint64_t loadWord(const char *position)
+{
+    // memory is not aligned
+    uint64_t word;
+    memcpy(&word, position, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief matches kernel of length class: compares words of sequence with memory
+ * at position. Words are inside memory, the first one is loaded as head.
+ */
+template <LengthClass CLASS>
+inline bool matches(const char *position, uint64_t head, const MatchWords &match,
+                    const std::vector<Signature> &, uint64_t)
+{
+    const size_t wordsCount = static_cast<size_t>(CLASS) + 1;
+    if (head != match.words[0])
+    {
+        return false;
+    }
+    for (size_t i = 1; i + 1 < wordsCount; i ++)
+    {
+        if (loadWord(position + i*sizeof(uint64_t)) != match.words[i])
+        {
+            return false;
+        }
+    }
+    return loadWord(position + match.lastOffset) == match.words[wordsCount - 1];
+}
+
+template <>
+inline bool matches<LengthClass::WORDS_1>(const char *, uint64_t head, const MatchWords &match,
+                                          const std::vector<Signature> &, uint64_t)
+{
+    return (head & match.mask) == match.words[0];
+}
+
+template <>
+inline bool matches<LengthClass::LONG>(const char *position, uint64_t head, const MatchWords &match,
+                                       const std::vector<Signature> &signatures, uint64_t remainingSize)
+{
+    // the first words filter out almost all offsets
+    return matches<LengthClass::WORDS_4>(position, head, match, signatures, remainingSize)
+            && signatures[match.index].find(position, remainingSize);
+}
+}
+
+bool Anchor::parse(const std::string &text, Anchor &anchor)
+{
+    size_t colon = text.find(':');
+    if (colon == std::string::npos)
+    {
+        int64_t offset;
+        if (!parseOffset(text, offset))
+        {
+            return false;
+        }
+        anchor.type = text[0] == '-' ? Type::OFFSET_FROM_END : Type::OFFSET;
+        anchor.begin = offset < 0 ? -offset : offset;
+        anchor.end = 0;
+        return true;
+    }
+
+    std::string first = text.substr(0, colon);
+    std::string last = text.substr(colon + 1);
+    anchor.type = Type::RANGE;
+    anchor.begin = 0;
+    anchor.end = std::numeric_limits<int64_t>::max();
+    return (first.empty() || parseOffset(first, anchor.begin))
+            && (last.empty() || parseOffset(last, anchor.end));
+}
+
+bool Anchor::positions(uint64_t dataSize, uint64_t sequenceSize, uint64_t &first, uint64_t &last) const
+{
+    if (sequenceSize > dataSize)
+    {
+        return false;
+    }
+
+    switch (type)
+    {
+    case Type::NONE:
+        first = 0;
+        last = dataSize - sequenceSize;
+        return true;
+    case Type::OFFSET:
+        first = last = static_cast<uint64_t>(begin);
+        return first <= dataSize - sequenceSize;
+    case Type::OFFSET_FROM_END:
+        if (static_cast<uint64_t>(begin) < sequenceSize || static_cast<uint64_t>(begin) > dataSize)
+        {
+            return false;
+        }
+        first = last = dataSize - begin;
+        return true;
+    case Type::RANGE:
+    {
+        uint64_t rangeBegin = resolveOffset(begin, dataSize);
+        uint64_t rangeEnd = resolveOffset(end, dataSize);
+        if (rangeBegin + sequenceSize > rangeEnd)
+        {
+            return false;
+        }
+        first = rangeBegin;
+        last = rangeEnd - sequenceSize;
+        return true;
+    }
+    }
+    return false;
+}
+
+LengthClass lengthClass(uint64_t sequenceSize)
+{
+    if (sequenceSize > MatchWords::MAX_WORDS*sizeof(uint64_t))
+    {
+        return LengthClass::LONG;
+    }
+    return static_cast<LengthClass>(sequenceSize > 0 ? (sequenceSize - 1)/sizeof(uint64_t) : 0);
+}
+
+ByteSequence::ByteSequence(const Bytes &_bytes, const Guid &_guid, const Anchor &_anchor,
+                           FileTypeMask _fileTypes)
     : m_bytes(_bytes)
     , m_guid(_guid)
-    , found(false)
+    , m_anchor(_anchor)
+    , m_fileTypes(_fileTypes)
 {
-    count64bit = m_bytes.size()/sizeof(uint64_t);
-    countRemainingBytes = m_bytes.size()%sizeof(uint64_t);
 }
 
 bool ByteSequence::find(const void *memoryStart, uint64_t remainingSize) const
 {
-    if (size() > remainingSize)
+    Signature signature = Signature();
+    signature.bytes = m_bytes.data();
+    signature.bytesCount = static_cast<uint32_t>(m_bytes.size());
+    return signature.find(memoryStart, remainingSize);
+}
+
+void Scanner::prepare()
+{
+    matchWords.assign(signatures.size(), MatchWords());
+    for (size_t i = 0; i < signatures.size(); i ++)
     {
-        return false;
+        const Signature &signature = signatures[i];
+        MatchWords &match = matchWords[i];
+        match.index = static_cast<uint32_t>(i);
+        match.lengthClass = lengthClass(signature.size());
+        match.mask = ~uint64_t(0);
+        if (signature.size() < sizeof(uint64_t))
+        {
+            // unused bytes of word and mask are zeros
+            memcpy(&match.words[0], signature.bytes, signature.size());
+            unsigned char maskBytes[sizeof(uint64_t)] = {};
+            memset(maskBytes, 0xff, signature.size());
+            memcpy(&match.mask, maskBytes, sizeof(uint64_t));
+            continue;
+        }
+
+        const size_t wordsCount = match.lengthClass == LengthClass::LONG
+                ? MatchWords::MAX_WORDS
+                : static_cast<size_t>(match.lengthClass) + 1;
+        for (size_t j = 0; j + 1 < wordsCount; j ++)
+        {
+            memcpy(&match.words[j], signature.bytes + j*sizeof(uint64_t), sizeof(uint64_t));
+        }
+        match.lastOffset = static_cast<uint32_t>(match.lengthClass == LengthClass::LONG
+                                                 ? (wordsCount - 1)*sizeof(uint64_t)
+                                                 : signature.size() - sizeof(uint64_t));
+        memcpy(&match.words[wordsCount - 1], signature.bytes + match.lastOffset, sizeof(uint64_t));
     }
+}
+
+void Scanner::scanMemoryBlock(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                              ResultsAggregator &aggregator, size_t slot,
+                              const std::atomic<bool> *cancelled, ScanProfile *profile) const
+{
+    ProfileScope profileScope(profile, ProfilePhase::SCAN);
 
-    if (count64bit > 0)
+    // applicable and not found yet sequences bucketed by length class
+    std::vector<MatchWords> buckets[LENGTH_CLASSES_COUNT];
+    uint64_t bucketLoadSizes[LENGTH_CLASSES_COUNT] = {};
+    for (const auto &val : matchWords)
     {
-        const uint64_t *data64bit = reinterpret_cast<const uint64_t *>(m_bytes.data());
-        const uint64_t *memory64bit = reinterpret_cast<const uint64_t *>(memoryStart);
-        for (auto i = 0u; i < count64bit; i ++)
+        const Signature &signature = signatures[val.index];
+        if (signature.appliesTo(filter) && !aggregator.marked(slot, val.index))
         {
-            if (data64bit[i] != memory64bit[i])
-            {
-                return false;
-            }
+            const size_t bucket = static_cast<size_t>(val.lengthClass);
+            buckets[bucket].push_back(val);
+            // kernels load at least one word at every offset
+            bucketLoadSizes[bucket] = std::max(bucketLoadSizes[bucket],
+                                               std::max<uint64_t>(signature.size(), sizeof(uint64_t)));
         }
     }
 
-    if (countRemainingBytes > 0)
+    const char *memory = memoryBlock.firstByte;
+    const uint64_t size = memoryBlock.sizeInBytes;
+    for (uint64_t windowStart = 0; windowStart < size; windowStart += CANCEL_CHECK_INTERVAL)
     {
-        const char *dataRemainingBytes = m_bytes.data() + count64bit*sizeof(uint64_t);
-        const char *remainingOffset =
-                reinterpret_cast<const char *>(memoryStart) + count64bit*sizeof(uint64_t);
-        for (auto i = 0u; i < countRemainingBytes; i ++)
+        if (windowStart > 0 && cancelled && cancelled->load(std::memory_order_relaxed))
+        {
+            break;
+        }
+
+        const uint64_t windowEnd = std::min(size, windowStart + CANCEL_CHECK_INTERVAL);
+        bool remaining = false;
+        for (size_t i = 0; i < LENGTH_CLASSES_COUNT; i ++)
         {
-            if (dataRemainingBytes[i] != remainingOffset[i])
+            if (buckets[i].empty())
+            {
+                continue;
+            }
+
+            // offsets where words of all sequences of bucket can be loaded,
+            // the rest ones near the end of block are checked with bounds
+            const uint64_t bodyEnd = size >= bucketLoadSizes[i] ? size - bucketLoadSizes[i] + 1 : 0;
+            const uint64_t kernelEnd = std::min(windowEnd, bodyEnd);
+            if (windowStart < kernelEnd)
+            {
+                scanBucket(static_cast<LengthClass>(i), memory, size, windowStart, kernelEnd,
+                           buckets[i], aggregator, slot);
+            }
+            if (std::max(windowStart, bodyEnd) < windowEnd)
             {
-                return false;
+                scanBucketTail(memory, size, std::max(windowStart, bodyEnd), windowEnd,
+                               buckets[i], aggregator, slot);
             }
+            remaining = remaining || !buckets[i].empty();
+        }
+
+        // found sequences needn't be searched anymore
+        if (!remaining)
+        {
+            break;
         }
     }
+}
 
-    return true;
+void Scanner::scanBucket(LengthClass lengthClass, const char *memory, uint64_t size,
+                         uint64_t first, uint64_t last, std::vector<MatchWords> &bucket,
+                         ResultsAggregator &aggregator, size_t slot) const
+{
+    switch (lengthClass)
+    {
+    case LengthClass::WORDS_1:
+        return scanBucket<LengthClass::WORDS_1>(memory, size, first, last, bucket, aggregator, slot);
+    case LengthClass::WORDS_2:
+        return scanBucket<LengthClass::WORDS_2>(memory, size, first, last, bucket, aggregator, slot);
+    case LengthClass::WORDS_3:
+        return scanBucket<LengthClass::WORDS_3>(memory, size, first, last, bucket, aggregator, slot);
+    case LengthClass::WORDS_4:
+        return scanBucket<LengthClass::WORDS_4>(memory, size, first, last, bucket, aggregator, slot);
+    case LengthClass::LONG:
+        return scanBucket<LengthClass::LONG>(memory, size, first, last, bucket, aggregator, slot);
+    }
 }
 
-void Scanner::scanMemoryBlock(MemoryBlock memoryBlock, cb_results cb)
+template <LengthClass CLASS>
+void Scanner::scanBucket(const char *memory, uint64_t size, uint64_t first, uint64_t last,
+                         std::vector<MatchWords> &bucket, ResultsAggregator &aggregator, size_t slot) const
 {
-    std::set<Guid> results;
-    if (byteSequences.size() > 0)
+    for (uint64_t offset = first; offset < last; offset ++)
     {
-        // last element stores minimal element because in Manager they are sorted by descending
-        auto minimalArraySize = byteSequences.back().size();
-        if (minimalArraySize <= memoryBlock.sizeInBytes)
+        const char *position = memory + offset;
+        const uint64_t head = loadWord(position);
+        for (size_t i = 0; i < bucket.size();)
+        {
+            if (matches<CLASS>(position, head, bucket[i], signatures, size - offset))
+            {
+                // order of bucket doesn't matter
+                aggregator.mark(slot, bucket[i].index);
+                bucket[i] = bucket.back();
+                bucket.pop_back();
+            }
+            else
+            {
+                i ++;
+            }
+        }
+
+        if (bucket.empty())
         {
-            auto remainingSize = memoryBlock.sizeInBytes;
+            return;
+        }
+    }
+}
 
-            const char *ptrEnd = memoryBlock.firstByte + memoryBlock.sizeInBytes - minimalArraySize;
-            for (char *ptrIterator = const_cast<char *>(memoryBlock.firstByte); ptrIterator <= ptrEnd; ptrIterator ++)
+void Scanner::scanBucketTail(const char *memory, uint64_t size, uint64_t first, uint64_t last,
+                             std::vector<MatchWords> &bucket, ResultsAggregator &aggregator,
+                             size_t slot) const
+{
+    for (uint64_t offset = first; offset < last && !bucket.empty(); offset ++)
+    {
+        for (size_t i = 0; i < bucket.size();)
+        {
+            if (signatures[bucket[i].index].find(memory + offset, size - offset))
             {
-                for (auto i = 0u; i < byteSequences.size(); i ++)
-                {
-                    if (byteSequences[i].find(ptrIterator, remainingSize))
-                    {
-                        results.insert(byteSequences[i].guid());
-                    }
-                }
-
-                remainingSize --;
+                aggregator.mark(slot, bucket[i].index);
+                bucket[i] = bucket.back();
+                bucket.pop_back();
+            }
+            else
+            {
+                i ++;
             }
         }
     }
+}
 
-    cb(ResultError::SUCCESS, std::move(results));
+ScannerThread::ScannerThread(const Scanner &scanner)
+    : m_scanner(scanner)
+    , m_stopping(false)
+    , m_thread(&ScannerThread::loop, this)
+{
+}
+
+ScannerThread::~ScannerThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
 }
 
-std::thread Scanner::scanMemoryBlockAsync(MemoryBlock memoryBlock, cb_results cb)
+std::future<void> ScannerThread::scanMemoryBlockAsync(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                                                      ResultsAggregator &aggregator, size_t slot,
+                                                      const std::atomic<bool> *cancelled,
+                                                      ScanProfile *profile)
 {
-    return std::thread([this, memoryBlock, cb]()
+    const Scanner &scanner = m_scanner;
+    std::packaged_task<void()> task([&scanner, memoryBlock, filter, &aggregator, slot, cancelled, profile]()
     {
-        scanMemoryBlock(memoryBlock, cb);
+        scanner.scanMemoryBlock(memoryBlock, filter, aggregator, slot, cancelled, profile);
     });
+    std::future<void> result = task.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+    return result;
+}
+
+void ScannerThread::loop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true)
+    {
+        m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+        if (m_tasks.empty())
+        {
+            return;
+        }
+        std::packaged_task<void()> task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
 }
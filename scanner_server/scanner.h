@@ -1,16 +1,89 @@
 #pragma once
 
 #include <../common.h>
+#include <filetype.h>
+#include <aggregator.h>
+#include <signaturestore.h>
+#include <profiler.h>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
 #include <vector>
 #include <thread>
 
+/**
+ * @brief The Anchor struct limits place of sequence in scanned data.
+ * Text form (@see parse):
+ *  "N"   - sequence starts at offset N;
+ *  "-N"  - sequence starts N bytes before end of data;
+ *  "A:B" - sequence is inside bytes range [A, B), negative values are counted
+ *          from end of data, omitted A is start and omitted B is end of data.
+ */
+struct Anchor
+{
+    enum class Type : uint8_t
+    {
+        NONE = 0,
+        OFFSET,
+        OFFSET_FROM_END,
+        RANGE,
+    };
+
+    Anchor()
+        : type(Type::NONE)
+        , begin(0)
+        , end(0)
+    {}
+
+    /**
+     * @brief parse creates anchor from its text form.
+     * @return false if text is wrong.
+     */
+    static bool parse(const std::string &text, Anchor &anchor);
+
+    /**
+     * @brief positions calculates range [first, last] of possible start positions
+     * of sequence in data.
+     * @return false if sequence can't be placed in data by this anchor.
+     */
+    bool positions(uint64_t dataSize, uint64_t sequenceSize, uint64_t &first, uint64_t &last) const;
+
+    bool operator==(const Anchor &other) const
+    {
+        return type == other.type && begin == other.begin && end == other.end;
+    }
+
+    bool operator<(const Anchor &other) const
+    {
+        if (type != other.type)
+        {
+            return type < other.type;
+        }
+        return begin != other.begin ? begin < other.begin : end < other.end;
+    }
+
+    Type type;
+    int64_t begin;
+    int64_t end;
+};
+
+/**
+ * @brief The ByteSequence struct is definition of sequence passed to Manager.
+ * Manager keeps them in SignatureStore (@see SignatureStore).
+ */
 struct ByteSequence
 {
-    ByteSequence(const Bytes &bytes, const Guid &guid);
+    ByteSequence(const Bytes &bytes, const Guid &guid, const Anchor &anchor = Anchor(),
+                 FileTypeMask fileTypes = 0);
 
     uint64_t size() const { return m_bytes.size(); }
 
+    const Bytes &bytes() const { return m_bytes; }
+
     /**
      * @brief find Fast scanning method in memory block.
      * Uses comparing bytes as 64 bit values.
@@ -18,14 +91,25 @@ struct ByteSequence
      */
     bool find(const void *firstByte, uint64_t remainingSize) const;
 
-    const Guid &guid() { return m_guid; }
+    const Guid &guid() const { return m_guid; }
+
+    const Anchor &anchor() const { return m_anchor; }
+
+    FileTypeMask fileTypes() const { return m_fileTypes; }
+
+    /**
+     * @brief appliesTo checks if sequence is searched in data of given types.
+     * Sequence without file types restriction applies to any data.
+     */
+    bool appliesTo(FileTypeMask dataTypes) const
+    {
+        return m_fileTypes == 0 || (m_fileTypes & dataTypes) != 0;
+    }
 private:
     std::string m_bytes;
     Guid m_guid;
-    // properties for optimized comparing:
-    uint64_t count64bit;
-    uint32_t countRemainingBytes;
-    bool found;
+    Anchor m_anchor;
+    FileTypeMask m_fileTypes;
 };
 
 struct MemoryBlock
@@ -39,34 +123,145 @@ struct MemoryBlock
 };
 
 /**
- * @brief cb_results used for return results from single scanner method.
- * ResultError: error occured or success.
- * std::set<Guid>: set of found GUIDs.
+ * @brief The LengthClass enum groups signatures by count of 64 bit words compared
+ * by matching kernel: lengths 1-8 are compared by single masked load, 9-16 by two
+ * loads and so on, longer than 32 bytes by the first word and full comparing.
  */
-typedef std::function<void(ResultError, std::set<Guid> &&)> cb_results;
+enum class LengthClass : uint8_t
+{
+    WORDS_1 = 0,
+    WORDS_2,
+    WORDS_3,
+    WORDS_4,
+    LONG,
+};
+
+const size_t LENGTH_CLASSES_COUNT = 5;
+
+LengthClass lengthClass(uint64_t sequenceSize);
+
+/**
+ * @brief The MatchWords struct is signature prepared for kernel of its length class.
+ * For lengths from 9 to 32 the last word is loaded at lastOffset, so it overlaps
+ * the previous one unless length is multiple of 8.
+ */
+struct MatchWords
+{
+    static const size_t MAX_WORDS = 4;
+
+    uint64_t words[MAX_WORDS];
+    // mask of the first word: only its bytes are compared for lengths below 8
+    uint64_t mask;
+    uint32_t lastOffset;
+    // index in Scanner::signatures
+    uint32_t index;
+    LengthClass lengthClass;
+};
 
 struct Scanner
 {
     /**
-     * @brief scanMemoryBlock scans memoryBlock in current thread.
-     * @param memoryBlock
-     * @param cb return callback with parameters (@see cb_results).
+     * @brief CANCEL_CHECK_INTERVAL scanned bytes between checks of cancellation.
+     * Memory block is scanned by windows of this size: kernels of all length
+     * classes are run for one window while it's in cache.
      */
-    void scanMemoryBlock(MemoryBlock memoryBlock, cb_results cb);
+    static const uint64_t CANCEL_CHECK_INTERVAL = 64*1024;
 
     /**
-     * @brief scanMemoryBlockAsync calls scanMemoryBlock in new thread.
-     * @see scanMemoryBlock.
-     * @return newly created thread.
+     * @brief prepare builds match words of signatures (@see MatchWords).
+     * Must be called after signatures are changed.
      */
-    std::thread scanMemoryBlockAsync(MemoryBlock memoryBlock, cb_results cb);
+    void prepare();
 
     /**
-     * @brief byteSequences stores sequences for current Scanner object.
+     * @brief scanMemoryBlock scans memoryBlock in current thread.
+     * Sequences already marked in aggregator slot are not searched again.
+     * @param memoryBlock
+     * @param filter types of scanned data and requested databases (@see Signature::appliesTo).
+     * @param aggregator found sequences are marked by their indices in signatures.
+     * @param slot aggregator slot owned by current thread.
+     * @param cancelled optional flag checked every CANCEL_CHECK_INTERVAL bytes: scan stops if it's set.
+     * @param profile optional profile: the call is measured as SCAN phase.
+     */
+    void scanMemoryBlock(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                         ResultsAggregator &aggregator, size_t slot,
+                         const std::atomic<bool> *cancelled = nullptr,
+                         ScanProfile *profile = nullptr) const;
+
+    /**
+     * @brief signatures stores sequences for current Scanner object.
      * All read sequences during Manager's construction is splat by groups
      * and stored in different scanner objects.
      * Single instance of Scanner stores sequences
      * which itself this instance is responsible to check in memory blocks.
+     * They are views of bytes in SignatureStore of Manager.
      */
-    std::vector<ByteSequence> byteSequences;
+    std::vector<Signature> signatures;
+
+    /**
+     * @brief matchWords prepared signatures in the same order.
+     */
+    std::vector<MatchWords> matchWords;
+
+private:
+    /**
+     * @brief scanBucket dispatches bucket to kernel of its length class.
+     * Kernel checks offsets [first, last): words of all sequences of bucket
+     * must be inside memory at these offsets. Found sequences are removed from bucket.
+     */
+    void scanBucket(LengthClass lengthClass, const char *memory, uint64_t size,
+                    uint64_t first, uint64_t last, std::vector<MatchWords> &bucket,
+                    ResultsAggregator &aggregator, size_t slot) const;
+
+    template <LengthClass CLASS>
+    void scanBucket(const char *memory, uint64_t size, uint64_t first, uint64_t last,
+                    std::vector<MatchWords> &bucket, ResultsAggregator &aggregator, size_t slot) const;
+
+    /**
+     * @brief scanBucketTail checks offsets [first, last) near the end of memory
+     * by Signature::find which checks bounds.
+     */
+    void scanBucketTail(const char *memory, uint64_t size, uint64_t first, uint64_t last,
+                        std::vector<MatchWords> &bucket, ResultsAggregator &aggregator,
+                        size_t slot) const;
+};
+
+/**
+ * @brief The ScannerThread class is persistent thread of one scanner: it scans blocks
+ * in order of submission. Resources of thread (e.g. hardware counters of ProfileScope)
+ * are opened once for its lifetime instead of once per block.
+ */
+class ScannerThread
+{
+public:
+    explicit ScannerThread(const Scanner &scanner);
+
+    /**
+     * @brief ~ScannerThread finishes queued scans and joins thread.
+     */
+    ~ScannerThread();
+
+    ScannerThread(const ScannerThread &) = delete;
+    ScannerThread &operator=(const ScannerThread &) = delete;
+
+    /**
+     * @brief scanMemoryBlockAsync queues Scanner::scanMemoryBlock to this thread.
+     * Arguments must stay valid till returned future is ready.
+     * @see Scanner::scanMemoryBlock.
+     */
+    std::future<void> scanMemoryBlockAsync(MemoryBlock memoryBlock, const SignatureFilter &filter,
+                                           ResultsAggregator &aggregator, size_t slot,
+                                           const std::atomic<bool> *cancelled = nullptr,
+                                           ScanProfile *profile = nullptr);
+
+private:
+    void loop();
+
+    const Scanner &m_scanner;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<std::packaged_task<void()>> m_tasks;
+    bool m_stopping;
+    // started after other members are initialized
+    std::thread m_thread;
 };
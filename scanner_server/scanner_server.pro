@@ -9,12 +9,34 @@ CONFIG -= app_bundle
 
 TEMPLATE = app
 
+LIBS += -lz
+
 SOURCES += \
     main.cpp \
+    aggregator.cpp \
+    bufferpool.cpp \
+    filetype.cpp \
     manager.cpp \
-    scanner.cpp
+    policy.cpp \
+    profiler.cpp \
+    scanner.cpp \
+    scheduler.cpp \
+    sequencesfile.cpp \
+    signaturestore.cpp \
+    trace.cpp \
+    unpacker.cpp
 
 HEADERS += \
+    aggregator.h \
+    bufferpool.h \
+    filetype.h \
     manager.h \
+    policy.h \
+    profiler.h \
     scanner.h \
+    scheduler.h \
+    sequencesfile.h \
+    signaturestore.h \
+    trace.h \
+    unpacker.h \
     interface.h
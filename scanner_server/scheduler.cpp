@@ -0,0 +1,197 @@
+#include <scheduler.h>
+#include <cassert>
+#include <iostream>
+
+RequestScheduler::RequestScheduler(unsigned maxConcurrentRequests)
+    : m_maxConcurrentRequests(0)
+    , m_runningCount(0)
+    , m_stopping(false)
+{
+    setMaxConcurrentRequests(maxConcurrentRequests);
+}
+
+RequestScheduler::~RequestScheduler()
+{
+    stop();
+}
+
+void RequestScheduler::submit(const std::string &client, RequestPriority priority, Task task,
+                              Task onDropped)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_stopping)
+        {
+            PriorityQueue &queue = m_queues[static_cast<size_t>(priority)];
+            std::deque<QueuedTask> &tasks = queue.clientTasks[client];
+            if (tasks.empty())
+            {
+                queue.clientsOrder.push_back(client);
+            }
+            tasks.push_back({std::move(task), std::move(onDropped)});
+            m_condition.notify_one();
+            return;
+        }
+    }
+
+    if (onDropped)
+    {
+        onDropped();
+    }
+}
+
+void RequestScheduler::stop()
+{
+    std::vector<Task> dropped;
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto &queue : m_queues)
+        {
+            for (auto &val : queue.clientTasks)
+            {
+                for (auto &queued : val.second)
+                {
+                    if (queued.onDropped)
+                    {
+                        dropped.push_back(std::move(queued.onDropped));
+                    }
+                }
+            }
+            queue.clientTasks.clear();
+            queue.clientsOrder.clear();
+        }
+        workers.swap(m_workers);
+    }
+    m_condition.notify_all();
+
+    for (auto &val : dropped)
+    {
+        val();
+    }
+
+    // running tasks are finished
+    for (auto &val : workers)
+    {
+        val.join();
+    }
+}
+
+void RequestScheduler::setMaxConcurrentRequests(unsigned count)
+{
+    if (count == 0)
+    {
+        count = 1;
+    }
+
+    std::cout << "Set max concurrent requests to " << count << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxConcurrentRequests = count;
+        // workers are never destroyed before scheduler is stopped:
+        // extra ones just wait while running count is on the limit
+        while (!m_stopping && m_workers.size() < count)
+        {
+            m_workers.push_back(std::thread(&RequestScheduler::workerLoop, this));
+        }
+    }
+    m_condition.notify_all();
+}
+
+void RequestScheduler::yield(RequestPriority current)
+{
+    size_t higherPriorities = static_cast<size_t>(current);
+    for (;;)
+    {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            // free worker will take the task itself
+            if (m_stopping || m_runningCount < m_maxConcurrentRequests
+                    || !hasPendingTasks(higherPriorities))
+            {
+                return;
+            }
+            task = popTask(higherPriorities);
+        }
+        task();
+    }
+}
+
+bool RequestScheduler::hasPendingTasks(size_t prioritiesCount) const
+{
+    for (size_t i = 0; i < prioritiesCount; i ++)
+    {
+        if (!m_queues[i].clientsOrder.empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+RequestScheduler::Task RequestScheduler::popTask(size_t prioritiesCount)
+{
+    for (size_t i = 0; i < prioritiesCount; i ++)
+    {
+        PriorityQueue &queue = m_queues[i];
+        if (queue.clientsOrder.empty())
+        {
+            continue;
+        }
+
+        std::string client = queue.clientsOrder.front();
+        queue.clientsOrder.pop_front();
+
+        auto it = queue.clientTasks.find(client);
+        assert(it != queue.clientTasks.end() && !it->second.empty());
+        Task task = std::move(it->second.front().task);
+        it->second.pop_front();
+
+        // client goes to the end of the line if it has more tasks
+        if (it->second.empty())
+        {
+            queue.clientTasks.erase(it);
+        }
+        else
+        {
+            queue.clientsOrder.push_back(client);
+        }
+        return task;
+    }
+
+    assert(false);
+    return Task();
+}
+
+void RequestScheduler::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;)
+    {
+        m_condition.wait(lock, [this]()
+        {
+            return m_stopping
+                    || (m_runningCount < m_maxConcurrentRequests
+                        && hasPendingTasks(REQUEST_PRIORITIES_COUNT));
+        });
+
+        if (m_stopping)
+        {
+            return;
+        }
+
+        Task task = popTask(REQUEST_PRIORITIES_COUNT);
+        m_runningCount ++;
+        lock.unlock();
+
+        task();
+
+        lock.lock();
+        m_runningCount --;
+        // the slot is free: another worker may continue
+        m_condition.notify_one();
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The RequestPriority enum defines priority classes of requests.
+ * Lower value means higher priority.
+ */
+enum class RequestPriority : uint8_t
+{
+    HIGH = 0,   // small requests (e.g. scanBytes)
+    NORMAL = 1, // regular files
+    LOW = 2,    // large files
+};
+
+const size_t REQUEST_PRIORITIES_COUNT = 3;
+
+/**
+ * @brief The RequestScheduler class runs requests asynchronously
+ * in a limited number of worker threads.
+ *
+ * Pending requests are taken by priority class first. Inside one priority class
+ * clients are served in round robin order, so a client with many queued
+ * requests can't starve other clients.
+ */
+class RequestScheduler
+{
+public:
+    typedef std::function<void()> Task;
+
+    explicit RequestScheduler(unsigned maxConcurrentRequests);
+
+    /**
+     * @brief ~RequestScheduler stops scheduler (@see stop).
+     */
+    ~RequestScheduler();
+
+    /**
+     * @brief submit queues task of given client.
+     * @param client Identifier of client (e.g. DBus unique name of sender).
+     * @param onDropped is called instead of task if it's dropped by stop
+     * (e.g. to reply with error), task submitted after stop is dropped at once.
+     */
+    void submit(const std::string &client, RequestPriority priority, Task task,
+                Task onDropped = Task());
+
+    /**
+     * @brief stop drops pending tasks and waits for running ones.
+     * Called before objects used by tasks are destroyed.
+     */
+    void stop();
+
+    /**
+     * @brief setMaxConcurrentRequests sets the limit of simultaneously running tasks.
+     */
+    void setMaxConcurrentRequests(unsigned count);
+
+    /**
+     * @brief yield lets pending tasks with priority higher than current one
+     * to run in current thread if there is no free worker for them.
+     * Long running tasks call it at chunk boundaries.
+     */
+    void yield(RequestPriority current);
+
+private:
+    struct QueuedTask
+    {
+        Task task;
+        Task onDropped;
+    };
+
+    struct PriorityQueue
+    {
+        std::map<std::string, std::deque<QueuedTask>> clientTasks;
+        // clients having pending tasks in order of their turn
+        std::deque<std::string> clientsOrder;
+    };
+
+    bool hasPendingTasks(size_t prioritiesCount) const;
+    Task popTask(size_t prioritiesCount);
+    void workerLoop();
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    PriorityQueue m_queues[REQUEST_PRIORITIES_COUNT];
+    std::vector<std::thread> m_workers;
+    unsigned m_maxConcurrentRequests;
+    unsigned m_runningCount;
+    bool m_stopping;
+};
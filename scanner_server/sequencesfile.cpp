@@ -0,0 +1,88 @@
+#include <sequencesfile.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+void updateSequencesFromFile(const std::string &filename,
+                             std::vector<ByteSequence> &byteSequences)
+{
+    byteSequences.clear();
+
+    std::cout << "updating byte sequences from file: " << filename << std::endl;
+
+    std::ifstream ifs(filename);
+    while (ifs)
+    {
+        std::string line;
+        if (!getline(ifs, line))
+        {
+            break;
+        }
+
+        size_t index = line.find(".{");
+
+        // optional suffix after guid: "bytes.{guid}@anchor#types"
+        // (@see Anchor, parseFileTypes), both parts may be omitted
+        Anchor anchor;
+        FileTypeMask fileTypes = 0;
+        size_t suffixIndex = line.find('}', index);
+        if (index != std::string::npos && suffixIndex != std::string::npos
+                && suffixIndex + 1 < line.size())
+        {
+            std::string suffix = line.substr(suffixIndex + 1);
+            size_t typesIndex = suffix.find('#');
+            std::string anchorText = suffix.substr(0, typesIndex);
+            bool correct = (typesIndex == std::string::npos
+                            || parseFileTypes(suffix.substr(typesIndex + 1), fileTypes))
+                    && (anchorText.empty()
+                        || (anchorText[0] == '@' && Anchor::parse(anchorText.substr(1), anchor)));
+            if (!correct)
+            {
+                std::cout << "wrong anchor or file types, line skipped: " << line << std::endl;
+                continue;
+            }
+            line.erase(suffixIndex + 1);
+        }
+
+        if (index > 0 && index != std::string::npos && line.back() == '}')
+        {
+            line.pop_back();
+            Guid guid = line.substr(index + 2);
+            Bytes bytes = line.erase(index);
+            byteSequences.push_back({bytes, guid, anchor, fileTypes});
+        }
+    }
+
+    std::cout << "number of byte sequences = " << byteSequences.size() << std::endl;
+}
+
+bool loadDatabases(const std::string &argument, std::vector<SignatureDatabase> &databases)
+{
+    databases.clear();
+    if (argument.find('=') == std::string::npos)
+    {
+        databases.push_back({DEFAULT_DATABASE_NAME, {}});
+        updateSequencesFromFile(argument, databases.back().byteSequences);
+        return !databases.back().byteSequences.empty();
+    }
+
+    std::stringstream stream(argument);
+    std::string entry;
+    while (getline(stream, entry, ','))
+    {
+        size_t index = entry.find('=');
+        if (index == 0 || index == std::string::npos || index + 1 == entry.size())
+        {
+            std::cout << "wrong database entry: " << entry << std::endl;
+            return false;
+        }
+        databases.push_back({entry.substr(0, index), {}});
+        updateSequencesFromFile(entry.substr(index + 1), databases.back().byteSequences);
+        if (databases.back().byteSequences.empty())
+        {
+            std::cout << "empty database: " << databases.back().name << std::endl;
+            return false;
+        }
+    }
+    return !databases.empty();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <manager.h>
+#include <scanner.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief updateSequencesFromFile replaces byteSequences by sequences of file.
+ * Line format: "bytes.{guid}@anchor#types" (@see Anchor, parseFileTypes),
+ * anchor and types are optional. Wrong lines are skipped.
+ */
+void updateSequencesFromFile(const std::string &filename,
+                             std::vector<ByteSequence> &byteSequences);
+
+/**
+ * @brief loadDatabases loads databases of argument: comma separated "name=file" entries
+ * or a single file which makes database named DEFAULT_DATABASE_NAME.
+ * @return false if some entry is wrong or some database is empty.
+ */
+bool loadDatabases(const std::string &argument, std::vector<SignatureDatabase> &databases);
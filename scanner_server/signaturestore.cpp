@@ -0,0 +1,177 @@
+#include <signaturestore.h>
+#include <scanner.h>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+bool isPrefix(const std::string &prefix, const std::string &text)
+{
+    return prefix.size() <= text.size() && std::equal(prefix.begin(), prefix.end(), text.begin());
+}
+
+bool isSuffix(const std::string &suffix, const std::string &text)
+{
+    return suffix.size() <= text.size() && std::equal(suffix.rbegin(), suffix.rend(), text.rbegin());
+}
+}
+
+bool Signature::find(const void *memoryStart, uint64_t remainingSize) const
+{
+    if (bytesCount > remainingSize)
+    {
+        return false;
+    }
+
+    // neither sequence nor memory block is aligned: 64 bit values are loaded by memcpy
+    const char *memory = reinterpret_cast<const char *>(memoryStart);
+    const uint32_t count64bit = bytesCount/sizeof(uint64_t);
+    for (uint32_t i = 0; i < count64bit; i ++)
+    {
+        uint64_t dataValue;
+        uint64_t memoryValue;
+        memcpy(&dataValue, bytes + i*sizeof(uint64_t), sizeof(uint64_t));
+        memcpy(&memoryValue, memory + i*sizeof(uint64_t), sizeof(uint64_t));
+        if (dataValue != memoryValue)
+        {
+            return false;
+        }
+    }
+
+    for (uint32_t i = count64bit*sizeof(uint64_t); i < bytesCount; i ++)
+    {
+        if (bytes[i] != memory[i])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+SignatureStore::SignatureStore(const std::vector<ByteSequence> &byteSequences,
+                               std::vector<Signature> &signatures)
+{
+    signatures.assign(byteSequences.size(), Signature());
+    internGuids(byteSequences, signatures);
+    storeBytes(byteSequences, signatures);
+
+    m_footprint.sequencesCount = byteSequences.size();
+    m_footprint.guidsCount = m_guidOffsets.size() - 1;
+    for (const auto &val : byteSequences)
+    {
+        m_footprint.sequencesBytes += val.size();
+        m_footprint.before += 2*(sizeof(ByteSequence) + val.size() + val.guid().size());
+    }
+    m_footprint.storedBytes = m_bytes.size();
+    m_footprint.after = sizeof(SignatureStore) + m_bytes.size() + m_guids.size()
+            + m_guidOffsets.size()*sizeof(uint64_t) + signatures.size()*sizeof(Signature);
+}
+
+void SignatureStore::internGuids(const std::vector<ByteSequence> &byteSequences,
+                                 std::vector<Signature> &signatures)
+{
+    std::unordered_map<std::string, GuidId> ids;
+    m_guidOffsets.push_back(0);
+    for (size_t i = 0; i < byteSequences.size(); i ++)
+    {
+        const Guid &guid = byteSequences[i].guid();
+        auto it = ids.find(guid);
+        if (it == ids.end())
+        {
+            it = ids.insert({guid, static_cast<GuidId>(ids.size())}).first;
+            m_guids += guid;
+            m_guidOffsets.push_back(m_guids.size());
+        }
+        signatures[i].guidId = it->second;
+    }
+    m_guids.shrink_to_fit();
+    m_guidOffsets.shrink_to_fit();
+}
+
+void SignatureStore::storeBytes(const std::vector<ByteSequence> &byteSequences,
+                                std::vector<Signature> &signatures)
+{
+    const size_t count = byteSequences.size();
+    auto bytes = [&byteSequences](size_t index) -> const Bytes &
+    {
+        return byteSequences[index].bytes();
+    };
+
+    // in lexicographic order a sequence which is prefix of any other one
+    // is prefix of the next one: chains end with the longest owner of bytes
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; i ++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&bytes](size_t a, size_t b)
+    {
+        return bytes(a) < bytes(b);
+    });
+    std::vector<size_t> prefixOwner(count);
+    std::vector<size_t> owners;
+    for (size_t i = count; i -- > 0;)
+    {
+        size_t current = order[i];
+        if (i + 1 < count && isPrefix(bytes(current), bytes(order[i + 1])))
+        {
+            prefixOwner[current] = prefixOwner[order[i + 1]];
+            m_footprint.sharedSequences ++;
+        }
+        else
+        {
+            prefixOwner[current] = current;
+            owners.push_back(current);
+        }
+    }
+
+    // the same for suffixes of owners in order of reversed bytes
+    std::sort(owners.begin(), owners.end(), [&bytes](size_t a, size_t b)
+    {
+        return std::lexicographical_compare(bytes(a).rbegin(), bytes(a).rend(),
+                                            bytes(b).rbegin(), bytes(b).rend());
+    });
+    std::vector<size_t> suffixOwner(count);
+    uint64_t arenaSize = 0;
+    for (size_t i = owners.size(); i -- > 0;)
+    {
+        size_t current = owners[i];
+        if (i + 1 < owners.size() && isSuffix(bytes(current), bytes(owners[i + 1])))
+        {
+            suffixOwner[current] = suffixOwner[owners[i + 1]];
+            m_footprint.sharedSequences ++;
+        }
+        else
+        {
+            suffixOwner[current] = current;
+            arenaSize += bytes(current).size();
+        }
+    }
+
+    // only bytes of sequences owning themselves are stored
+    std::vector<uint64_t> offsets(count);
+    m_bytes.reserve(arenaSize);
+    for (auto val : owners)
+    {
+        if (suffixOwner[val] == val)
+        {
+            offsets[val] = m_bytes.size();
+            m_bytes.insert(m_bytes.end(), bytes(val).begin(), bytes(val).end());
+        }
+    }
+    for (auto val : owners)
+    {
+        size_t owner = suffixOwner[val];
+        offsets[val] = offsets[owner] + bytes(owner).size() - bytes(val).size();
+    }
+
+    for (size_t i = 0; i < count; i ++)
+    {
+        signatures[i].bytes = m_bytes.data() + offsets[prefixOwner[i]];
+        signatures[i].bytesCount = static_cast<uint32_t>(bytes(i).size());
+        signatures[i].fileTypes = byteSequences[i].fileTypes();
+        signatures[i].databases = ALL_DATABASES;
+    }
+}
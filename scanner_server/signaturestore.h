@@ -0,0 +1,122 @@
+#pragma once
+
+#include <../common.h>
+#include <filetype.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct ByteSequence;
+
+typedef uint32_t GuidId;
+
+/**
+ * @brief DatabaseMask is a set of signature databases hosted by Manager:
+ * bit N stands for database with index N.
+ */
+typedef uint32_t DatabaseMask;
+
+const size_t MAX_DATABASES_COUNT = 32;
+const DatabaseMask ALL_DATABASES = ~DatabaseMask(0);
+
+/**
+ * @brief The SignatureFilter struct selects signatures searched in data:
+ * by types of data (@see ByteSequence::appliesTo) and by requested databases.
+ */
+struct SignatureFilter
+{
+    FileTypeMask fileTypes;
+    DatabaseMask databases;
+};
+
+/**
+ * @brief The Signature struct is a view of sequence stored in SignatureStore.
+ * It's valid while the store exists.
+ */
+struct Signature
+{
+    uint64_t size() const { return bytesCount; }
+
+    /**
+     * @brief find Fast scanning method in memory block.
+     * Uses comparing bytes as 64 bit values.
+     * @return true if sequence is found in memory block.
+     */
+    bool find(const void *firstByte, uint64_t remainingSize) const;
+
+    /**
+     * @brief appliesTo (@see ByteSequence::appliesTo), signature must belong
+     * to one of requested databases.
+     */
+    bool appliesTo(const SignatureFilter &filter) const
+    {
+        return (databases & filter.databases) != 0
+                && (fileTypes == 0 || (fileTypes & filter.fileTypes) != 0);
+    }
+
+    const char *bytes;
+    uint32_t bytesCount;
+    GuidId guidId;
+    FileTypeMask fileTypes;
+    // databases containing the signature, all ones by default
+    DatabaseMask databases;
+};
+
+/**
+ * @brief The SignatureFootprint struct describes memory used by sequences.
+ */
+struct SignatureFootprint
+{
+    uint64_t sequencesCount = 0;
+    uint64_t guidsCount = 0;
+    // bytes of all sequences and bytes stored after sharing
+    uint64_t sequencesBytes = 0;
+    uint64_t storedBytes = 0;
+    // sequences stored as duplicates, prefixes or suffixes of others
+    uint64_t sharedSequences = 0;
+    // objects and stored data sizes regardless of allocation overhead: two copies
+    // of ByteSequence (manager and scanners) before, store and signature views after
+    uint64_t before = 0;
+    uint64_t after = 0;
+};
+
+/**
+ * @brief The SignatureStore class is immutable storage of sequences bytes and GUIDs.
+ *
+ * GUIDs are interned: each distinct one is stored once and referenced by GuidId.
+ * Bytes of all sequences are kept in one arena: duplicates and sequences which are
+ * prefixes or suffixes of other ones don't take place, they point into bytes of
+ * longer sequences. Signatures are views, so the store can't be copied or moved.
+ */
+class SignatureStore
+{
+public:
+    /**
+     * @param signatures views of byteSequences in the same order.
+     */
+    SignatureStore(const std::vector<ByteSequence> &byteSequences, std::vector<Signature> &signatures);
+
+    SignatureStore(const SignatureStore &) = delete;
+    SignatureStore &operator=(const SignatureStore &) = delete;
+
+    Guid guid(GuidId id) const
+    {
+        return Guid(m_guids.data() + m_guidOffsets[id], m_guidOffsets[id + 1] - m_guidOffsets[id]);
+    }
+
+    /**
+     * @brief footprint counts one signature view per sequence owned by caller.
+     */
+    const SignatureFootprint &footprint() const { return m_footprint; }
+
+private:
+    void internGuids(const std::vector<ByteSequence> &byteSequences, std::vector<Signature> &signatures);
+    void storeBytes(const std::vector<ByteSequence> &byteSequences, std::vector<Signature> &signatures);
+
+    // arena of sequences bytes
+    std::vector<char> m_bytes;
+    // arena of GUIDs: GUID with id N takes [m_guidOffsets[N], m_guidOffsets[N + 1])
+    std::string m_guids;
+    std::vector<uint64_t> m_guidOffsets;
+    SignatureFootprint m_footprint;
+};
@@ -0,0 +1,242 @@
+#include <trace.h>
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+namespace
+{
+const char *TRACE_HEADER = "# method\tclient\tpriority\tstart_us\tlatency_us\tsize\terror\tresults\thash";
+
+const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+// size of blocks read for hashing files
+const size_t HASH_READ_SIZE = 1024*1024;
+
+/**
+ * @brief percentile nearest rank value of sorted latencies.
+ */
+uint64_t percentile(const std::vector<uint64_t> &sorted, unsigned percent)
+{
+    size_t rank = (sorted.size()*percent + 99)/100;
+    return sorted[std::max<size_t>(rank, 1) - 1];
+}
+}
+
+const char *asString(TraceMethod method)
+{
+    switch (method)
+    {
+    case TraceMethod::SCAN_FILE:
+        return "scanFile";
+    case TraceMethod::SCAN_BYTES:
+        return "scanBytes";
+    }
+    return "";
+}
+
+std::string formatTraceRecord(const TraceRecord &record)
+{
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(record.contentHash));
+
+    std::stringstream result;
+    result << asString(record.method) << '\t' << record.client
+           << '\t' << static_cast<unsigned>(record.priority)
+           << '\t' << record.startMicroseconds << '\t' << record.latencyMicroseconds
+           << '\t' << record.size << '\t' << static_cast<unsigned>(record.error)
+           << '\t' << record.resultsCount << '\t' << hash;
+    return result.str();
+}
+
+bool parseTraceRecord(const std::string &line, TraceRecord &record)
+{
+    std::stringstream stream(line);
+    std::string method;
+    unsigned priority;
+    unsigned error;
+    std::string hash;
+    if (!(stream >> method >> record.client >> priority >> record.startMicroseconds
+          >> record.latencyMicroseconds >> record.size >> error >> record.resultsCount >> hash))
+    {
+        return false;
+    }
+
+    if (method == asString(TraceMethod::SCAN_FILE))
+    {
+        record.method = TraceMethod::SCAN_FILE;
+    }
+    else if (method == asString(TraceMethod::SCAN_BYTES))
+    {
+        record.method = TraceMethod::SCAN_BYTES;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (priority >= REQUEST_PRIORITIES_COUNT || hash.size() != 16
+            || hash.find_first_not_of("0123456789abcdef") != std::string::npos)
+    {
+        return false;
+    }
+    record.priority = static_cast<RequestPriority>(priority);
+    record.error = static_cast<ResultError>(error);
+    record.contentHash = std::stoull(hash, nullptr, 16);
+    return true;
+}
+
+bool loadTrace(const std::string &filename, std::vector<TraceRecord> &records)
+{
+    records.clear();
+    std::ifstream stream(filename);
+    if (!stream)
+    {
+        return false;
+    }
+
+    std::string line;
+    while (getline(stream, line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+        TraceRecord record;
+        if (!parseTraceRecord(line, record))
+        {
+            return false;
+        }
+        records.push_back(record);
+    }
+    return true;
+}
+
+void sortByArrival(std::vector<TraceRecord> &records)
+{
+    std::stable_sort(records.begin(), records.end(), [](const TraceRecord &first, const TraceRecord &second)
+    {
+        return first.startMicroseconds < second.startMicroseconds;
+    });
+}
+
+uint64_t contentHash(const void *firstByte, uint64_t sizeInBytes, uint64_t seed)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(firstByte);
+    uint64_t hash = seed;
+    for (uint64_t i = 0; i < sizeInBytes; i ++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t fileContentHash(const std::string &filename)
+{
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return 0;
+    }
+
+    std::vector<char> buffer(HASH_READ_SIZE);
+    uint64_t hash = contentHash(nullptr, 0);
+    size_t actuallyRead;
+    while ((actuallyRead = fread(buffer.data(), 1, buffer.size(), file)) > 0)
+    {
+        hash = contentHash(buffer.data(), actuallyRead, hash);
+    }
+    fclose(file);
+    return hash;
+}
+
+LatencySummary summarizeLatencies(std::vector<uint64_t> latencies)
+{
+    LatencySummary summary;
+    if (latencies.empty())
+    {
+        return summary;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    uint64_t total = 0;
+    for (auto val : latencies)
+    {
+        total += val;
+    }
+    summary.count = latencies.size();
+    summary.mean = total/latencies.size();
+    summary.p50 = percentile(latencies, 50);
+    summary.p90 = percentile(latencies, 90);
+    summary.p99 = percentile(latencies, 99);
+    summary.max = latencies.back();
+    return summary;
+}
+
+TraceRecorder::TraceRecorder()
+    : m_hashContent(false)
+{
+}
+
+bool TraceRecorder::start(const std::string &filename, bool hashContent)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stream.is_open())
+    {
+        m_stream.close();
+    }
+    m_stream.clear();
+    m_stream.open(filename, std::ios::out | std::ios::trunc);
+    if (!m_stream)
+    {
+        return false;
+    }
+
+    m_stream << TRACE_HEADER << std::endl;
+    m_hashContent = hashContent;
+    m_start = now();
+    m_clients.clear();
+    return true;
+}
+
+void TraceRecorder::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_stream.is_open())
+    {
+        m_stream.close();
+    }
+}
+
+bool TraceRecorder::isRecording() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stream.is_open();
+}
+
+bool TraceRecorder::hashesContent() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stream.is_open() && m_hashContent;
+}
+
+void TraceRecorder::record(const std::string &client, std::chrono::steady_clock::time_point started,
+                           std::chrono::steady_clock::time_point finished, TraceRecord record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_stream.is_open())
+    {
+        return;
+    }
+
+    auto it = m_clients.insert({client, static_cast<uint32_t>(m_clients.size())}).first;
+    record.client = it->second;
+    // requests received before start of trace start at zero
+    record.startMicroseconds = started > m_start
+            ? std::chrono::duration_cast<std::chrono::microseconds>(started - m_start).count()
+            : 0;
+    record.latencyMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                finished - started).count();
+    // every record is flushed: trace is complete if server is killed
+    m_stream << formatTraceRecord(record) << std::endl;
+}
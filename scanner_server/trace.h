@@ -0,0 +1,131 @@
+#pragma once
+
+#include <../common.h>
+#include <scheduler.h>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The TraceMethod enum scan requests recorded in trace.
+ */
+enum class TraceMethod : uint8_t
+{
+    SCAN_FILE = 0,
+    SCAN_BYTES,
+};
+
+const char *asString(TraceMethod method);
+
+/**
+ * @brief The TraceRecord struct describes one scan request.
+ * Names of files and clients are not recorded: files are replayed
+ * by synthetic ones of the same size, clients are numbered in order of appearance.
+ */
+struct TraceRecord
+{
+    TraceMethod method = TraceMethod::SCAN_FILE;
+    uint32_t client = 0;
+    RequestPriority priority = RequestPriority::NORMAL;
+    // receiving time since trace start
+    uint64_t startMicroseconds = 0;
+    // from receiving till reply: includes waiting in scheduler queue
+    uint64_t latencyMicroseconds = 0;
+    uint64_t size = 0;
+    ResultError error = ResultError::SUCCESS;
+    uint32_t resultsCount = 0;
+    // FNV-1a of content, 0 if hashing is disabled
+    uint64_t contentHash = 0;
+};
+
+/**
+ * @brief formatTraceRecord one line of trace file: tab separated fields in order of TraceRecord.
+ */
+std::string formatTraceRecord(const TraceRecord &record);
+bool parseTraceRecord(const std::string &line, TraceRecord &record);
+
+/**
+ * @brief loadTrace reads trace file written by TraceRecorder.
+ * Records are in order of replies (@see sortByArrival).
+ * @return false if file can't be opened or has wrong lines.
+ */
+bool loadTrace(const std::string &filename, std::vector<TraceRecord> &records);
+
+/**
+ * @brief sortByArrival orders records by receiving time, records received
+ * at the same time keep their order.
+ */
+void sortByArrival(std::vector<TraceRecord> &records);
+
+/**
+ * @brief contentHash FNV-1a hash of memory block, continues hash passed as seed.
+ */
+uint64_t contentHash(const void *firstByte, uint64_t sizeInBytes, uint64_t seed = 0xcbf29ce484222325ULL);
+
+/**
+ * @brief fileContentHash FNV-1a hash of file content, 0 if file can't be read.
+ */
+uint64_t fileContentHash(const std::string &filename);
+
+/**
+ * @brief The LatencySummary struct distribution of latencies in microseconds.
+ */
+struct LatencySummary
+{
+    uint64_t count = 0;
+    uint64_t mean = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t max = 0;
+};
+
+/**
+ * @brief summarizeLatencies nearest rank percentiles of latencies.
+ */
+LatencySummary summarizeLatencies(std::vector<uint64_t> latencies);
+
+/**
+ * @brief The TraceRecorder class writes scan requests to trace file.
+ * It's thread safe: requests are recorded by scheduler workers when they're replied.
+ */
+class TraceRecorder
+{
+public:
+    TraceRecorder();
+
+    /**
+     * @brief start opens trace file, previous trace is closed. Time of records is counted from now.
+     * @param hashContent enables content hashes: files are read once more after scanning.
+     */
+    bool start(const std::string &filename, bool hashContent);
+    void stop();
+
+    bool isRecording() const;
+    bool hashesContent() const;
+
+    /**
+     * @brief now time of request receiving and replying used by record.
+     */
+    static std::chrono::steady_clock::time_point now() { return std::chrono::steady_clock::now(); }
+
+    /**
+     * @brief record writes request which has been received at started and replied at finished.
+     * Does nothing if recording is stopped. Record fields method, priority, size,
+     * error, resultsCount and contentHash are taken from record argument.
+     * @param client client name, numbered in trace.
+     */
+    void record(const std::string &client, std::chrono::steady_clock::time_point started,
+                std::chrono::steady_clock::time_point finished, TraceRecord record);
+
+private:
+    mutable std::mutex m_mutex;
+    std::ofstream m_stream;
+    bool m_hashContent;
+    std::chrono::steady_clock::time_point m_start;
+    std::map<std::string, uint32_t> m_clients;
+};
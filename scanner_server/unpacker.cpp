@@ -0,0 +1,1057 @@
+#include <unpacker.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace
+{
+// total unpacked size allowed for any container regardless of ratio
+const uint64_t MIN_UNPACKED_SIZE_LIMIT = 1024*1024;
+// size of output buffer of inflater and of reads of zip members
+const size_t UNPACK_BUFFER_SIZE = 64*1024;
+const size_t TAR_BLOCK_SIZE = 512;
+const size_t ZIP_LOCAL_HEADER_SIZE = 30;
+const size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+const size_t ZIP_END_OF_DIRECTORY_SIZE = 22;
+const uint32_t ZIP_LOCAL_HEADER_SIGNATURE = 0x04034b50;
+const uint32_t ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+const uint32_t ZIP_END_OF_DIRECTORY_SIGNATURE = 0x06054b50;
+const uint32_t ZIP_DESCRIPTOR_SIGNATURE = 0x08074b50;
+const uint16_t ZIP_FLAG_ENCRYPTED = 0x1;
+const uint16_t ZIP_FLAG_DESCRIPTOR = 0x8;
+const uint16_t ZIP_METHOD_STORED = 0;
+const uint16_t ZIP_METHOD_DEFLATED = 8;
+
+uint16_t readLE16(const char *data)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+uint32_t readLE32(const char *data)
+{
+    return readLE16(data) | (static_cast<uint32_t>(readLE16(data + 2)) << 16);
+}
+
+/**
+ * @brief parseTarNumber parses octal or base-256 number field of tar header.
+ */
+uint64_t parseTarNumber(const char *field, size_t size)
+{
+    uint64_t value = 0;
+    if (static_cast<unsigned char>(field[0]) & 0x80)
+    {
+        value = field[0] & 0x7f;
+        for (size_t i = 1; i < size; i ++)
+        {
+            value = (value << 8) | static_cast<unsigned char>(field[i]);
+        }
+        return value;
+    }
+
+    size_t i = 0;
+    while (i < size && (field[i] == ' ' || field[i] == '\0'))
+    {
+        i ++;
+    }
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i ++)
+    {
+        value = (value << 3) | static_cast<uint64_t>(field[i] - '0');
+    }
+    return value;
+}
+
+/**
+ * @brief The StreamScanner class scans stream by blocks of chunk size
+ * overlapped the same way as Manager::scanFile reads files.
+ * Window is taken from pool with the first bytes and returned on finish.
+ */
+class StreamScanner : public DataSink
+{
+public:
+    explicit StreamScanner(UnpackContext &context)
+        : m_context(context)
+        , m_usedSize(0)
+        , m_pendingSize(0)
+    {}
+
+    bool write(const char *data, size_t size) override
+    {
+        if (size > 0 && !m_window)
+        {
+            m_window = m_context.acquireWindow();
+            if (!m_window)
+            {
+                return false;
+            }
+        }
+
+        const size_t windowSize = static_cast<size_t>(m_window.size());
+        const size_t overlap = static_cast<size_t>(m_context.overlap());
+        while (size > 0)
+        {
+            size_t portion = std::min(size, windowSize - m_usedSize);
+            memcpy(m_window.data() + m_usedSize, data, portion);
+            data += portion;
+            size -= portion;
+            m_usedSize += portion;
+            m_pendingSize += portion;
+
+            if (m_usedSize == windowSize)
+            {
+                m_context.scan({m_window.data(), m_usedSize});
+                memmove(m_window.data(), m_window.data() + m_usedSize - overlap, overlap);
+                m_usedSize = overlap;
+                m_pendingSize = 0;
+            }
+        }
+        return true;
+    }
+
+    void finish() override
+    {
+        if (m_pendingSize > 0)
+        {
+            m_context.scan({m_window.data(), m_usedSize});
+        }
+        m_window.release();
+        m_usedSize = 0;
+        m_pendingSize = 0;
+    }
+
+private:
+    UnpackContext &m_context;
+    PooledBuffer m_window;
+    size_t m_usedSize;
+    // bytes in window which are not scanned yet
+    size_t m_pendingSize;
+};
+
+/**
+ * @brief The ContainerSink class sniffs type of stream by its header and passes the stream
+ * to unpacker of detected container type and (optionally) to raw bytes scanner.
+ */
+class ContainerSink : public DataSink
+{
+public:
+    ContainerSink(UnpackContext &context, unsigned depth, bool scanRaw)
+        : m_context(context)
+        , m_depth(depth)
+        , m_sniffed(false)
+    {
+        if (scanRaw)
+        {
+            m_raw.reset(new StreamScanner(context));
+        }
+    }
+
+    bool write(const char *data, size_t size) override
+    {
+        if (!m_sniffed)
+        {
+            size_t portion = std::min(size, CONTAINER_SNIFF_SIZE - m_header.size());
+            m_header.append(data, portion);
+            data += portion;
+            size -= portion;
+            if (m_header.size() < CONTAINER_SNIFF_SIZE)
+            {
+                return !m_context.stopped();
+            }
+
+            sniff();
+            if (!forward(m_header.data(), m_header.size()))
+            {
+                return false;
+            }
+        }
+
+        return forward(data, size);
+    }
+
+    void finish() override
+    {
+        if (!m_sniffed)
+        {
+            sniff();
+            forward(m_header.data(), m_header.size());
+        }
+        if (m_unpacker)
+        {
+            m_unpacker->finish();
+        }
+        if (m_raw)
+        {
+            m_raw->finish();
+        }
+    }
+
+private:
+    void sniff()
+    {
+        m_sniffed = true;
+        if (m_depth >= m_context.limits().maxDepth)
+        {
+            return;
+        }
+
+        ContainerType type = sniffContainer(m_header.data(), m_header.size());
+        for (auto unpacker : unpackers())
+        {
+            if (unpacker->type() == type)
+            {
+                m_unpacker = unpacker->createSink(m_context, m_depth);
+                break;
+            }
+        }
+    }
+
+    bool forward(const char *data, size_t size)
+    {
+        if (size > 0)
+        {
+            // broken or finished container: raw scanning goes on anyway
+            if (m_unpacker && !m_unpacker->write(data, size))
+            {
+                m_unpacker->finish();
+                m_unpacker.reset();
+            }
+            if (m_raw)
+            {
+                m_raw->write(data, size);
+            }
+        }
+        return !m_context.stopped() && (m_unpacker || m_raw);
+    }
+
+    UnpackContext &m_context;
+    const unsigned m_depth;
+    bool m_sniffed;
+    std::string m_header;
+    std::unique_ptr<DataSink> m_unpacker;
+    std::unique_ptr<DataSink> m_raw;
+};
+
+/**
+ * @brief The Inflater class is a wrapper of zlib inflate stream.
+ */
+class Inflater
+{
+public:
+    enum class Status
+    {
+        NEED_MORE,
+        STREAM_END,
+        FAILED,
+    };
+
+    explicit Inflater(int windowBits)
+        : m_output(UNPACK_BUFFER_SIZE)
+    {
+        memset(&m_stream, 0, sizeof(m_stream));
+        m_initialized = inflateInit2(&m_stream, windowBits) == Z_OK;
+    }
+
+    ~Inflater()
+    {
+        if (m_initialized)
+        {
+            inflateEnd(&m_stream);
+        }
+    }
+
+    void reset()
+    {
+        inflateReset(&m_stream);
+    }
+
+    /**
+     * @brief inflate decompresses input into output sink until the input
+     * or the compressed stream is over.
+     * @param data, size are moved forward by consumed bytes count.
+     */
+    Status inflate(UnpackContext &context, const char *&data, size_t &size, DataSink &output)
+    {
+        if (!m_initialized)
+        {
+            return Status::FAILED;
+        }
+
+        while (size > 0)
+        {
+            uInt portion = static_cast<uInt>(std::min<size_t>(size, std::numeric_limits<uInt>::max()));
+            m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            m_stream.avail_in = portion;
+
+            Status status = inflatePortion(context, output);
+
+            size_t consumed = portion - m_stream.avail_in;
+            data += consumed;
+            size -= consumed;
+            if (status != Status::NEED_MORE)
+            {
+                return status;
+            }
+        }
+        return Status::NEED_MORE;
+    }
+
+private:
+    Status inflatePortion(UnpackContext &context, DataSink &output)
+    {
+        do
+        {
+            // compressed data may expand a lot: cancellation is checked per output portion
+            if (context.stopped())
+            {
+                return Status::FAILED;
+            }
+
+            m_stream.next_out = reinterpret_cast<Bytef *>(m_output.data());
+            m_stream.avail_out = static_cast<uInt>(m_output.size());
+
+            int result = ::inflate(&m_stream, Z_NO_FLUSH);
+            if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR)
+            {
+                return Status::FAILED;
+            }
+
+            size_t produced = m_output.size() - m_stream.avail_out;
+            if (produced > 0
+                    && (!context.account(produced) || !output.write(m_output.data(), produced)))
+            {
+                return Status::FAILED;
+            }
+
+            if (result == Z_STREAM_END)
+            {
+                return Status::STREAM_END;
+            }
+            if (result == Z_BUF_ERROR)
+            {
+                break;
+            }
+        }
+        while (m_stream.avail_in > 0 || m_stream.avail_out == 0);
+
+        return Status::NEED_MORE;
+    }
+
+    z_stream m_stream;
+    bool m_initialized;
+    std::vector<char> m_output;
+};
+
+/**
+ * @brief The InflateSink class unpacks gzip and zlib streams.
+ */
+class InflateSink : public DataSink
+{
+public:
+    InflateSink(UnpackContext &context, unsigned depth, int windowBits, bool multiMember)
+        : m_context(context)
+        , m_inflater(windowBits)
+        , m_output(context.createSink(depth + 1, true))
+        , m_multiMember(multiMember)
+        , m_ended(false)
+    {}
+
+    bool write(const char *data, size_t size) override
+    {
+        while (size > 0 && !m_ended)
+        {
+            switch (m_inflater.inflate(m_context, data, size, *m_output))
+            {
+            case Inflater::Status::FAILED:
+                return false;
+            case Inflater::Status::STREAM_END:
+                // gzip file may consist of several concatenated members
+                if (m_multiMember && size > 0)
+                {
+                    m_inflater.reset();
+                }
+                else
+                {
+                    m_ended = true;
+                }
+                break;
+            case Inflater::Status::NEED_MORE:
+                break;
+            }
+        }
+        return true;
+    }
+
+    void finish() override
+    {
+        m_output->finish();
+    }
+
+private:
+    UnpackContext &m_context;
+    Inflater m_inflater;
+    std::unique_ptr<DataSink> m_output;
+    const bool m_multiMember;
+    // trailing bytes after the compressed stream are ignored
+    bool m_ended;
+};
+
+/**
+ * @brief The TarSink class unpacks tar stream. Every regular file is a separate stream.
+ */
+class TarSink : public DataSink
+{
+public:
+    TarSink(UnpackContext &context, unsigned depth)
+        : m_context(context)
+        , m_depth(depth)
+        , m_state(State::HEADER)
+        , m_remainingSize(0)
+        , m_paddingSize(0)
+    {}
+
+    bool write(const char *data, size_t size) override
+    {
+        while (size > 0 && m_state != State::DONE)
+        {
+            if (m_state == State::HEADER)
+            {
+                size_t portion = std::min(size, TAR_BLOCK_SIZE - m_header.size());
+                m_header.append(data, portion);
+                data += portion;
+                size -= portion;
+                if (m_header.size() == TAR_BLOCK_SIZE)
+                {
+                    parseHeader();
+                    m_header.clear();
+                }
+                continue;
+            }
+
+            // State::DATA
+            size_t portion = std::min<uint64_t>(size, m_remainingSize);
+            if (portion > 0 && m_member && !m_member->write(data, portion))
+            {
+                finishMember();
+            }
+            m_remainingSize -= portion;
+            data += portion;
+            size -= portion;
+
+            size_t padding = std::min<uint64_t>(size, m_paddingSize);
+            m_paddingSize -= padding;
+            data += padding;
+            size -= padding;
+
+            if (m_remainingSize == 0 && m_paddingSize == 0)
+            {
+                finishMember();
+                m_state = State::HEADER;
+            }
+        }
+        return m_state != State::DONE && !m_context.stopped();
+    }
+
+    void finish() override
+    {
+        finishMember();
+    }
+
+private:
+    enum class State
+    {
+        HEADER,
+        DATA,
+        DONE,
+    };
+
+    void parseHeader()
+    {
+        const char *block = m_header.data();
+
+        // archive end marker or not a tar header at all
+        uint64_t checksum = 0;
+        for (size_t i = 0; i < TAR_BLOCK_SIZE; i ++)
+        {
+            checksum += (i >= 148 && i < 156) ? ' ' : static_cast<unsigned char>(block[i]);
+        }
+        if (checksum == 8*' ' || checksum != parseTarNumber(block + 148, 8))
+        {
+            m_state = State::DONE;
+            return;
+        }
+
+        m_remainingSize = parseTarNumber(block + 124, 12);
+        m_paddingSize = (TAR_BLOCK_SIZE - m_remainingSize%TAR_BLOCK_SIZE)%TAR_BLOCK_SIZE;
+
+        char typeFlag = block[156];
+        if (typeFlag == '0' || typeFlag == '\0' || typeFlag == '7')
+        {
+            m_member = m_context.createSink(m_depth + 1, true);
+        }
+        m_state = m_remainingSize + m_paddingSize > 0 ? State::DATA : State::HEADER;
+        if (m_state == State::HEADER)
+        {
+            finishMember();
+        }
+    }
+
+    void finishMember()
+    {
+        if (m_member)
+        {
+            m_member->finish();
+            m_member.reset();
+        }
+    }
+
+    UnpackContext &m_context;
+    const unsigned m_depth;
+    State m_state;
+    std::string m_header;
+    uint64_t m_remainingSize;
+    uint64_t m_paddingSize;
+    std::unique_ptr<DataSink> m_member;
+};
+
+/**
+ * @brief The ZipSink class unpacks zip stream sequentially by its local headers.
+ * Used for nested zip archives and when central directory is not available.
+ */
+class ZipSink : public DataSink
+{
+public:
+    ZipSink(UnpackContext &context, unsigned depth)
+        : m_context(context)
+        , m_depth(depth)
+        , m_inflater(-MAX_WBITS)
+        , m_state(State::LOCAL_HEADER)
+        , m_remainingSize(0)
+        , m_dataSize(0)
+        , m_flags(0)
+        , m_method(0)
+    {}
+
+    bool write(const char *data, size_t size) override
+    {
+        while (size > 0 && m_state != State::DONE)
+        {
+            switch (m_state)
+            {
+            case State::LOCAL_HEADER:
+                if (accumulate(data, size, ZIP_LOCAL_HEADER_SIZE))
+                {
+                    parseLocalHeader();
+                }
+                break;
+            case State::NAME_EXTRA:
+                if (skip(data, size))
+                {
+                    startData();
+                }
+                break;
+            case State::STORED:
+            {
+                size_t portion = std::min<uint64_t>(size, m_remainingSize);
+                if (m_member && !m_member->write(data, portion))
+                {
+                    finishMember();
+                }
+                data += portion;
+                size -= portion;
+                m_remainingSize -= portion;
+                if (m_remainingSize == 0)
+                {
+                    finishMember();
+                    m_state = State::LOCAL_HEADER;
+                }
+                break;
+            }
+            case State::DEFLATED:
+                switch (m_inflater.inflate(m_context, data, size, *m_member))
+                {
+                case Inflater::Status::FAILED:
+                    finishMember();
+                    m_state = State::DONE;
+                    break;
+                case Inflater::Status::STREAM_END:
+                    finishMember();
+                    m_state = (m_flags & ZIP_FLAG_DESCRIPTOR) ? State::DESCRIPTOR : State::LOCAL_HEADER;
+                    break;
+                case Inflater::Status::NEED_MORE:
+                    break;
+                }
+                break;
+            case State::DESCRIPTOR:
+                // descriptor is crc, sizes and optional signature before them
+                if (accumulate(data, size, sizeof(uint32_t)))
+                {
+                    m_remainingSize = readLE32(m_header.data()) == ZIP_DESCRIPTOR_SIGNATURE ? 12 : 8;
+                    m_header.clear();
+                    m_state = State::SKIP;
+                }
+                break;
+            case State::SKIP:
+                if (skip(data, size))
+                {
+                    m_state = State::LOCAL_HEADER;
+                }
+                break;
+            case State::DONE:
+                break;
+            }
+        }
+        return m_state != State::DONE && !m_context.stopped();
+    }
+
+    void finish() override
+    {
+        finishMember();
+    }
+
+private:
+    enum class State
+    {
+        LOCAL_HEADER,
+        NAME_EXTRA,
+        STORED,
+        DEFLATED,
+        DESCRIPTOR,
+        SKIP,
+        DONE,
+    };
+
+    /**
+     * @brief accumulate collects fixed size header in m_header.
+     * @return true when header is complete (caller clears it after parsing).
+     */
+    bool accumulate(const char *&data, size_t &size, size_t headerSize)
+    {
+        size_t portion = std::min(size, headerSize - m_header.size());
+        m_header.append(data, portion);
+        data += portion;
+        size -= portion;
+        return m_header.size() == headerSize;
+    }
+
+    /**
+     * @brief skip skips m_remainingSize bytes.
+     * @return true when all bytes are skipped.
+     */
+    bool skip(const char *&data, size_t &size)
+    {
+        size_t portion = std::min<uint64_t>(size, m_remainingSize);
+        data += portion;
+        size -= portion;
+        m_remainingSize -= portion;
+        return m_remainingSize == 0;
+    }
+
+    void parseLocalHeader()
+    {
+        const char *header = m_header.data();
+        if (readLE32(header) != ZIP_LOCAL_HEADER_SIGNATURE)
+        {
+            // central directory or garbage: no more members
+            m_state = State::DONE;
+            return;
+        }
+
+        m_flags = readLE16(header + 6);
+        m_method = readLE16(header + 8);
+        m_dataSize = readLE32(header + 18);
+        m_remainingSize = readLE16(header + 26) + readLE16(header + 28);
+        m_header.clear();
+        m_state = State::NAME_EXTRA;
+        if (m_remainingSize == 0)
+        {
+            startData();
+        }
+    }
+
+    void startData()
+    {
+        bool sizeKnown = !(m_flags & ZIP_FLAG_DESCRIPTOR) || m_dataSize != 0;
+        if (m_dataSize == std::numeric_limits<uint32_t>::max()
+                || (m_method != ZIP_METHOD_DEFLATED && !sizeKnown))
+        {
+            // zip64 or unknown size of not deflated data: end of member can't be found
+            m_state = State::DONE;
+            return;
+        }
+
+        m_remainingSize = m_dataSize;
+        if (m_flags & ZIP_FLAG_ENCRYPTED)
+        {
+            m_state = State::SKIP;
+        }
+        else if (m_method == ZIP_METHOD_STORED)
+        {
+            m_member = m_context.createSink(m_depth + 1, true);
+            m_state = State::STORED;
+        }
+        else if (m_method == ZIP_METHOD_DEFLATED)
+        {
+            m_member = m_context.createSink(m_depth + 1, true);
+            m_inflater.reset();
+            m_state = State::DEFLATED;
+        }
+        else
+        {
+            m_state = State::SKIP;
+        }
+
+        if (m_state != State::DEFLATED && m_remainingSize == 0)
+        {
+            finishMember();
+            m_state = State::LOCAL_HEADER;
+        }
+    }
+
+    void finishMember()
+    {
+        if (m_member)
+        {
+            m_member->finish();
+            m_member.reset();
+        }
+    }
+
+    UnpackContext &m_context;
+    const unsigned m_depth;
+    Inflater m_inflater;
+    State m_state;
+    std::string m_header;
+    uint64_t m_remainingSize;
+    uint64_t m_dataSize;
+    uint16_t m_flags;
+    uint16_t m_method;
+    std::unique_ptr<DataSink> m_member;
+};
+
+class GzipUnpacker : public Unpacker
+{
+public:
+    ContainerType type() const override { return ContainerType::GZIP; }
+    std::unique_ptr<DataSink> createSink(UnpackContext &context, unsigned depth) const override
+    {
+        return std::unique_ptr<DataSink>(new InflateSink(context, depth, MAX_WBITS + 16, true));
+    }
+};
+
+class ZlibUnpacker : public Unpacker
+{
+public:
+    ContainerType type() const override { return ContainerType::ZLIB; }
+    std::unique_ptr<DataSink> createSink(UnpackContext &context, unsigned depth) const override
+    {
+        return std::unique_ptr<DataSink>(new InflateSink(context, depth, MAX_WBITS, false));
+    }
+};
+
+class TarUnpacker : public Unpacker
+{
+public:
+    ContainerType type() const override { return ContainerType::TAR; }
+    std::unique_ptr<DataSink> createSink(UnpackContext &context, unsigned depth) const override
+    {
+        return std::unique_ptr<DataSink>(new TarSink(context, depth));
+    }
+};
+
+class ZipUnpacker : public Unpacker
+{
+public:
+    ContainerType type() const override { return ContainerType::ZIP; }
+    std::unique_ptr<DataSink> createSink(UnpackContext &context, unsigned depth) const override
+    {
+        return std::unique_ptr<DataSink>(new ZipSink(context, depth));
+    }
+};
+
+struct ZipMember
+{
+    uint64_t localHeaderOffset;
+    uint64_t compressedSize;
+    uint16_t method;
+};
+
+bool preadAll(int fd, char *buffer, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t actuallyRead = pread(fd, buffer, size, static_cast<off_t>(offset));
+        if (actuallyRead < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (actuallyRead <= 0)
+        {
+            return false;
+        }
+        buffer += actuallyRead;
+        size -= static_cast<size_t>(actuallyRead);
+        offset += static_cast<uint64_t>(actuallyRead);
+    }
+    return true;
+}
+
+bool readZipDirectory(int fd, uint64_t fileSize, std::vector<ZipMember> &members)
+{
+    // end of central directory record is followed by comment up to 64 KB
+    size_t tailSize = static_cast<size_t>(std::min<uint64_t>(fileSize,
+            ZIP_END_OF_DIRECTORY_SIZE + std::numeric_limits<uint16_t>::max()));
+    if (tailSize < ZIP_END_OF_DIRECTORY_SIZE)
+    {
+        return false;
+    }
+    std::vector<char> tail(tailSize);
+    if (!preadAll(fd, tail.data(), tailSize, fileSize - tailSize))
+    {
+        return false;
+    }
+
+    const char *endRecord = nullptr;
+    for (size_t i = tailSize - ZIP_END_OF_DIRECTORY_SIZE + 1; i > 0; i --)
+    {
+        if (readLE32(tail.data() + i - 1) == ZIP_END_OF_DIRECTORY_SIGNATURE)
+        {
+            endRecord = tail.data() + i - 1;
+            break;
+        }
+    }
+    if (endRecord == nullptr)
+    {
+        return false;
+    }
+
+    uint32_t directorySize = readLE32(endRecord + 12);
+    uint32_t directoryOffset = readLE32(endRecord + 16);
+    if (directoryOffset == std::numeric_limits<uint32_t>::max()
+            || static_cast<uint64_t>(directoryOffset) + directorySize > fileSize)
+    {
+        // zip64 is not supported
+        return false;
+    }
+
+    std::vector<char> directory(directorySize);
+    if (!preadAll(fd, directory.data(), directorySize, directoryOffset))
+    {
+        return false;
+    }
+
+    size_t position = 0;
+    while (position + ZIP_CENTRAL_HEADER_SIZE <= directory.size())
+    {
+        const char *header = directory.data() + position;
+        if (readLE32(header) != ZIP_CENTRAL_HEADER_SIGNATURE)
+        {
+            break;
+        }
+
+        uint16_t flags = readLE16(header + 8);
+        uint16_t method = readLE16(header + 10);
+        uint32_t compressedSize = readLE32(header + 20);
+        uint32_t localHeaderOffset = readLE32(header + 42);
+        if (!(flags & ZIP_FLAG_ENCRYPTED)
+                && (method == ZIP_METHOD_STORED || method == ZIP_METHOD_DEFLATED)
+                && compressedSize != std::numeric_limits<uint32_t>::max()
+                && localHeaderOffset != std::numeric_limits<uint32_t>::max())
+        {
+            members.push_back({localHeaderOffset, compressedSize, method});
+        }
+
+        position += ZIP_CENTRAL_HEADER_SIZE + readLE16(header + 28)
+                + readLE16(header + 30) + readLE16(header + 32);
+    }
+    return true;
+}
+
+void unpackZipMember(UnpackContext &context, int fd, const ZipMember &member)
+{
+    char header[ZIP_LOCAL_HEADER_SIZE];
+    if (!preadAll(fd, header, sizeof(header), member.localHeaderOffset)
+            || readLE32(header) != ZIP_LOCAL_HEADER_SIGNATURE)
+    {
+        return;
+    }
+
+    uint64_t position = member.localHeaderOffset + ZIP_LOCAL_HEADER_SIZE
+            + readLE16(header + 26) + readLE16(header + 28);
+    uint64_t remainingSize = member.compressedSize;
+
+    std::unique_ptr<DataSink> sink = context.createSink(1, true);
+    std::unique_ptr<Inflater> inflater;
+    if (member.method == ZIP_METHOD_DEFLATED)
+    {
+        inflater.reset(new Inflater(-MAX_WBITS));
+    }
+
+    std::vector<char> buffer(UNPACK_BUFFER_SIZE);
+    while (remainingSize > 0 && !context.stopped())
+    {
+        size_t portion = static_cast<size_t>(std::min<uint64_t>(remainingSize, buffer.size()));
+        if (!preadAll(fd, buffer.data(), portion, position))
+        {
+            break;
+        }
+        position += portion;
+        remainingSize -= portion;
+
+        if (inflater)
+        {
+            const char *data = buffer.data();
+            if (inflater->inflate(context, data, portion, *sink) != Inflater::Status::NEED_MORE)
+            {
+                break;
+            }
+        }
+        else if (!sink->write(buffer.data(), portion))
+        {
+            break;
+        }
+    }
+
+    sink->finish();
+}
+}
+
+ContainerType sniffContainer(const char *header, size_t size)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(header);
+    if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b)
+    {
+        return ContainerType::GZIP;
+    }
+    if (size >= 4 && readLE32(header) == ZIP_LOCAL_HEADER_SIGNATURE)
+    {
+        return ContainerType::ZIP;
+    }
+    if (size >= 262 && memcmp(header + 257, "ustar", 5) == 0)
+    {
+        return ContainerType::TAR;
+    }
+    // compression method 8 with 32K window and one of standard levels
+    if (size >= 2 && bytes[0] == 0x78
+            && (bytes[1] == 0x01 || bytes[1] == 0x5e || bytes[1] == 0x9c || bytes[1] == 0xda))
+    {
+        return ContainerType::ZLIB;
+    }
+    return ContainerType::NONE;
+}
+
+const std::vector<const Unpacker *> &unpackers()
+{
+    static const GzipUnpacker gzipUnpacker;
+    static const ZlibUnpacker zlibUnpacker;
+    static const TarUnpacker tarUnpacker;
+    static const ZipUnpacker zipUnpacker;
+    static const std::vector<const Unpacker *> registered
+    {
+        &gzipUnpacker,
+        &zlibUnpacker,
+        &tarUnpacker,
+        &zipUnpacker,
+    };
+    return registered;
+}
+
+const uint64_t UnpackContext::MIN_WINDOW_CHUNK_SIZE;
+
+UnpackContext::UnpackContext(const UnpackLimits &limits, uint64_t containerSize,
+                             uint64_t chunkSize, uint64_t overlap, BufferPool &pool, cb_block scan,
+                             const std::atomic<bool> *cancelled)
+    : m_limits(limits)
+    , m_chunkSize(chunkSize)
+    , m_overlap(overlap)
+    , m_pool(pool)
+    , m_scan(scan)
+    , m_cancelled(cancelled)
+    , m_unpackedSize(0)
+    , m_limitExceeded(false)
+    , m_outOfMemory(false)
+{
+    uint64_t ratioLimit = std::numeric_limits<uint64_t>::max();
+    if (limits.maxRatio == 0 || containerSize <= ratioLimit/limits.maxRatio)
+    {
+        ratioLimit = containerSize*limits.maxRatio;
+    }
+    m_maxUnpackedSize = std::min(limits.maxUnpackedSize,
+                                 std::max(ratioLimit, MIN_UNPACKED_SIZE_LIMIT));
+}
+
+std::unique_ptr<DataSink> UnpackContext::createSink(unsigned depth, bool scanRaw)
+{
+    return std::unique_ptr<DataSink>(new ContainerSink(*this, depth, scanRaw));
+}
+
+PooledBuffer UnpackContext::acquireWindow()
+{
+    PooledBuffer window = m_pool.acquire(m_chunkSize + m_overlap,
+                                         std::min(m_chunkSize, MIN_WINDOW_CHUNK_SIZE) + m_overlap,
+                                         m_cancelled);
+    if (!window && !(m_cancelled != nullptr && m_cancelled->load()))
+    {
+        m_outOfMemory = true;
+    }
+    return window;
+}
+
+bool UnpackContext::account(size_t unpackedBytes)
+{
+    if (m_unpackedSize.fetch_add(unpackedBytes) + unpackedBytes > m_maxUnpackedSize)
+    {
+        m_limitExceeded = true;
+    }
+    return !m_limitExceeded;
+}
+
+bool unpackZipFile(UnpackContext &context, const std::string &filename, unsigned threadsCount)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    std::vector<ZipMember> members;
+    bool found = fstat(fd, &fileStat) == 0
+            && readZipDirectory(fd, static_cast<uint64_t>(fileStat.st_size), members);
+    if (found && !members.empty())
+    {
+        std::atomic<size_t> nextMember(0);
+        auto worker = [&]()
+        {
+            for (size_t i = nextMember++; i < members.size(); i = nextMember++)
+            {
+                if (context.stopped())
+                {
+                    break;
+                }
+                unpackZipMember(context, fd, members[i]);
+            }
+        };
+
+        threadsCount = static_cast<unsigned>(std::max<size_t>(1,
+                std::min<size_t>(threadsCount, members.size())));
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < threadsCount; i ++)
+        {
+            threads.push_back(std::thread(worker));
+        }
+        worker();
+        for (auto &val : threads)
+        {
+            val.join();
+        }
+    }
+
+    close(fd);
+    return found;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <bufferpool.h>
+#include <scanner.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The UnpackLimits struct protects from decompression bombs.
+ */
+struct UnpackLimits
+{
+    UnpackLimits()
+        : maxDepth(3)
+        , maxRatio(100)
+        , maxUnpackedSize(4ull*1024*1024*1024)
+    {}
+    /**
+     * @brief maxDepth maximal nesting level of containers to unpack.
+     */
+    unsigned maxDepth;
+    /**
+     * @brief maxRatio maximal ratio of total unpacked size to container file size.
+     */
+    uint64_t maxRatio;
+    /**
+     * @brief maxUnpackedSize maximal total unpacked size of single container file.
+     */
+    uint64_t maxUnpackedSize;
+};
+
+enum class ContainerType : uint8_t
+{
+    NONE = 0,
+    GZIP,
+    ZLIB,
+    TAR,
+    ZIP,
+};
+
+/**
+ * @brief CONTAINER_SNIFF_SIZE bytes from stream start are enough to detect any container type.
+ */
+const size_t CONTAINER_SNIFF_SIZE = 512;
+
+/**
+ * @brief sniffContainer detects container type by header of the stream.
+ */
+ContainerType sniffContainer(const char *header, size_t size);
+
+/**
+ * @brief The DataSink interface receives a stream of bytes by portions.
+ */
+class DataSink
+{
+public:
+    virtual ~DataSink() {}
+
+    /**
+     * @brief write passes next portion of the stream.
+     * @return false if sink doesn't accept data anymore (error or limits exceeded).
+     */
+    virtual bool write(const char *data, size_t size) = 0;
+
+    /**
+     * @brief finish is called once at the end of the stream.
+     */
+    virtual void finish() = 0;
+};
+
+/**
+ * @brief cb_block used for scanning memory blocks of unpacked data.
+ * May be called from several threads simultaneously.
+ */
+typedef std::function<void(MemoryBlock)> cb_block;
+
+class UnpackContext;
+
+/**
+ * @brief The Unpacker interface decodes one container format.
+ * Unpacked streams are passed to sinks created by context (@see UnpackContext::createSink),
+ * so nested containers are unpacked recursively without temporary files.
+ */
+class Unpacker
+{
+public:
+    virtual ~Unpacker() {}
+
+    virtual ContainerType type() const = 0;
+
+    /**
+     * @brief createSink creates decoder of container placed at nesting level depth.
+     */
+    virtual std::unique_ptr<DataSink> createSink(UnpackContext &context, unsigned depth) const = 0;
+};
+
+/**
+ * @brief unpackers returns all registered unpackers.
+ */
+const std::vector<const Unpacker *> &unpackers();
+
+/**
+ * @brief The UnpackContext class is shared state of unpacking of one container file.
+ *
+ * Windows of unpacked streams are taken from buffer pool like read buffers of files:
+ * under memory pressure they are shrunk, unpacking stops if even the smallest one
+ * can't be given (@see outOfMemory).
+ */
+class UnpackContext
+{
+public:
+    /**
+     * @param containerSize size of top level container (base for limits.maxRatio).
+     * @param chunkSize size of memory blocks passed to scan callback.
+     * @param overlap bytes count repeated in adjacent blocks (longest sequence size - 1).
+     * @param pool buffer pool of windows of unpacked streams.
+     * @param scan callback scanning blocks of unpacked data.
+     * @param cancelled optional flag which stops unpacking.
+     */
+    UnpackContext(const UnpackLimits &limits, uint64_t containerSize,
+                  uint64_t chunkSize, uint64_t overlap, BufferPool &pool, cb_block scan,
+                  const std::atomic<bool> *cancelled = nullptr);
+
+    /**
+     * @brief createSink creates sink for stream at nesting level depth.
+     * The stream is unpacked if it's known container and depth allows.
+     * @param scanRaw scan stream bytes as is too.
+     */
+    std::unique_ptr<DataSink> createSink(unsigned depth, bool scanRaw);
+
+    /**
+     * @brief account counts unpacked bytes.
+     * @return false if limits are exceeded.
+     */
+    bool account(size_t unpackedBytes);
+
+    bool limitExceeded() const { return m_limitExceeded; }
+
+    /**
+     * @brief outOfMemory window of some stream has not been given by pool.
+     */
+    bool outOfMemory() const { return m_outOfMemory; }
+
+    /**
+     * @brief stopped unpacking should stop: limits are exceeded, memory is out
+     * or request is cancelled.
+     */
+    bool stopped() const
+    {
+        return m_limitExceeded || m_outOfMemory || (m_cancelled != nullptr && m_cancelled->load());
+    }
+
+    /**
+     * @brief acquireWindow takes window of chunkSize + overlap bytes from pool,
+     * it's shrunk down to MIN_WINDOW_CHUNK_SIZE + overlap under memory pressure.
+     * @return empty buffer on failure.
+     */
+    PooledBuffer acquireWindow();
+
+    /**
+     * @brief MIN_WINDOW_CHUNK_SIZE windows are not shrunk below this chunk size.
+     */
+    static const uint64_t MIN_WINDOW_CHUNK_SIZE = 64*1024;
+
+    const UnpackLimits &limits() const { return m_limits; }
+    uint64_t chunkSize() const { return m_chunkSize; }
+    uint64_t overlap() const { return m_overlap; }
+    void scan(MemoryBlock memoryBlock) const { m_scan(memoryBlock); }
+
+private:
+    UnpackLimits m_limits;
+    uint64_t m_maxUnpackedSize;
+    uint64_t m_chunkSize;
+    uint64_t m_overlap;
+    BufferPool &m_pool;
+    cb_block m_scan;
+    const std::atomic<bool> *m_cancelled;
+    std::atomic<uint64_t> m_unpackedSize;
+    std::atomic<bool> m_limitExceeded;
+    std::atomic<bool> m_outOfMemory;
+};
+
+/**
+ * @brief unpackZipFile scans members of zip file in parallel using its central directory.
+ * @param threadsCount number of members unpacked simultaneously: scan callback of context
+ * is called from all of them, so it should not start more threads.
+ * @return false if central directory is not found or not supported.
+ */
+bool unpackZipFile(UnpackContext &context, const std::string &filename, unsigned threadsCount);
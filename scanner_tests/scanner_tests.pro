@@ -9,9 +9,26 @@ CONFIG-= app_bundle
 TEMPLATE = app
 
 SOURCES += scannertest.cpp
+SOURCES += ../scanner_server/aggregator.cpp
+SOURCES += ../scanner_server/bufferpool.cpp
+SOURCES += ../scanner_server/filetype.cpp
 SOURCES += ../scanner_server/manager.cpp
+SOURCES += ../scanner_server/policy.cpp
+SOURCES += ../scanner_server/profiler.cpp
 SOURCES += ../scanner_server/scanner.cpp
+SOURCES += ../scanner_server/signaturestore.cpp
+SOURCES += ../scanner_server/scheduler.cpp
+SOURCES += ../scanner_server/trace.cpp
+SOURCES += ../scanner_server/unpacker.cpp
 
 DEFINES += SRCDIR=\\\"$$PWD/\\\"
 
 INCLUDEPATH += ../scanner_server
+
+LIBS += -lz
+
+# qmake CONFIG+=tsan: build with ThreadSanitizer to check results aggregation
+tsan {
+    QMAKE_CXXFLAGS += -fsanitize=thread -fno-omit-frame-pointer
+    QMAKE_LFLAGS += -fsanitize=thread
+}
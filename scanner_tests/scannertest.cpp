@@ -1,8 +1,195 @@
 #include <manager.h>
+#include <scheduler.h>
+#include <trace.h>
 #include <QString>
 #include <QtTest>
 #include <fstream>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <zlib.h>
+#include <unistd.h>
+
+namespace
+{
+void writeFile(const std::string &filename, const std::string &content)
+{
+    std::ofstream ofs(filename, std::ios::binary);
+    ofs << content;
+}
+
+std::string gzipBytes(const std::string &content)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+    std::string result(deflateBound(&stream, content.size()) + 32, '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(content.data()));
+    stream.avail_in = content.size();
+    stream.next_out = reinterpret_cast<Bytef *>(&result[0]);
+    stream.avail_out = result.size();
+    deflate(&stream, Z_FINISH);
+    result.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result;
+}
+
+std::string tarBytes(const std::string &name, const std::string &content)
+{
+    std::string header(512, '\0');
+    header.replace(0, name.size(), name);
+    char field[16];
+    snprintf(field, sizeof(field), "%011o", static_cast<unsigned>(content.size()));
+    header.replace(124, 11, field);
+    header[156] = '0';
+    header.replace(257, 5, "ustar");
+    header.replace(148, 8, 8, ' ');
+    unsigned checksum = 0;
+    for (auto val : header)
+    {
+        checksum += static_cast<unsigned char>(val);
+    }
+    snprintf(field, sizeof(field), "%06o", checksum);
+    header.replace(148, 7, field, 7);
+
+    std::string data = content;
+    data.resize((content.size() + 511)/512*512, '\0');
+    return header + data + std::string(1024, '\0');
+}
+
+std::string zipStoredBytes(const std::string &name, const std::string &content)
+{
+    auto le = [](uint32_t value, size_t size)
+    {
+        std::string result;
+        for (size_t i = 0; i < size; i ++)
+        {
+            result.push_back(static_cast<char>((value >> (8*i)) & 0xff));
+        }
+        return result;
+    };
+    uint32_t crc = crc32(0, reinterpret_cast<const Bytef *>(content.data()), content.size());
+    uint32_t size = content.size();
+
+    std::string local = le(0x04034b50, 4) + le(10, 2) + le(0, 2) + le(0, 2) + le(0, 4)
+            + le(crc, 4) + le(size, 4) + le(size, 4) + le(name.size(), 2) + le(0, 2) + name;
+    std::string central = le(0x02014b50, 4) + le(10, 2) + le(10, 2) + le(0, 2) + le(0, 2)
+            + le(0, 4) + le(crc, 4) + le(size, 4) + le(size, 4) + le(name.size(), 2)
+            + le(0, 2) + le(0, 2) + le(0, 2) + le(0, 2) + le(0, 4) + le(0, 4) + name;
+    std::string end = le(0x06054b50, 4) + le(0, 2) + le(0, 2) + le(1, 2) + le(1, 2)
+            + le(central.size(), 4) + le(local.size() + content.size(), 4) + le(0, 2);
+    return local + content + central + end;
+}
+
+/**
+ * @brief The ReadMode struct is read path checked by boundary and throughput tests.
+ */
+struct ReadMode
+{
+    const char *name;
+    // 0 means sequential buffered reading, more are parallel pread workers
+    unsigned parallelReaders;
+    // content is scanned in memory by scanBytes instead of file
+    bool inMemory;
+};
+
+const ReadMode READ_MODES[] = {{"buffered", 0, false},
+                               {"parallel-2", 2, false},
+                               {"parallel-4", 4, false},
+                               {"memory", 0, true}};
+
+ScannerResults scanByMode(Manager &manager, const ReadMode &mode,
+                          const std::string &filename, const std::string &content)
+{
+    if (mode.inMemory)
+    {
+        return manager.scanBytes(content.data(), content.size());
+    }
+    manager.setParallelReaders(mode.parallelReaders);
+    return manager.scanFile(filename);
+}
+
+std::string randomLetters(std::mt19937 &generator, size_t size)
+{
+    std::uniform_int_distribution<int> letters('a', 'z');
+    std::string result(size, '\0');
+    for (auto &val : result)
+    {
+        val = static_cast<char>(letters(generator));
+    }
+    return result;
+}
+
+/**
+ * @brief boundaryContent content of size bytes with sequences placed at its edges
+ * and around chunk boundaries: ending at boundary, crossing it and starting at it in turn.
+ */
+std::string boundaryContent(uint64_t size, uint64_t chunkSize, const std::vector<ByteSequence> &sequences)
+{
+    std::string content(size, '.');
+    uint64_t cursor = 0;
+    for (size_t i = 0; ; i ++)
+    {
+        const Bytes &bytes = sequences[i % sequences.size()].bytes();
+        const uint64_t length = bytes.size();
+        const uint64_t boundary = (cursor + length + chunkSize - 1)/chunkSize*chunkSize;
+        uint64_t start = i == 0 ? 0 : boundary;
+        if (i > 0 && i % 3 == 1)
+        {
+            start = boundary - length;
+        }
+        else if (i > 0 && i % 3 == 2)
+        {
+            start = boundary - length/2;
+        }
+        if (start + length > size)
+        {
+            break;
+        }
+        content.replace(start, length, bytes);
+        cursor = start + length + 1;
+    }
+
+    const Bytes &last = sequences.back().bytes();
+    if (size >= cursor + last.size())
+    {
+        content.replace(size - last.size(), last.size(), last);
+    }
+    return content;
+}
+
+/**
+ * @brief containedGuids GUIDs of sequences found in content by plain search.
+ */
+std::set<Guid> containedGuids(const std::vector<ByteSequence> &sequences, const std::string &content)
+{
+    std::set<Guid> result;
+    for (const auto &val : sequences)
+    {
+        if (content.find(val.bytes()) != std::string::npos)
+        {
+            result.insert(val.guid());
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief environmentDouble value of environment variable or defaultValue if it's not set.
+ */
+double environmentDouble(const char *name, double defaultValue)
+{
+    const char *value = std::getenv(name);
+    return value != nullptr ? std::atof(value) : defaultValue;
+}
+}
 
 class ScannerTest : public QObject
 {
@@ -12,6 +199,23 @@ public:
 
 private Q_SLOTS:
     void testScanFile();
+    void testSchedulerOrder();
+    void testSchedulerStop();
+    void testScanArchives();
+    void testScanRegions();
+    void testScanPolicy();
+    void testResultsAggregation();
+    void testScanCancellation();
+    void testSignatureStore();
+    void testParallelRead();
+    void testParallelReadScaling();
+    void testProfiling();
+    void testTrace();
+    void testDatabases();
+    void testBufferPool();
+    void testBudgetScheduling();
+    void testChunkBoundaries();
+    void testReadThroughput();
 };
 
 ScannerTest::ScannerTest()
@@ -51,6 +255,1142 @@ void ScannerTest::testScanFile()
         QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
         QVERIFY2(results.error == ResultError::SUCCESS, "Not SUCCESS");
         QVERIFY2(results.results.size() == 1, "size should be 1");
+        QCOMPARE(results.size, uint64_t(fileSize));
+    }
+
+    ScannerResults results = manager.scanFile("not_existing.tmp");
+    QVERIFY(results.error == ResultError::CAN_NOT_OPEN_FILE);
+    QCOMPARE(results.size, uint64_t(0));
+    results = manager.scanBytes(bytes.data(), bytes.size());
+    QCOMPARE(results.size, uint64_t(bytes.size()));
+
+#ifdef __linux__
+    // size of pipe can't be got
+    int pipeFds[2];
+    QVERIFY(pipe(pipeFds) == 0);
+    results = manager.scanFile("/dev/fd/" + std::to_string(pipeFds[0]));
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+    QVERIFY(results.error == ResultError::FILE_READ_ERROR);
+    QCOMPARE(results.size, uint64_t(0));
+#endif
+}
+
+void ScannerTest::testSchedulerOrder()
+{
+    RequestScheduler scheduler(1);
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool released = false;
+    std::string order;
+
+    // occupy the only worker until all requests are queued
+    scheduler.submit("blocker", RequestPriority::NORMAL, [&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return released; });
+    });
+
+    auto task = [&](char name)
+    {
+        return [&, name]()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(name);
+            condition.notify_all();
+        };
+    };
+    scheduler.submit("client1", RequestPriority::NORMAL, task('a'));
+    scheduler.submit("client1", RequestPriority::NORMAL, task('a'));
+    scheduler.submit("client1", RequestPriority::NORMAL, task('a'));
+    scheduler.submit("client2", RequestPriority::NORMAL, task('b'));
+    scheduler.submit("client3", RequestPriority::LOW, task('c'));
+    scheduler.submit("client3", RequestPriority::HIGH, task('C'));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    released = true;
+    condition.notify_all();
+    condition.wait(lock, [&]() { return order.size() == 6; });
+
+    // high priority first, then clients of the same priority by turns
+    QVERIFY2(order == "Cabaac", order.c_str());
+}
+
+void ScannerTest::testSchedulerStop()
+{
+    RequestScheduler scheduler(1);
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool started = false;
+    bool released = false;
+    bool finished = false;
+    int executed = 0;
+    int dropped = 0;
+
+    scheduler.submit("blocker", RequestPriority::NORMAL, [&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        started = true;
+        condition.notify_all();
+        condition.wait(lock, [&]() { return released; });
+        finished = true;
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [&]() { return started; });
+    }
+
+    auto task = [&]()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        executed ++;
+    };
+    auto onDropped = [&]()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropped ++;
+    };
+    scheduler.submit("client1", RequestPriority::NORMAL, task, onDropped);
+    scheduler.submit("client2", RequestPriority::HIGH, task, onDropped);
+    scheduler.submit("client2", RequestPriority::LOW, task);
+
+    // stop waits for the running task
+    std::thread releaser([&]()
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::lock_guard<std::mutex> lock(mutex);
+        released = true;
+        condition.notify_all();
+    });
+    scheduler.stop();
+    releaser.join();
+
+    QVERIFY(finished);
+    QCOMPARE(executed, 0);
+    QCOMPARE(dropped, 2);
+
+    // submitted after stop is dropped at once
+    scheduler.submit("client1", RequestPriority::NORMAL, task, onDropped);
+    QCOMPARE(executed, 0);
+    QCOMPARE(dropped, 3);
+}
+
+void ScannerTest::testScanArchives()
+{
+    std::string filename = "archive.tmp";
+    std::string bytes = "~some@ seq!ueNce12";
+    std::string guid = "concrete_guid";
+    std::vector<ByteSequence> byteSequences{{bytes, guid}};
+    Manager manager(std::move(byteSequences));
+    manager.setChunkSize(50u);
+
+    std::string infected = std::string(1000, '.') + bytes + std::string(1000, '.');
+    std::string clean(2000, '.');
+
+    std::vector<std::string> containers
+    {
+        gzipBytes(infected),
+        gzipBytes(tarBytes("clean.txt", clean) + tarBytes("infected.txt", infected)),
+        zipStoredBytes("infected.gz", gzipBytes(infected)),
+        tarBytes("infected.zip", zipStoredBytes("infected.gz", gzipBytes(infected))),
+    };
+    for (const auto &val : containers)
+    {
+        QVERIFY2(val.find(bytes) == std::string::npos, "Sequence is visible without unpacking");
+
+        writeFile(filename, val);
+        ScannerResults results = manager.scanFile(filename);
+        QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+        QVERIFY2(results.error == ResultError::SUCCESS, "Not SUCCESS");
+        QVERIFY2(results.results.size() == 1, "size should be 1");
+
+        results = manager.scanBytes(val.data(), val.size());
+        QVERIFY2(results.error == ResultError::SUCCESS, "Not SUCCESS");
+        QVERIFY2(results.results.size() == 1, "size should be 1");
+    }
+
+    // nesting deeper than limit isn't unpacked
+    UnpackLimits limits;
+    limits.maxDepth = 1;
+    manager.setUnpackLimits(limits);
+    std::string nested = gzipBytes(gzipBytes(infected));
+    QVERIFY2(manager.scanBytes(nested.data(), nested.size()).results.empty(), "Too deep nesting unpacked");
+
+    // decompression bomb
+    std::string bomb = gzipBytes(std::string(16*1024*1024, '\0') + bytes);
+    ScannerResults results = manager.scanBytes(bomb.data(), bomb.size());
+    QVERIFY2(results.error == ResultError::ARCHIVE_LIMIT_EXCEEDED, "Bomb is not detected");
+
+    // cancelled unpacking stops decompressing instead of scanning nothing to the end
+    std::atomic<bool> cancelled(false);
+    size_t scannedBlocks = 0;
+    BufferPool pool;
+    UnpackContext context(UnpackLimits(), bomb.size(), 1024, 0, pool, [&](MemoryBlock)
+    {
+        scannedBlocks ++;
+        cancelled = true;
+    }, &cancelled);
+    std::string compressed = gzipBytes(std::string(4*1024*1024, '.'));
+    std::unique_ptr<DataSink> sink = context.createSink(0, false);
+    QVERIFY(!sink->write(compressed.data(), compressed.size()));
+    sink->finish();
+    QVERIFY(scannedBlocks > 0);
+    QVERIFY2(scannedBlocks < 4*1024/16, std::to_string(scannedBlocks).c_str());
+}
+
+void ScannerTest::testScanRegions()
+{
+    std::string filename = "regions.tmp";
+    std::string header = "HEADER";
+    std::string tail = "TAIL";
+    std::string middle = "MIDDLE";
+    std::string body = "~some@ seq!ueNce12";
+    std::vector<ByteSequence> byteSequences;
+
+    Anchor anchor;
+    QVERIFY(Anchor::parse("0", anchor));
+    byteSequences.push_back({header, "header_guid", anchor});
+    QVERIFY(Anchor::parse("-4", anchor));
+    byteSequences.push_back({tail, "tail_guid", anchor});
+    QVERIFY(Anchor::parse("1000:-1000", anchor));
+    byteSequences.push_back({middle, "middle_guid", anchor});
+    byteSequences.push_back({body, "body_guid"});
+    QVERIFY(!Anchor::parse("1x", anchor));
+    // offsets are decimal, overflow is error
+    QVERIFY(Anchor::parse("010", anchor));
+    QCOMPARE(anchor.begin, int64_t(10));
+    QVERIFY(Anchor::parse("-010:0100", anchor));
+    QCOMPARE(anchor.begin, int64_t(-10));
+    QCOMPARE(anchor.end, int64_t(100));
+    QVERIFY(!Anchor::parse("0x10", anchor));
+    QVERIFY(!Anchor::parse("99999999999999999999", anchor));
+    QVERIFY(!Anchor::parse("0:-99999999999999999999", anchor));
+    QVERIFY(!Anchor::parse(" 1", anchor));
+    QVERIFY(!Anchor::parse("-9223372036854775808", anchor));
+    QVERIFY(!Anchor::parse("-9223372036854775808:", anchor));
+    QVERIFY(Anchor::parse("-9223372036854775807", anchor));
+    QCOMPARE(anchor.begin, std::numeric_limits<int64_t>::max());
+
+    Manager manager(std::move(byteSequences));
+    manager.setChunkSize(100u);
+
+    auto scan = [&](const std::string &content)
+    {
+        writeFile(filename, content);
+        ScannerResults results = manager.scanFile(filename);
+        std::remove(filename.c_str());
+        ScannerResults bytesResults = manager.scanBytes(content.data(), content.size());
+        return results.results == bytesResults.results ? results.results.size() : size_t(100);
+    };
+
+    std::string content(5000, '.');
+    content.replace(0, header.size(), header);
+    content.replace(content.size() - tail.size(), tail.size(), tail);
+    content.replace(2500, middle.size(), middle);
+    content.replace(3000, body.size(), body);
+    QCOMPARE(scan(content), size_t(4));
+
+    // anchored sequences out of their regions
+    content.assign(5000, '.');
+    content.replace(1, header.size(), header);
+    content.replace(content.size() - tail.size() - 1, tail.size(), tail);
+    content.replace(500, middle.size(), middle);
+    content.replace(4500, middle.size(), middle);
+    QCOMPARE(scan(content), size_t(0));
+}
+
+void ScannerTest::testScanPolicy()
+{
+    std::string peSequence = "pe only sequence";
+    std::string bodySequence = "~some@ seq!ueNce12";
+    FileTypeMask fileTypes;
+    QVERIFY(parseFileTypes("pe", fileTypes));
+    QVERIFY(!parseFileTypes("pe,unknown_type", fileTypes));
+    std::vector<ByteSequence> byteSequences{{peSequence, "pe_guid", Anchor(), fileTypeBit(FileType::PE)},
+                                            {bodySequence, "body_guid"}};
+    Manager manager(std::move(byteSequences));
+    manager.setChunkSize(100u);
+
+    std::string policyFilename = "policy.tmp";
+    writeFile(policyFilename, "# test policy\n"
+                              "headersize 1K\n"
+                              "skip ext=mp4,MKV\n"
+                              "headers type=png maxsize=1M\n");
+    ScanPolicy policy;
+    QVERIFY(policy.load(policyFilename));
+    QVERIFY2(std::remove(policyFilename.c_str()) == 0, "File remove error!");
+    QCOMPARE(policy.headerSize(), uint64_t(1024));
+    manager.setPolicy(policy);
+
+    auto scan = [&](const std::string &filename, const std::string &content)
+    {
+        writeFile(filename, content);
+        ScannerResults results = manager.scanFile(filename);
+        std::remove(filename.c_str());
+        return results.results.size();
+    };
+
+    std::string png = std::string("\x89PNG\r\n\x1a\n", 8) + std::string(5000, '.');
+    std::string pe = "MZ" + std::string(5000, '.');
+    std::string text(5000, '.');
+
+    QCOMPARE(scan("video.mp4", text + bodySequence), size_t(0));
+    QCOMPARE(scan("video.mkv", text + bodySequence), size_t(0));
+    QCOMPARE(scan("video.txt", text + bodySequence), size_t(1));
+    QCOMPARE(scan("image.png", png.substr(0, 100) + bodySequence + png), size_t(1));
+    QCOMPARE(scan("image.png", png + bodySequence), size_t(0));
+    QCOMPARE(scan("image.bin", png + bodySequence), size_t(0));
+    QCOMPARE(scan("text.png", text + bodySequence), size_t(1));
+    QCOMPARE(scan("program.exe", pe + peSequence), size_t(1));
+    QCOMPARE(scan("program.txt", text + peSequence), size_t(0));
+
+    // skipped files take no read buffer: they are skipped under exhausted budget too
+    manager.setMemoryBudget(1024, BudgetPolicy::REJECT);
+    PooledBuffer held = manager.bufferPool().reserve(1024);
+    const uint64_t peak = manager.bufferPool().status().peak;
+    writeFile("video.mp4", text + bodySequence);
+    writeFile("video.txt", text + bodySequence);
+    ScannerResults results = manager.scanFile("video.mp4");
+    QVERIFY(results.error == ResultError::SUCCESS);
+    QVERIFY(results.results.empty());
+    QCOMPARE(manager.bufferPool().status().peak, peak);
+    QCOMPARE(manager.bufferPool().status().rejected, uint64_t(0));
+    QVERIFY(manager.scanFile("video.txt").error == ResultError::OUT_OF_MEMORY);
+    std::remove("video.mp4");
+    std::remove("video.txt");
+}
+
+void ScannerTest::testResultsAggregation()
+{
+    // every scanner searches the whole data: hits are spread over it and some sequences are absent,
+    // so no scanner finishes early and found ones are marked by all threads simultaneously
+    const size_t sequencesCount = 128;
+    const size_t absentEvery = 4;
+    const size_t dataSize = 1024*1024;
+    // speedup of N threads should reach this part of min(N, cores), 0 disables the check
+    const double efficiency = environmentDouble("SCANNER_SCALING_EFFICIENCY", 0.5);
+    const int runs = 3;
+
+    std::vector<ByteSequence> byteSequences;
+    std::string data(dataSize, '.');
+    size_t presentCount = 0;
+    for (size_t i = 0; i < sequencesCount; i ++)
+    {
+        std::string bytes = "<" + std::to_string(i) + ">";
+        byteSequences.push_back({bytes, "guid" + std::to_string(i)});
+        if (i%absentEvery != 0)
+        {
+            data.replace((i + 1)*(dataSize/(sequencesCount + 1)), bytes.size(), bytes);
+            presentCount ++;
+        }
+    }
+
+    std::string filename = "aggregation.tmp";
+    writeFile(filename, data);
+
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    double singleThreadTime = 0;
+    for (unsigned threadsCount : {1u, 2u, 4u, 8u})
+    {
+        Manager manager(std::vector<ByteSequence>(byteSequences), threadsCount);
+        manager.setChunkSize(64*1024);
+
+        double best = 0;
+        for (int i = 0; i < runs; i ++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            ScannerResults bytesResults = manager.scanBytes(data.data(), data.size());
+            ScannerResults fileResults = manager.scanFile(filename);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = i == 0 ? elapsed.count() : std::min(best, elapsed.count());
+
+            QVERIFY(bytesResults.error == ResultError::SUCCESS);
+            QVERIFY(fileResults.error == ResultError::SUCCESS);
+            QCOMPARE(bytesResults.results.size(), presentCount);
+            QCOMPARE(fileResults.results.size(), presentCount);
+        }
+        if (threadsCount == 1)
+        {
+            singleThreadTime = best;
+        }
+
+        const double speedup = singleThreadTime/std::max(best, 1e-6);
+        const double ideal = std::min(threadsCount, cores);
+        qDebug() << "Threads:" << threadsCount << "time:" << best*1000 << "ms, speedup:" << speedup
+                 << "of" << ideal;
+        const std::string message = "speedup " + std::to_string(speedup) + " of " + std::to_string(threadsCount)
+                + " threads is below " + std::to_string(efficiency) + " of " + std::to_string(ideal);
+        QVERIFY2(speedup >= efficiency*ideal, message.c_str());
+    }
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testScanCancellation()
+{
+    const uint64_t chunkSize = 64*1024;
+    const size_t fileSize = 64*chunkSize;
+    std::string firstSequence = "first#sequence";
+    std::string lastSequence = "last#sequence";
+    std::vector<ByteSequence> byteSequences{{firstSequence, "first_guid"},
+                                            {lastSequence, "last_guid"}};
+    Manager manager(std::move(byteSequences), 2);
+    manager.setChunkSize(chunkSize);
+
+    std::string content(fileSize, '.');
+    content.replace(10, firstSequence.size(), firstSequence);
+    content.replace(fileSize - lastSequence.size(), lastSequence.size(), lastSequence);
+    std::string filename = "cancellation.tmp";
+    writeFile(filename, content);
+
+    // progress is reported after every chunk up to file size
+    std::vector<uint64_t> progress;
+    ScanControl control;
+    control.onProgress = [&](uint64_t bytesDone, uint64_t bytesTotal)
+    {
+        QCOMPARE(bytesTotal, uint64_t(fileSize));
+        progress.push_back(bytesDone);
+    };
+    ScannerResults results = manager.scanFile(filename, control);
+    QVERIFY(results.error == ResultError::SUCCESS);
+    QCOMPARE(results.results.size(), size_t(2));
+    QCOMPARE(progress.size(), size_t(fileSize/chunkSize));
+    QVERIFY(std::is_sorted(progress.begin(), progress.end()));
+    QCOMPARE(progress.back(), uint64_t(fileSize));
+
+    // cancelled in the middle: partial results
+    progress.clear();
+    ScanControl cancelledControl;
+    cancelledControl.onProgress = [&](uint64_t bytesDone, uint64_t)
+    {
+        progress.push_back(bytesDone);
+        if (bytesDone >= 4*chunkSize)
+        {
+            cancelledControl.cancelled = true;
+        }
+    };
+    results = manager.scanFile(filename, cancelledControl);
+    QVERIFY(results.error == ResultError::CANCELLED);
+    QCOMPARE(results.results.size(), size_t(1));
+    QCOMPARE(*results.results.begin(), Guid("first_guid"));
+    QCOMPARE(progress.size(), size_t(4));
+
+    // cancelled before start
+    results = manager.scanFile(filename, cancelledControl);
+    QVERIFY(results.error == ResultError::CANCELLED);
+    QVERIFY(results.results.empty());
+
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testSignatureStore()
+{
+    // duplicates, prefixes and suffixes share bytes, GUIDs are interned
+    std::vector<ByteSequence> byteSequences{{"abcdef", "whole_guid"},
+                                            {"abc", "prefix_guid"},
+                                            {"def", "suffix_guid"},
+                                            {"abcdef", "whole_guid"},
+                                            {"xyz", "other_guid", Anchor()}};
+    Manager manager(std::move(byteSequences), 2);
+    QVERIFY(byteSequences.empty());
+    const SignatureFootprint &footprint = manager.signatureFootprint();
+    QCOMPARE(footprint.sequencesCount, uint64_t(5));
+    QCOMPARE(footprint.guidsCount, uint64_t(4));
+    QCOMPARE(footprint.sequencesBytes, uint64_t(21));
+    QCOMPARE(footprint.storedBytes, uint64_t(9));
+    QCOMPARE(footprint.sharedSequences, uint64_t(3));
+
+    std::string data = "..abc..def..abcdef..xyz";
+    ScannerResults results = manager.scanBytes(data.data(), data.size());
+    QCOMPARE(results.results, std::set<Guid>({"whole_guid", "prefix_guid", "suffix_guid", "other_guid"}));
+    data = "..abcde..bcdef..";
+    results = manager.scanBytes(data.data(), data.size());
+    QCOMPARE(results.results, std::set<Guid>({"prefix_guid", "suffix_guid"}));
+
+    // sequences in families with common prefixes, GUID per 4 sequences
+    const size_t familySize = 64;
+    const size_t sequencesCount = 64*familySize;
+    char guid[64];
+    for (size_t i = 0; i < sequencesCount; i ++)
+    {
+        std::string bytes = "family-" + std::to_string(i/familySize) + "-header-bytes";
+        if (i%familySize != 0)
+        {
+            bytes += "-variant-" + std::to_string(i%familySize);
+        }
+        snprintf(guid, sizeof(guid), "{6f1c0000-0000-4000-8000-%012zx}", i/4);
+        byteSequences.push_back({bytes, guid});
+    }
+    Manager bigManager(std::move(byteSequences), 4);
+    const SignatureFootprint &bigFootprint = bigManager.signatureFootprint();
+    qDebug() << sequencesCount << "sequences footprint before:" << bigFootprint.before
+             << "bytes, after:" << bigFootprint.after << "bytes";
+    QCOMPARE(bigFootprint.sequencesCount, uint64_t(sequencesCount));
+    QCOMPARE(bigFootprint.guidsCount, uint64_t(sequencesCount/4));
+    // family header and variants 1-6 are prefixes of others
+    QCOMPARE(bigFootprint.sharedSequences, uint64_t(sequencesCount/familySize*7));
+    QVERIFY(bigFootprint.after*2 < bigFootprint.before);
+
+    data = "..family-37-header-bytes-variant-5..";
+    results = bigManager.scanBytes(data.data(), data.size());
+    QCOMPARE(results.results, std::set<Guid>({"{6f1c0000-0000-4000-8000-000000000250}",
+                                              "{6f1c0000-0000-4000-8000-000000000251}"}));
+}
+
+void ScannerTest::testParallelRead()
+{
+    const uint64_t chunkSize = 1000;
+    const size_t chunksCount = 37;
+    std::vector<std::string> sequences;
+    std::vector<ByteSequence> byteSequences;
+    for (size_t i = 1; i < chunksCount; i ++)
+    {
+        // sequence crosses boundary of chunks i - 1 and i at different places
+        sequences.push_back("<boundary#" + std::to_string(i) + ">");
+        byteSequences.push_back({sequences.back(), "guid" + std::to_string(i)});
+    }
+    Manager manager(std::move(byteSequences), 2);
+    manager.setChunkSize(chunkSize);
+
+    std::string content(chunkSize*chunksCount, '.');
+    for (size_t i = 1; i < chunksCount; i ++)
+    {
+        size_t shift = i%sequences[i - 1].size();
+        content.replace(i*chunkSize - shift, sequences[i - 1].size(), sequences[i - 1]);
+    }
+    std::string filename = "parallel.tmp";
+    writeFile(filename, content);
+
+    for (unsigned readers : {0u, 2u, 3u, 8u, 64u})
+    {
+        manager.setParallelReaders(readers);
+        uint64_t lastProgress = 0;
+        ScanControl control;
+        control.onProgress = [&lastProgress](uint64_t bytesDone, uint64_t)
+        {
+            lastProgress = bytesDone;
+        };
+        ScannerResults results = manager.scanFile(filename, control);
+        QVERIFY(results.error == ResultError::SUCCESS);
+        QCOMPARE(results.results.size(), chunksCount - 1);
+        QCOMPARE(lastProgress, uint64_t(content.size()));
+    }
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testParallelReadScaling()
+{
+    // file on the device to measure (uncached), generated one is read from page cache
+    const char *benchmarkFile = std::getenv("SCANNER_READ_BENCHMARK_FILE");
+    // rate of the most readers should reach this part of sequential reading, 0 disables the check
+    const double speedup = environmentDouble("SCANNER_READERS_SPEEDUP", 0.5);
+    const int runs = 3;
+
+    std::vector<ByteSequence> byteSequences;
+    for (int i = 0; i < 8; i ++)
+    {
+        // absent sequences: the whole file is scanned
+        byteSequences.push_back({"<absent#" + std::to_string(i) + ">", "guid" + std::to_string(i)});
+    }
+    Manager manager(std::move(byteSequences));
+    manager.setChunkSize(256*1024);
+
+    std::string filename = "scaling.tmp";
+    if (benchmarkFile != nullptr)
+    {
+        filename = benchmarkFile;
+    }
+    else
+    {
+        writeFile(filename, std::string(8*1024*1024, '.'));
+    }
+
+    std::map<unsigned, double> rates;
+    for (unsigned readers : {0u, 2u, 4u, 8u})
+    {
+        manager.setParallelReaders(readers);
+        double best = 0;
+        for (int i = 0; i < runs; i ++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            ScannerResults results = manager.scanFile(filename);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            QVERIFY(results.error == ResultError::SUCCESS);
+            best = std::max(best, results.size/(1024.0*1024.0)/std::max(elapsed.count(), 1e-6));
+        }
+        rates[readers] = best;
+        qDebug() << "Parallel readers:" << readers << "throughput:" << best << "MB/s";
+    }
+    if (benchmarkFile == nullptr)
+    {
+        QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+    }
+
+    const std::string message = "8 readers: " + std::to_string(rates[8]) + " MB/s is below "
+            + std::to_string(speedup) + " of sequential " + std::to_string(rates[0]) + " MB/s";
+    QVERIFY2(rates[8] >= speedup*rates[0], message.c_str());
+}
+
+void ScannerTest::testProfiling()
+{
+    const uint64_t chunkSize = 1000;
+    const size_t chunksCount = 10;
+    Manager manager({{"<profiled>", "guid1"}, {"<unknown>", "guid2"}}, 2);
+    manager.setChunkSize(chunkSize);
+
+    std::string content(chunkSize*chunksCount, '.');
+    content.replace(content.size()/2, 10, "<profiled>");
+    std::string filename = "profile.tmp";
+    writeFile(filename, content);
+
+    // per request profile: global one is disabled
+    ScanProfile profile;
+    ScanControl control;
+    control.profile = &profile;
+    ScannerResults results = manager.scanFile(filename, control);
+    QCOMPARE(results.results.size(), size_t(1));
+    QVERIFY(profile.phase(ProfilePhase::READ).calls > chunksCount);
+    QCOMPARE(profile.phase(ProfilePhase::SCAN).calls, uint64_t(2*chunksCount));
+    QCOMPARE(manager.profile().phase(ProfilePhase::SCAN).calls, uint64_t(0));
+
+    // counters may be forbidden by system: then they're reported as n/a
+    PhaseCounters scan = profile.phase(ProfilePhase::SCAN);
+    const size_t cycles = static_cast<size_t>(HardwareCounter::CYCLES);
+    QVERIFY(!scan.available[cycles] || scan.values[cycles] > 0);
+    std::string report = profile.report();
+    QVERIFY(report.find("read") != std::string::npos);
+    QVERIFY(report.find("scan") != std::string::npos);
+    QVERIFY(report.find("cycles") != std::string::npos);
+
+    // global profile accumulates all requests: scanBytes measures both scanners
+    // and anchored sequences
+    manager.setProfiling(true);
+    manager.scanFile(filename);
+    manager.scanBytes(content.data(), content.size());
+    const uint64_t scanCalls = 2*chunksCount + 3;
+    QCOMPARE(manager.profile().phase(ProfilePhase::SCAN).calls, scanCalls);
+    manager.setProfiling(false);
+    manager.scanFile(filename);
+    QCOMPARE(manager.profile().phase(ProfilePhase::SCAN).calls, scanCalls);
+    manager.profile().reset();
+    QCOMPARE(manager.profile().phase(ProfilePhase::READ).calls, uint64_t(0));
+
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testTrace()
+{
+    QCOMPARE(contentHash("", 0), uint64_t(0xcbf29ce484222325ULL));
+    QCOMPARE(contentHash("a", 1), uint64_t(0xaf63dc4c8601ec8cULL));
+
+    std::string content = "content of traced file";
+    std::string filename = "trace_content.tmp";
+    writeFile(filename, content);
+    QCOMPARE(fileContentHash(filename), contentHash(content.data(), content.size()));
+    QCOMPARE(fileContentHash("not_existing.tmp"), uint64_t(0));
+
+    TraceRecord record;
+    record.method = TraceMethod::SCAN_BYTES;
+    record.priority = RequestPriority::HIGH;
+    record.size = content.size();
+    record.error = ResultError::CANCELLED;
+    record.resultsCount = 3;
+    record.contentHash = fileContentHash(filename);
+
+    // clients are numbered in order of appearance, times are relative to trace start
+    std::string traceFilename = "trace.tmp";
+    TraceRecorder recorder;
+    recorder.record("client", TraceRecorder::now(), TraceRecorder::now(), record);
+    QVERIFY(!recorder.isRecording());
+    QVERIFY(recorder.start(traceFilename, true));
+    QVERIFY(recorder.hashesContent());
+    const auto started = TraceRecorder::now() + std::chrono::milliseconds(5);
+    recorder.record(":1.20", started, started + std::chrono::microseconds(1500), record);
+    record.method = TraceMethod::SCAN_FILE;
+    record.priority = RequestPriority::LOW;
+    recorder.record(":1.10", started, started, record);
+    recorder.record(":1.20", started, started, record);
+    recorder.stop();
+    recorder.record(":1.30", started, started, record);
+
+    std::vector<TraceRecord> records;
+    QVERIFY(loadTrace(traceFilename, records));
+    QCOMPARE(records.size(), size_t(3));
+    QVERIFY(records[0].method == TraceMethod::SCAN_BYTES);
+    QVERIFY(records[0].priority == RequestPriority::HIGH);
+    QVERIFY(records[0].startMicroseconds >= 5000);
+    QCOMPARE(records[0].latencyMicroseconds, uint64_t(1500));
+    QCOMPARE(records[0].size, uint64_t(content.size()));
+    QVERIFY(records[0].error == ResultError::CANCELLED);
+    QCOMPARE(records[0].resultsCount, uint32_t(3));
+    QCOMPARE(records[0].contentHash, contentHash(content.data(), content.size()));
+    QVERIFY(records[1].method == TraceMethod::SCAN_FILE);
+    QVERIFY(records[1].priority == RequestPriority::LOW);
+    QCOMPARE(records[0].client, uint32_t(0));
+    QCOMPARE(records[1].client, uint32_t(1));
+    QCOMPARE(records[2].client, uint32_t(0));
+
+    // long request received first is written after short ones received later
+    QVERIFY(recorder.start(traceFilename, false));
+    const auto first = TraceRecorder::now();
+    recorder.record(":1.10", first + std::chrono::milliseconds(20), first + std::chrono::milliseconds(30), record);
+    recorder.record(":1.20", first + std::chrono::milliseconds(10), first + std::chrono::milliseconds(40), record);
+    recorder.record(":1.30", first, first + std::chrono::milliseconds(50), record);
+    recorder.record(":1.40", first + std::chrono::milliseconds(20), first + std::chrono::milliseconds(60), record);
+    recorder.stop();
+    QVERIFY(loadTrace(traceFilename, records));
+    QCOMPARE(records.size(), size_t(4));
+    QVERIFY(records[0].startMicroseconds > records[2].startMicroseconds);
+    sortByArrival(records);
+    QCOMPARE(records[0].client, uint32_t(2));
+    QCOMPARE(records[1].client, uint32_t(1));
+    // the same receiving time keeps order of file
+    QCOMPARE(records[2].client, uint32_t(0));
+    QCOMPARE(records[3].client, uint32_t(3));
+    QCOMPARE(records[3].latencyMicroseconds, uint64_t(40000));
+
+    TraceRecord parsed;
+    QVERIFY(parseTraceRecord(formatTraceRecord(records[1]), parsed));
+    QCOMPARE(formatTraceRecord(parsed), formatTraceRecord(records[1]));
+    QVERIFY(!parseTraceRecord("scanFile\t0\t7\t0\t0\t0\t0\t0\t0000000000000000", parsed));
+    QVERIFY(!parseTraceRecord("scanDirectory\t0\t1\t0\t0\t0\t0\t0\t0000000000000000", parsed));
+    QVERIFY(!parseTraceRecord("scanFile\t0\t1\t0", parsed));
+
+    std::vector<uint64_t> latencies;
+    for (uint64_t i = 100; i > 0; i --)
+    {
+        latencies.push_back(i);
+    }
+    LatencySummary summary = summarizeLatencies(latencies);
+    QCOMPARE(summary.count, uint64_t(100));
+    QCOMPARE(summary.mean, uint64_t(50));
+    QCOMPARE(summary.p50, uint64_t(50));
+    QCOMPARE(summary.p90, uint64_t(90));
+    QCOMPARE(summary.p99, uint64_t(99));
+    QCOMPARE(summary.max, uint64_t(100));
+    QCOMPARE(summarizeLatencies({7}).p99, uint64_t(7));
+    QCOMPARE(summarizeLatencies({}).count, uint64_t(0));
+
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+    QVERIFY2(std::remove(traceFilename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testDatabases()
+{
+    // the shared sequence is stored once, duplicate inside database is kept
+    Anchor anchor;
+    QVERIFY(Anchor::parse("0", anchor));
+    std::vector<SignatureDatabase> databases{{"a", {{"shared", "shared_guid"},
+                                                    {"only_a", "a_guid"},
+                                                    {"only_a", "a_guid"}}},
+                                             {"b", {{"shared", "shared_guid"},
+                                                    {"only_b", "b_guid"},
+                                                    {"head", "head_guid", anchor}}},
+                                             {"a", {{"ignored", "ignored_guid"}}}};
+    Manager manager(std::move(databases), 2);
+    QCOMPARE(manager.databaseNames(), std::vector<std::string>({"a", "b"}));
+    QCOMPARE(manager.signatureFootprint().sequencesCount, uint64_t(5));
+
+    DatabaseMask maskA = 0;
+    DatabaseMask maskB = 0;
+    DatabaseMask maskAll = 0;
+    QVERIFY(manager.databaseMask("a", maskA));
+    QVERIFY(manager.databaseMask("b", maskB));
+    QVERIFY(manager.databaseMask("", maskAll));
+    QCOMPARE(maskA, DatabaseMask(1));
+    QCOMPARE(maskB, DatabaseMask(2));
+    QCOMPARE(maskAll, ALL_DATABASES);
+    DatabaseMask mask = 0;
+    QVERIFY(manager.databaseMask("b,a", mask));
+    QCOMPARE(mask, maskA | maskB);
+    QVERIFY(!manager.databaseMask("a,c", mask));
+    QVERIFY(!manager.databaseMask("a,,b", mask));
+
+    std::string data = "head..shared..only_a..only_b..ignored";
+    ScannerResults results = manager.scanBytes(data.data(), data.size(), maskA);
+    QCOMPARE(results.results, std::set<Guid>({"shared_guid", "a_guid"}));
+    results = manager.scanBytes(data.data(), data.size(), maskB);
+    QCOMPARE(results.results, std::set<Guid>({"shared_guid", "b_guid", "head_guid"}));
+    results = manager.scanBytes(data.data(), data.size());
+    QCOMPARE(results.results, std::set<Guid>({"shared_guid", "a_guid", "b_guid", "head_guid"}));
+
+    // results of every requested database are got by the same pass
+    DatabaseResults databaseResults;
+    manager.scanBytes(data.data(), data.size(), ALL_DATABASES, &databaseResults);
+    QCOMPARE(databaseResults.size(), size_t(2));
+    QCOMPARE(databaseResults["a"], std::set<Guid>({"shared_guid", "a_guid"}));
+    QCOMPARE(databaseResults["b"], std::set<Guid>({"shared_guid", "b_guid", "head_guid"}));
+    databaseResults.clear();
+    data = "..only_b..";
+    manager.scanBytes(data.data(), data.size(), maskA, &databaseResults);
+    QCOMPARE(databaseResults.size(), size_t(1));
+    QVERIFY(databaseResults["a"].empty());
+
+    std::string filename = "databases.tmp";
+    writeFile(filename, "head" + std::string(1000, '.') + "only_a" + std::string(1000, '.') + "shared");
+    manager.setChunkSize(256);
+    ScanControl control;
+    control.databases = maskB;
+    control.databaseResults = &databaseResults;
+    databaseResults.clear();
+    results = manager.scanFile(filename, control);
+    QVERIFY(results.error == ResultError::SUCCESS);
+    QCOMPARE(results.results, std::set<Guid>({"shared_guid", "head_guid"}));
+    QCOMPARE(databaseResults.size(), size_t(1));
+    QCOMPARE(databaseResults["b"], results.results);
+    control.databases = maskA;
+    control.databaseResults = nullptr;
+    results = manager.scanFile(filename, control);
+    QCOMPARE(results.results, std::set<Guid>({"shared_guid", "a_guid"}));
+
+    // sequences without database name make the default database
+    Manager single(std::vector<ByteSequence>{{"abc", "abc_guid"}}, 1);
+    QCOMPARE(single.databaseNames(), std::vector<std::string>({DEFAULT_DATABASE_NAME}));
+    QVERIFY(single.databaseMask(DEFAULT_DATABASE_NAME, mask));
+    QVERIFY(!single.databaseMask("a", mask));
+
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testBufferPool()
+{
+    // buffers are shrunk down to minimal size under pressure
+    BufferPool pool(100, BudgetPolicy::REJECT);
+    PooledBuffer first = pool.acquire(60, 10);
+    QCOMPARE(first.size(), uint64_t(60));
+    PooledBuffer second = pool.acquire(60, 10);
+    QCOMPARE(second.size(), uint64_t(30));
+    QVERIFY(!pool.acquire(60, 20));
+    QVERIFY(!pool.reserve(20));
+    PooledBuffer reservation = pool.reserve(10);
+    QVERIFY(reservation);
+    QVERIFY(reservation.data() == nullptr);
+    BufferPoolStatus status = pool.status();
+    QCOMPARE(status.inUse, uint64_t(100));
+    QCOMPARE(status.buffersInUse, uint64_t(2));
+    QCOMPARE(status.shrunk, uint64_t(1));
+    QCOMPARE(status.rejected, uint64_t(2));
+
+    // released buffers are reused, cached ones are freed for other sizes
+    char *data = first.data();
+    first.release();
+    QCOMPARE(pool.status().cached, uint64_t(60));
+    first = pool.acquire(60, 60);
+    QVERIFY(first.data() == data);
+    first.release();
+    PooledBuffer other = pool.acquire(50, 50);
+    QVERIFY(other);
+    QCOMPARE(pool.status().cached, uint64_t(0));
+    other.release();
+    reservation.release();
+    second.release();
+    QCOMPARE(pool.status().inUse, uint64_t(0));
+    QCOMPARE(pool.status().peak, uint64_t(100));
+
+    // blocked request waits for release, cancelled one stops waiting
+    pool.setBudget(100, BudgetPolicy::BLOCK);
+    QVERIFY(!pool.acquire(200, 150));
+    first = pool.acquire(100, 100);
+    std::atomic<bool> cancelled(false);
+    PooledBuffer waited;
+    std::thread waiter([&]()
+    {
+        waited = pool.acquire(80, 80, &cancelled);
+    });
+    while (pool.status().waiting == 0)
+    {
+        std::this_thread::yield();
+    }
+    first.release();
+    waiter.join();
+    QCOMPARE(waited.size(), uint64_t(80));
+    QCOMPARE(pool.status().blocked, uint64_t(1));
+    bool cancelledAcquired = true;
+    std::thread cancelledWaiter([&]()
+    {
+        cancelledAcquired = static_cast<bool>(pool.acquire(80, 80, &cancelled));
+    });
+    while (pool.status().waiting == 0)
+    {
+        std::this_thread::yield();
+    }
+    cancelled = true;
+    cancelledWaiter.join();
+    QVERIFY(!cancelledAcquired);
+    waited.release();
+    QVERIFY(pool.report().find("blocked = 2") != std::string::npos);
+
+    // chunks of file are shrunk to fit budget, sequences on chunk borders are found
+    std::vector<ByteSequence> byteSequences{{"border", "border_guid"}, {"tail", "tail_guid"}};
+    Manager manager(std::move(byteSequences), 2);
+    const uint64_t chunkSize = 4*Manager::MIN_CHUNK_SIZE;
+    manager.setChunkSize(chunkSize);
+    manager.setMemoryBudget(chunkSize, BudgetPolicy::REJECT);
+    std::string content(3*Manager::MIN_CHUNK_SIZE, '.');
+    content.replace(2*Manager::MIN_CHUNK_SIZE - 3, 6, "border");
+    content.replace(content.size() - 4, 4, "tail");
+    std::string filename = "buffer_pool.tmp";
+    writeFile(filename, content);
+    PooledBuffer held = manager.bufferPool().reserve(chunkSize/2);
+    ScannerResults results = manager.scanFile(filename);
+    QVERIFY(results.error == ResultError::SUCCESS);
+    QCOMPARE(results.results, std::set<Guid>({"border_guid", "tail_guid"}));
+    QCOMPARE(manager.bufferPool().status().shrunk, uint64_t(1));
+
+    // rejected when even minimal chunk doesn't fit
+    PooledBuffer rest = manager.bufferPool().reserve(chunkSize/2 - 1);
+    results = manager.scanFile(filename);
+    QVERIFY(results.error == ResultError::OUT_OF_MEMORY);
+    QVERIFY(results.results.empty());
+    held.release();
+    rest.release();
+    QCOMPARE(manager.bufferPool().status().inUse, uint64_t(0));
+
+    // parallel readers get buffers which fit into budget
+    manager.setChunkSize(Manager::MIN_CHUNK_SIZE/2);
+    manager.setParallelReaders(4);
+    results = manager.scanFile(filename);
+    QCOMPARE(results.results, std::set<Guid>({"border_guid", "tail_guid"}));
+    QVERIFY(manager.bufferPool().status().peak <= chunkSize);
+
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testBudgetScheduling()
+{
+    std::vector<ByteSequence> byteSequences{{"needle", "needle_guid"}};
+    Manager manager(std::move(byteSequences), 1);
+    manager.setChunkSize(Manager::MIN_CHUNK_SIZE);
+    const uint64_t budget = 3*Manager::MIN_CHUNK_SIZE;
+    manager.setMemoryBudget(budget, BudgetPolicy::BLOCK);
+    std::string content(Manager::MIN_CHUNK_SIZE, '.');
+    content.replace(100, 6, "needle");
+    std::string filename = "budget_scheduling.tmp";
+    writeFile(filename, content);
+    const std::string payload = std::string(600, '.') + "needle";
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<ScannerResults> fileResults;
+    std::vector<ScannerResults> bytesResults;
+    auto waitResults = [&](const std::vector<ScannerResults> &results, size_t count)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return condition.wait_for(lock, std::chrono::seconds(10), [&]() { return results.size() >= count; });
+    };
+
+    // the rest of budget fits received payloads, not read buffers
+    PooledBuffer held = manager.bufferPool().reserve(budget - 8*1024);
+    {
+        RequestScheduler scheduler(2);
+        for (int i = 0; i < 2; i ++)
+        {
+            auto control = std::make_shared<ScanControl>();
+            control->onChunk = [&scheduler]()
+            {
+                scheduler.yield(RequestPriority::NORMAL);
+            };
+            scheduler.submit("files", RequestPriority::NORMAL, [&, control]()
+            {
+                ScannerResults results = manager.scanFile(filename, *control);
+                std::lock_guard<std::mutex> lock(mutex);
+                fileResults.push_back(results);
+                condition.notify_all();
+            });
+        }
+        while (manager.bufferPool().status().waiting < 2)
+        {
+            std::this_thread::yield();
+        }
+
+        // payloads are accounted at reception like server does, queued ones run in slots
+        // of waiting file scans and release their memory
+        for (int i = 0; i < 8; i ++)
+        {
+            auto reservation = std::make_shared<PooledBuffer>(manager.bufferPool().tryReserve(payload.size()));
+            QVERIFY(*reservation);
+            scheduler.submit("client" + std::to_string(i), RequestPriority::HIGH, [&, reservation]()
+            {
+                ScannerResults results = manager.scanBytes(payload.data(), payload.size());
+                reservation->release();
+                std::lock_guard<std::mutex> lock(mutex);
+                bytesResults.push_back(results);
+                condition.notify_all();
+            });
+        }
+        QVERIFY(waitResults(bytesResults, 8));
+        for (const auto &val : bytesResults)
+        {
+            QVERIFY(val.error == ResultError::SUCCESS);
+            QCOMPARE(val.results, std::set<Guid>{"needle_guid"});
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            QVERIFY(fileResults.empty());
+        }
+
+        held.release();
+        QVERIFY(waitResults(fileResults, 2));
+        for (const auto &val : fileResults)
+        {
+            QVERIFY(val.error == ResultError::SUCCESS);
+            QCOMPARE(val.results, std::set<Guid>{"needle_guid"});
+        }
+    }
+
+    // waiting of blocked requests is limited
+    manager.bufferPool().setMaxWait(200);
+    held = manager.bufferPool().reserve(budget - 1024);
+    QVERIFY(manager.scanFile(filename).error == ResultError::OUT_OF_MEMORY);
+    QCOMPARE(manager.bufferPool().status().timedOut, uint64_t(1));
+    QVERIFY(!manager.bufferPool().tryReserve(2048));
+    held.release();
+    QCOMPARE(manager.bufferPool().status().inUse, uint64_t(0));
+
+    // unpack windows are taken from the same budget
+    std::string archive = gzipBytes(content);
+    manager.setMemoryBudget(UnpackContext::MIN_WINDOW_CHUNK_SIZE/2, BudgetPolicy::REJECT);
+    ScannerResults results = manager.scanBytes(archive.data(), archive.size());
+    QVERIFY(results.error == ResultError::OUT_OF_MEMORY);
+    manager.setMemoryBudget(budget, BudgetPolicy::REJECT);
+    results = manager.scanBytes(archive.data(), archive.size());
+    QVERIFY(results.error == ResultError::SUCCESS);
+    QCOMPARE(results.results, std::set<Guid>{"needle_guid"});
+    QVERIFY(manager.bufferPool().status().peak <= budget);
+    writeFile(filename, archive);
+    QVERIFY(manager.scanFile(filename).error == ResultError::SUCCESS);
+    QCOMPARE(manager.bufferPool().status().inUse, uint64_t(0));
+
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testChunkBoundaries()
+{
+    std::mt19937 generator(42);
+    std::vector<ByteSequence> byteSequences;
+    for (size_t length : {1u, 2u, 5u, 17u, 64u, 300u})
+    {
+        for (int i = 0; i < 2; i ++)
+        {
+            byteSequences.push_back({randomLetters(generator, length),
+                                     "guid_" + std::to_string(byteSequences.size())});
+        }
+    }
+    // alternate lengths, so long sequences are placed at small chunks too
+    std::vector<ByteSequence> placed;
+    for (size_t i = 0; i < byteSequences.size()/2; i ++)
+    {
+        placed.push_back(byteSequences[i]);
+        placed.push_back(byteSequences[byteSequences.size() - 1 - i]);
+    }
+
+    // files of large chunks are tens of megabytes: they are scanned on request only
+    std::vector<uint64_t> chunkSizes{1, 2, 3, 7, 64, 255, 4096, 65536, 1024*1024};
+    if (std::getenv("SCANNER_BOUNDARY_LARGE_CHUNKS") != nullptr)
+    {
+        chunkSizes.push_back(16*1024*1024);
+    }
+
+    Manager manager(std::vector<ByteSequence>(byteSequences), 2);
+    const std::string filename = "boundaries.tmp";
+    for (uint64_t chunkSize : chunkSizes)
+    {
+        manager.setChunkSize(chunkSize);
+        // smaller chunks get longer files: sequences longer than chunk span several of them
+        const uint64_t sizes[] = {0, 1, chunkSize - 1, chunkSize, chunkSize + 1, 2*chunkSize,
+                                  2*chunkSize + 1, std::min<uint64_t>(4096*chunkSize, 65536) + 3};
+        for (uint64_t size : sizes)
+        {
+            const std::string content = boundaryContent(size, chunkSize, placed);
+            const std::set<Guid> expected = containedGuids(byteSequences, content);
+            writeFile(filename, content);
+            for (const ReadMode &mode : READ_MODES)
+            {
+                ScannerResults results = scanByMode(manager, mode, filename, content);
+                const std::string message = std::string(mode.name) + ": chunk " + std::to_string(chunkSize)
+                        + ", size " + std::to_string(size);
+                QVERIFY2(results.error == ResultError::SUCCESS, message.c_str());
+                QVERIFY2(results.results == expected, message.c_str());
+                QVERIFY2(results.size == size, message.c_str());
+            }
+        }
+    }
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+}
+
+void ScannerTest::testReadThroughput()
+{
+    // fraction of recorded baseline (SCANNER_THROUGHPUT_BASELINE) each read path should reach,
+    // 0 disables the gate; without baseline rates are only reported
+    const double fraction = environmentDouble("SCANNER_THROUGHPUT_FRACTION", 0.25);
+    const uint64_t fileSize = 16*1024*1024;
+    const int runs = 3;
+
+    std::mt19937 generator(7);
+    std::vector<ByteSequence> byteSequences;
+    for (int i = 0; i < 64; i ++)
+    {
+        byteSequences.push_back({randomLetters(generator, 8 + i), "guid_" + std::to_string(i)});
+    }
+    const std::string content = boundaryContent(fileSize, 1024*1024, byteSequences);
+    const std::set<Guid> expected = containedGuids(byteSequences, content);
+    const std::string filename = "throughput.tmp";
+    writeFile(filename, content);
+
+    // the same scanners pool on any machine: rates are comparable with recorded ones
+    const unsigned threadsCount = 2;
+    Manager manager(std::vector<ByteSequence>(byteSequences), threadsCount);
+    manager.setChunkSize(1024*1024);
+    std::map<std::string, double> rates;
+    for (const ReadMode &mode : READ_MODES)
+    {
+        double best = 0;
+        for (int i = 0; i < runs; i ++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            ScannerResults results = scanByMode(manager, mode, filename, content);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            QVERIFY(results.error == ResultError::SUCCESS);
+            QVERIFY2(results.results == expected, mode.name);
+            best = std::max(best, fileSize/(1024.0*1024.0)/std::max(elapsed.count(), 1e-6));
+        }
+        rates[mode.name] = best;
+        qDebug() << "Read path:" << mode.name << "throughput:" << best << "MB/s";
+    }
+    QVERIFY2(std::remove(filename.c_str()) == 0, "File remove error!");
+
+    // baseline is recorded rate of the same path ("path MB/s" lines, @see SCANNER_THROUGHPUT_OUTPUT):
+    // rates of other paths of this run differ too little to catch regressions
+    std::map<std::string, double> baseline;
+    if (const char *baselineFile = std::getenv("SCANNER_THROUGHPUT_BASELINE"))
+    {
+        std::ifstream input(baselineFile);
+        std::string name;
+        double rate;
+        while (input >> name >> rate)
+        {
+            baseline[name] = rate;
+        }
+    }
+    if (const char *outputFile = std::getenv("SCANNER_THROUGHPUT_OUTPUT"))
+    {
+        std::ofstream output(outputFile);
+        for (const auto &val : rates)
+        {
+            output << val.first << "\t" << val.second << "\n";
+        }
+    }
+
+    for (const auto &val : rates)
+    {
+        auto it = baseline.find(val.first);
+        if (it == baseline.end())
+        {
+            continue;
+        }
+        const double reference = it->second;
+        const std::string message = val.first + ": " + std::to_string(val.second) + " MB/s is below "
+                + std::to_string(fraction) + " of " + std::to_string(reference) + " MB/s";
+        QVERIFY2(val.second >= fraction*reference, message.c_str());
     }
 }
 